@@ -8,21 +8,33 @@
  * Actuators send register signal to controller with an actuator type and wait
  * for an acknowledge signal back from the controller.
  *
- * Actuators will wait until a message is sent via the message queue with an
- * action, and then will perform that action by printing it to stdout. Sends
- * Acknowledgment back to controller that action has been processed.
+ * Actuators take their acknowledge, actions and stop from an inbox, a
+ * message queue of their own given to the controller in the init, so they
+ * never wait behind mail for other devices. They will wait until an
+ * action arrives, and then will perform that action by printing it to stdout. Sends
+ * Acknowledgment back to controller that action has been processed, on the
+ * queue of the controller worker that sent the action.
  *
  * If control+C is pressed, the program sends a quit message to the
  * controller to delete it from the registered devices.
  *
+ * An actuator that died comes back under the session token it kept (see
+ * session.h), the controller acknowledging that it resumed.
+ *
  *  Created on: Oct 6, 2015
  *      Author: Nicolas McCallum 100936816
  */
 
 #include <sys/msg.h>
+#include <time.h>
 #include "message.h"
+#include "log.h"
+#include "session.h"
 
 int msgid;
+int inbox = -1;	// Queue of its own the controller sends the actuator's mail to
+int queues[MAXSHARDS];	// Queue of each controller worker, -1 until used
+char *path;
 char running = 1;
 char *name;
 char type;
@@ -46,7 +58,7 @@ void send_init() {
 
     // Wait for ack signal back
     while(1) {
-        if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), getpid(), 0) == -1) {
+        if (msgrcv(inbox, (void *)&msg, sizeof(msg.pinfo), 0, 0) == -1) {
             fprintf(stderr, "Failed during checking the init messages: %d\n", errno);
             exit(3);
         }
@@ -54,25 +66,95 @@ void send_init() {
         // Make sure its the right process
         if (msg.pinfo.data == ACKCODE) {
             printf("[INIT] Received acknowledge signal from controller\n");
+            save_session(path, name, &msg.pinfo);
             break;
         }
     }
 }
 
+/**
+ * Sends an init carrying the session token left by the actuator's last run
+ * so the controller moves it over to this PID, and waits for the
+ * acknowledge like a full registration. A controller that no longer has
+ * the session registers the actuator again instead.
+ *
+ * param token: Session token from the last run.
+ */
+void resume_session(session_token *token) {
+	msg.pinfo.session = token->session;
+	msg.pinfo.handle = token->handle;
+	msg.pinfo.shard = token->shard;
+	msg.pinfo.previous = token->pid;
+
+	send_init();
+	if (msg.pinfo.session == token->session) {
+		printf("[INIT] Resumed session of PID %d with controller\n", token->pid);
+	}
+}
+
+/**
+ * Removes the inbox the actuator's last run made, if it died and left it.
+ * Its mail was for that run, and the queue would otherwise be left in the
+ * kernel for good. It is only removed if the last run is gone and it is
+ * still the user's queue that the last run took its mail from, the inbox
+ * of an actuator of the same name that is still running is left alone.
+ *
+ * param token: Session token from the last run.
+ */
+void drop_old_inbox(session_token *token) {
+	struct msqid_ds ds;
+
+	if (token->inbox == -1 || kill(token->pid, 0) == 0 || errno != ESRCH ||
+			msgctl(token->inbox, IPC_STAT, &ds) == -1) {
+		return;
+	}
+	if (ds.msg_perm.uid == getuid() && ds.msg_lrpid == token->pid &&
+			msgctl(token->inbox, IPC_RMID, 0) == 0) {
+		printf("[INIT] Removed inbox %d left by PID %d\n", token->inbox, token->pid);
+	}
+}
+
+/**
+ * Returns the time from the monotonic clock in microseconds, which the
+ * controller times the action's hops against.
+ */
+long long int now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 /**
  * Sends acknowledge signal back to controller via message queue that
- * the action was performed.
+ * the action was performed. The acknowledge is stamped with the time it
+ * was sent.
  */
 void send_ack() {
-	// Set the type to acknowledge and send to controller
+	// Set the type to acknowledge and send to controller, the correlation ID
+	// from the action is left in the message so the controller can match it
     msg.msg_type = AACKCODE;
+    msg.pinfo.pid = getpid();
     strcpy(msg.pinfo.name, name);
+    msg.pinfo.stamps.ack = now_us();
 
-    if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+    // Connect to the worker's queue the first time it sends an action
+    if (msg.pinfo.shard < 0 || msg.pinfo.shard >= MAXSHARDS) {
+    	msg.pinfo.shard = 0;
+    }
+    if (queues[msg.pinfo.shard] == -1) {
+    	queues[msg.pinfo.shard] = msgget(ftok(path, QUEUEPROJ(msg.pinfo.shard)), 0666);
+    	if (queues[msg.pinfo.shard] == -1) {
+    		fprintf(stderr, "Error connecting to worker %d queue: %d\n", msg.pinfo.shard, errno);
+    		exit(MQGERR);
+    	}
+    }
+
+    if (msgsnd(queues[msg.pinfo.shard], (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
 		fprintf(stderr, "Acknowledge signal failed to be sent\n");
 	    exit(4);
 	}
-    printf("[ACTION] Sent acknowledge signal to controller!\n");
+    log_info("[ACTION] Sent acknowledge signal to controller!\n");
 }
 
 /**
@@ -108,6 +190,7 @@ void signal_handler(int signum) {
 		// Send quit message to the controller
 		msg.msg_type = QUITCODE;
 		msg.pinfo.pid = getpid();
+		msg.pinfo.device = type;
 		if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
 			fprintf(stderr, "[ERROR] Quit signal failed to be sent\n");
 			exit(MQSERR);
@@ -116,6 +199,9 @@ void signal_handler(int signum) {
 }
 
 int main(int argc, char *argv[]) {
+	session_token token;
+	int resume;
+
 	// Check that correct command line args were passed
 	if (argc != 4) {
 		fprintf(stderr, "[ERROR] Actuator takes exactly 3 arguments "
@@ -139,14 +225,28 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Connect to the message queue
-	msgid = msgget(ftok(argv[1], 1), 0666 | IPC_CREAT);
+	path = argv[1];
+	msgid = msgget(ftok(argv[1], MAINPROJ), 0666 | IPC_CREAT);
 	if (msgid == -1) {
 		fprintf(stderr, "[ERROR] Error connecting to message queue: %d\n",
 				errno);
 		exit(MQGERR);
 	}
 	printf("Connecting to message queue: %d, key %d\n",
-			msgid, ftok(argv[1], 1));
+			msgid, ftok(argv[1], MAINPROJ));
+	memset(queues, -1, sizeof(queues));
+	queues[0] = msgid;
+
+	// Make the inbox, once the last run's is out of the way
+	resume = load_session(path, name, &token);
+	if (resume) {
+		drop_old_inbox(&token);
+	}
+	inbox = msgget(IPC_PRIVATE, 0600);
+	if (inbox == -1) {
+		fprintf(stderr, "[ERROR] Error creating inbox: %d\n", errno);
+		exit(MQGERR);
+	}
 
 	// Copy the variables to the message struct
 	strcpy(msg.pinfo.name, name);
@@ -154,28 +254,50 @@ int main(int argc, char *argv[]) {
 	msg.pinfo.data = 0;
 	msg.pinfo.pid = getpid();
 	msg.pinfo.threshold = 0;
+	msg.pinfo.inbox = inbox;
 
-	// Send initialization message to controller and wait for acknowledgment
-	send_init();
+	// Resume the last run's session if it died, otherwise send initialization
+	// message to controller and wait for acknowledgment
+	if (resume) {
+		resume_session(&token);
+	} else {
+		send_init();
+	}
+
+	// Actions are printed through the logger so a slow terminal can't delay the acknowledge
+	if (!log_init()) {
+		exit(INITERR);
+	}
 
 	// Run forever
 	while(running) {
 		// Look for quit message from controller
-		if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), getpid(), 0) == -1) {
+		if (msgrcv(inbox, (void *)&msg, sizeof(msg.pinfo), 0, 0) == -1) {
+			// Control+C already sent the quit
+			if (errno == EINTR && !running) {
+				break;
+			}
 			fprintf(stderr, "[ERROR] Failed during checking the stop message: %d\n", errno);
 			exit(MQRERR);
 		}
 
 		if (msg.pinfo.data == STOPCODE) {
-			printf("[STOPPING] Stop signal received, shutting down...\n");
+			log_info("[STOPPING] Stop signal received, shutting down...\n");
 			break;
+		} else if (msg.pinfo.data == ACKCODE) {
+			// A restarted controller acknowledges the actuator again
+			log_info("[INIT] Received acknowledge signal from controller\n");
+			save_session(path, name, &msg.pinfo);
 		} else {
-			printf("[ACTION] Triggered action \"%s\" caused by PID %d (%s)\n",
+			log_info("[ACTION] Triggered action \"%s\" caused by PID %d (%s)\n",
 					msg.pinfo.action, msg.pinfo.pid, msg.pinfo.name);
 			send_ack();
 		}
 	}
 
+	// Only an actuator that died resumes its session
+	drop_session(path, name);
+	msgctl(inbox, IPC_RMID, 0);
 	exit(0);
 
 }
@@ -0,0 +1,1449 @@
+/*
+ * bench.c
+ *
+ * Measurement tool for the controller. Each mode is given as the first
+ * argument:
+ *
+ *   idle PID [seconds]
+ *       Samples the CPU time of a running process (the controller child)
+ *       from /proc over the given period and prints the percentage of a
+ *       core it used. Run while no device is sending data.
+ *
+ *   wake QUEUE_PATH [rounds] [gap_ms]
+ *       Registers as a temperature sensor and repeatedly leaves the
+ *       controller idle for gap_ms before sending an init message, timing
+ *       how long the acknowledge takes to come back. Prints min/avg/max.
+ *
+ *   register QUEUE_PATH [devices] [in_flight]
+ *       Registers the given number of made up sensors (10000 by default)
+ *       with a running controller the way a restart storm would, keeping
+ *       in_flight inits (32 by default) waiting on their acknowledges, and
+ *       first the way one device at a time would. Then restarts them all
+ *       under new PIDs with the session tokens from their acknowledges, as
+ *       many in flight, and waits for the acknowledges of their resumes.
+ *       Prints the devices per
+ *       second of each. Run against a controller no other device is using.
+ *
+ *   lanes QUEUE_PATH [probes] [flooders]
+ *       Saturates the last worker of a running controller with temperature
+ *       readings from the given number of flooding processes (4 by default)
+ *       and sends it smoke readings over their threshold (50 by default),
+ *       first behind the backlog on its queue and then through its alarm
+ *       lane, registering as the bell they ring. Prints how long the smoke
+ *       readings waited before the worker took them. Needs a controller
+ *       with at least 2 workers.
+ *
+ *   registry [devices]
+ *       Registers, looks up and removes the given number of devices
+ *       (100000 by default) in the controller's registry and prints the
+ *       operations per second of each step.
+ *
+ *   snapshot [devices]
+ *       Registers the given number of devices (100000 by default) in a
+ *       registry, journaling each one to a scratch directory, checkpoints
+ *       the registry, journals a tenth as many again, then restores a new
+ *       registry from the checkpoint and journal. Prints the time of each
+ *       step and checks every device came back in its slot.
+ *
+ *   queues [depth] [receives]
+ *       Times a device taking its mail off a queue by its mailbox, and a
+ *       worker taking a reading off it, while mail for other devices waits
+ *       on the same queue, at depths from 0 up to the given one (10000 by
+ *       default) rising tenfold. Depth 0 is a queue that only holds what
+ *       its reader takes. Prints the nanoseconds per send and receive.
+ *
+ *   transport [frames]
+ *       Sends the given number of frames (200000 by default) from one
+ *       process to another through a message queue, then through the
+ *       shared memory ring, and prints the frames per second of each.
+ *
+ *   store [records]
+ *       Appends the given number of alarms (1000000 by default) from 1000
+ *       devices to a record store in a scratch directory, then queries
+ *       one device over a short time range many times, and prints the
+ *       rate of each.
+ *
+ *   rules [readings]
+ *       Checks the given number of readings (1000000 by default) against
+ *       each kind of alarm rule, one reading at a time and then a full
+ *       batch at a time. Prints the nanoseconds per reading of each.
+ *
+ *   window [readings]
+ *       Adds the given number of readings (1000000 by default) to a
+ *       sensor's sliding window a batch at a time, then reads its
+ *       aggregates many times. Prints the rate of each.
+ *
+ *   limit [sensors] [seconds]
+ *       Simulates the given number of sensors (100 by default) hovering
+ *       around their threshold for the given number of seconds (60 by
+ *       default), each sending a batch of readings every 100ms to one
+ *       actuator. Prints how many alarms the rules raise, how many are left
+ *       after each sensor's quiet period and how many actions the
+ *       actuator's rate limit lets through, with the nanoseconds per reading.
+ *
+ *   codec [readings]
+ *       Encodes the given number of readings (1000000 by default) of one
+ *       device with the store's compressed encoding, once as a sensor
+ *       sends them and once as a slowly changing reading, then decodes
+ *       them. Prints the bytes per reading and the rate of each step.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <limits.h>
+#include <time.h>
+#include "message.h"
+#include "registry.h"
+#include "ring.h"
+#include "store.h"
+#include "codec.h"
+#include "rules.h"
+#include "window.h"
+#include "limit.h"
+#include "metrics.h"
+#include "session.h"
+#include "snapshot.h"
+
+// Made up PIDs of the devices the register mode registers
+#define BENCHPID(i) (1000000000 + (getpid() % 1000) * 1000000 + (i))
+
+// Mail queue of the controller a mode runs against, the bench's devices take their mail there
+int mail;
+
+/**
+ * Returns the monotonic clock in microseconds.
+ */
+double now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Connects to the mail queue of the controller whose queues are at the path.
+ */
+void connect_mail(char *path) {
+	mail = msgget(ftok(path, MAILPROJ), 0666);
+	if (mail == -1) {
+		fprintf(stderr, "[ERROR] Error connecting to mail queue: %d\n", errno);
+		exit(MQGERR);
+	}
+}
+
+/**
+ * Reads the user + system CPU ticks used by a process from /proc.
+ *
+ * param pid: Process to read.
+ * return: CPU ticks used or -1 if the process could not be read.
+ */
+long int read_ticks(pid_t pid) {
+	char path[64], buf[1024], *p;
+	unsigned long int utime, stime;
+	FILE *file;
+
+	sprintf(path, "/proc/%d/stat", pid);
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+	if (fgets(buf, sizeof(buf), file) == NULL) {
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	// Skip past the command name since it may contain spaces
+	p = strrchr(buf, ')');
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+			&utime, &stime) != 2) {
+		return -1;
+	}
+	return utime + stime;
+}
+
+/**
+ * Prints the CPU usage of a process over a sampling period.
+ */
+int bench_idle(int argc, char *argv[]) {
+	pid_t pid;
+	int seconds = 5;
+	long int before, after;
+
+	if (argc < 3) {
+		fprintf(stderr, "[ERROR] idle takes a PID and optional seconds!\n");
+		exit(INITERR);
+	}
+	pid = strtol(argv[2], NULL, 10);
+	if (argc > 3) {
+		seconds = strtol(argv[3], NULL, 10);
+	}
+
+	before = read_ticks(pid);
+	sleep(seconds);
+	after = read_ticks(pid);
+	if (before == -1 || after == -1) {
+		fprintf(stderr, "[ERROR] Could not read CPU time of PID %d\n", pid);
+		exit(INITERR);
+	}
+
+	printf("[IDLE] PID %d used %.2f%% CPU over %ds\n", pid,
+			100.0 * (after - before) / sysconf(_SC_CLK_TCK) / seconds, seconds);
+	return 0;
+}
+
+/**
+ * Times init -> acknowledge round trips against an idle controller.
+ */
+int bench_wake(int argc, char *argv[]) {
+	struct proc_msg msg;
+	int msgid, rounds = 20, gap_ms = 200, i;
+	double start, elapsed, total = 0, min = -1, max = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "[ERROR] wake takes a queue path and optional rounds and gap!\n");
+		exit(INITERR);
+	}
+	if (argc > 3) {
+		rounds = strtol(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		gap_ms = strtol(argv[4], NULL, 10);
+	}
+
+	msgid = msgget(ftok(argv[2], MAINPROJ), 0666);
+	if (msgid == -1) {
+		fprintf(stderr, "[ERROR] Error connecting to message queue: %d\n", errno);
+		exit(MQGERR);
+	}
+	connect_mail(argv[2]);
+
+	memset(&msg, 0, sizeof(msg));
+	strcpy(msg.pinfo.name, "bench");
+	msg.pinfo.device = TEMP_SENSOR_TYPE;
+	msg.pinfo.pid = getpid();
+	msg.pinfo.threshold = INT_MAX;
+	msg.pinfo.inbox = -1;
+
+	for (i = 0; i < rounds; i++) {
+		// Leave the controller idle so it has to be woken up
+		usleep(gap_ms * 1000);
+
+		msg.msg_type = INITCODE;
+		start = now_us();
+		if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed to send init to message queue: %d\n", errno);
+			exit(MQSERR);
+		}
+		if (msgrcv(mail, (void *)&msg, sizeof(msg.pinfo), MBOX(getpid()), 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed waiting for acknowledge: %d\n", errno);
+			exit(MQRERR);
+		}
+		elapsed = now_us() - start;
+
+		total += elapsed;
+		if (min < 0 || elapsed < min) {
+			min = elapsed;
+		}
+		if (elapsed > max) {
+			max = elapsed;
+		}
+	}
+
+	// Unregister so the controller does not keep the bench device
+	msg.msg_type = QUITCODE;
+	msg.pinfo.pid = getpid();
+	msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0);
+
+	printf("[WAKE] %d rounds after %dms idle: min %.1fus, avg %.1fus, max %.1fus\n",
+			rounds, gap_ms, min, total / rounds, max);
+	return 0;
+}
+
+/**
+ * Sends the init of a made up sensor without waiting for room on the queue,
+ * carrying a session token to resume it under a new PID if one is given.
+ *
+ * return: 1 if sent, 0 if the queue is full
+ */
+int send_bench_init(int msgid, pid_t pid, session_token *token) {
+	struct proc_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = INITCODE;
+	sprintf(msg.pinfo.name, "bench%d", pid % 1000000);
+	msg.pinfo.device = TEMP_SENSOR_TYPE;
+	msg.pinfo.pid = pid;
+	msg.pinfo.threshold = INT_MAX;
+	msg.pinfo.inbox = -1;
+	if (token != NULL) {
+		sprintf(msg.pinfo.name, "bench%d", token->pid % 1000000);
+		msg.pinfo.session = token->session;
+		msg.pinfo.handle = token->handle;
+		msg.pinfo.shard = token->shard;
+		msg.pinfo.previous = token->pid;
+	}
+	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), IPC_NOWAIT) == -1) {
+		if (errno == EAGAIN) {
+			return 0;
+		}
+		fprintf(stderr, "[ERROR] Failed to send init to message queue: %d\n", errno);
+		exit(MQSERR);
+	}
+	return 1;
+}
+
+/**
+ * Takes the acknowledge of any made up sensor off the mail queue and keeps
+ * its session token, if it is one of the n devices in tokens numbered from
+ * first. Whatever mail comes first is taken, which only works while no
+ * other device uses the controller.
+ *
+ * return: 1 if an acknowledge was taken, 0 if none was waiting
+ */
+int take_bench_ack(session_token *tokens, int first, int n, int flags) {
+	struct proc_msg msg;
+	int i;
+
+	if (msgrcv(mail, (void *)&msg, sizeof(msg.pinfo), 0, flags) == -1) {
+		if (errno == ENOMSG) {
+			return 0;
+		}
+		fprintf(stderr, "[ERROR] Failed waiting for acknowledge: %d\n", errno);
+		exit(MQRERR);
+	}
+	i = msg.pinfo.pid - BENCHPID(first);
+	if (msg.pinfo.data != ACKCODE || i < 0 || i >= n) {
+		return 0;
+	}
+	tokens[i].session = msg.pinfo.session;
+	tokens[i].handle = msg.pinfo.handle;
+	tokens[i].shard = msg.pinfo.shard;
+	tokens[i].pid = msg.pinfo.pid;
+	return 1;
+}
+
+/**
+ * Registers n devices numbered from first keeping up to in_flight inits
+ * waiting on their acknowledges, and returns the microseconds it took. Like
+ * devices that each wait on their own acknowledge, the bench never blocks
+ * sending while acknowledges it has not taken fill the queue. With resume
+ * each device carries the session token in tokens at its index, which its
+ * acknowledge replaces.
+ */
+double register_storm(int msgid, session_token *tokens, int first, int n, int in_flight, int resume) {
+	double start = now_us();
+	int sent = 0, acked = 0, full = 0;
+
+	while (acked < n) {
+		while (sent < n && sent - acked < in_flight && !full) {
+			if (send_bench_init(msgid, BENCHPID(first + sent), resume ? &tokens[sent] : NULL)) {
+				sent++;
+			} else {
+				full = 1;
+			}
+		}
+
+		// Wait for an acknowledge once no more inits can go out
+		if (take_bench_ack(tokens, first, n, sent < n && sent - acked < in_flight && !full ?
+				IPC_NOWAIT : 0)) {
+			acked++;
+			full = 0;
+		}
+	}
+	return now_us() - start;
+}
+
+/**
+ * Sends the quits of made up sensors.
+ */
+void quit_bench(int msgid, session_token *tokens, int n, int offset) {
+	struct proc_msg msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = QUITCODE;
+	msg.pinfo.device = TEMP_SENSOR_TYPE;
+	for (i = 0; i < n; i++) {
+		msg.pinfo.pid = tokens[i].pid + offset;
+		msg.pinfo.session = tokens[i].session;
+		msg.pinfo.shard = tokens[i].shard;
+		if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed to send quit to message queue: %d\n", errno);
+			exit(MQSERR);
+		}
+	}
+}
+
+/**
+ * Adds up the devices every worker of the controller has resumed.
+ */
+unsigned long long count_resumed(metrics *stats) {
+	unsigned long long resumed = 0;
+	int s;
+
+	for (s = 0; s < stats->nshards; s++) {
+		resumed += stats->workers[s].resumed;
+	}
+	return resumed;
+}
+
+/**
+ * Times registering a storm of devices with a running controller, one at
+ * a time and then many at once, and resuming them all after a restart.
+ */
+int bench_register(int argc, char *argv[]) {
+	session_token *tokens;
+	metrics *stats;
+	unsigned long long before;
+	int n = 10000, in_flight = 32, single, msgid;
+	double us;
+
+	if (argc < 3) {
+		fprintf(stderr, "[ERROR] register takes a queue path and optional devices and in flight!\n");
+		exit(INITERR);
+	}
+	if (argc > 3) {
+		n = strtol(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		in_flight = strtol(argv[4], NULL, 10);
+	}
+	if (n < 1 || n > 100000 || in_flight < 1) {
+		fprintf(stderr, "[ERROR] Devices must be between 1 and 100000 and in flight at least 1!\n");
+		exit(INITERR);
+	}
+
+	msgid = msgget(ftok(argv[2], MAINPROJ), 0666);
+	stats = attach_metrics(ftok(argv[2], METRICSPROJ));
+	if (msgid == -1 || stats == NULL) {
+		fprintf(stderr, "[ERROR] Error connecting to the controller: %d\n", errno);
+		exit(MQGERR);
+	}
+	connect_mail(argv[2]);
+	tokens = malloc(sizeof(session_token) * (n + 1000));
+	if (tokens == NULL) {
+		fprintf(stderr, "[ERROR] Could not allocate %d devices\n", n);
+		exit(MEMERR);
+	}
+
+	// A handshake at a time as each device does it, on a slice of the devices with
+	// PIDs of their own, kept registered until the end so no quit is waiting
+	single = n < 1000 ? n : 1000;
+	us = register_storm(msgid, tokens + n, 2 * n, single, 1, 0);
+	printf("[REGISTER] %d devices one at a time in %.1fms (%.0f devices/s)\n", single, us / 1000,
+			single / (us / 1e6));
+
+	us = register_storm(msgid, tokens, 0, n, in_flight, 0);
+	printf("[REGISTER] %d devices %d at a time in %.1fms (%.0f devices/s)\n", n, in_flight,
+			us / 1000, n / (us / 1e6));
+
+	// Every device restarts under a new PID and resumes with its token
+	before = count_resumed(stats);
+	us = register_storm(msgid, tokens, n, n, in_flight, 1);
+	printf("[REGISTER] %llu of %d devices resumed in %.1fms (%.0f devices/s)\n",
+			count_resumed(stats) - before, n, us / 1000, (count_resumed(stats) - before) / (us / 1e6));
+
+	// Unregister so the controller does not keep the bench devices
+	quit_bench(msgid, tokens, n, 0);
+	quit_bench(msgid, tokens + n, n < 1000 ? n : 1000, 0);
+	shmdt(stats);
+	free(tokens);
+	return 0;
+}
+
+// Made up PID the smoke readings of the lanes mode come from
+#define LANEPID BENCHPID(999999)
+
+// Microseconds between the lanes mode's smoke readings, under the bell's rate limit
+#define PROBEGAP 150000
+
+/**
+ * Takes every message waiting in a mailbox on the mail queue.
+ */
+void drain_mailbox(pid_t pid) {
+	struct proc_msg msg;
+
+	while (msgrcv(mail, (void *)&msg, sizeof(msg.pinfo), MBOX(pid), IPC_NOWAIT) != -1);
+}
+
+/**
+ * Floods a worker's queue with temperature readings under the process's
+ * own PID until killed. Never waits on the full queue, taking the stops
+ * the controller sends back off the mail queue instead so they don't fill
+ * it up.
+ */
+void flood_queue(int queue) {
+	struct proc_msg msg;
+	int sent = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = DATACODE;
+	msg.pinfo.pid = getpid();
+	msg.pinfo.device = TEMP_SENSOR_TYPE;
+	msg.pinfo.threshold = INT_MAX;
+	strcpy(msg.pinfo.name, "bench_flood");
+
+	while (1) {
+		msg.pinfo.data = sent++ % 100;
+		if (msgsnd(queue, (void *)&msg, sizeof(msg.pinfo), IPC_NOWAIT) == -1) {
+			if (errno != EAGAIN) {
+				fprintf(stderr, "[ERROR] Failed to send reading to message queue: %d\n", errno);
+				exit(MQSERR);
+			}
+			sched_yield();
+		}
+		if (sent % 64 == 0) {
+			drain_mailbox(getpid());
+		}
+	}
+}
+
+/**
+ * Sends smoke readings over their threshold to a worker one at a time,
+ * through its queue or through its alarm lane with a doorbell on its queue,
+ * and takes the action each one raises for the bench's bell. The time each
+ * reading waited before the worker took it comes from the action's stamps.
+ *
+ * return: Readings that raised no action within a second
+ */
+int probe_smoke(int queue, int lane, double *waits, int n) {
+	struct proc_msg msg, action, bell;
+	double start, sent;
+	int i, lost = 0;
+
+	memset(&bell, 0, sizeof(bell));
+	bell.msg_type = RINGCODE;
+	for (i = 0; i < n; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_type = DATACODE;
+		msg.pinfo.pid = LANEPID;
+		msg.pinfo.device = SMOKE_SENSOR_TYPE;
+		msg.pinfo.data = 100;
+		strcpy(msg.pinfo.name, "bench_smoke");
+
+		start = now_us();
+		msg.pinfo.stamps.read = (long long int)start;
+		if (msgsnd(lane != -1 ? lane : queue, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed to send reading to message queue: %d\n", errno);
+			exit(MQSERR);
+		}
+		if (lane != -1) {
+			msgsnd(queue, (void *)&bell, 0, IPC_NOWAIT);
+		}
+
+		// Wait for the action, the bench's own stops are not for the reading
+		waits[i - lost] = -1;
+		while (now_us() - start < 1e6) {
+			if (msgrcv(mail, (void *)&action, sizeof(action.pinfo), MBOX(getpid()), IPC_NOWAIT) == -1) {
+				usleep(100);
+			} else if (action.pinfo.data == DATACODE) {
+				waits[i - lost] = action.pinfo.stamps.receive - action.pinfo.stamps.read;
+				action.msg_type = AACKCODE;
+				action.pinfo.pid = getpid();
+				strcpy(action.pinfo.name, "bench_bell");
+				if (msgsnd(queue, (void *)&action, sizeof(action.pinfo), 0) == -1) {
+					fprintf(stderr, "[ERROR] Failed to send acknowledge to message queue: %d\n", errno);
+					exit(MQSERR);
+				}
+				break;
+			}
+		}
+		if (waits[i - lost] < 0) {
+			lost++;
+		}
+		drain_mailbox(LANEPID);
+
+		sent = now_us() - start;
+		if (sent < PROBEGAP) {
+			usleep(PROBEGAP - sent);
+		}
+	}
+	return lost;
+}
+
+/**
+ * Sorts microseconds in ascending order for qsort.
+ */
+int compare_waits(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Prints the spread of the waits of the smoke readings sent one way.
+ */
+void print_waits(char *how, double *waits, int n, int lost) {
+	if (n == 0) {
+		printf("[LANES] %-6s no smoke reading raised an action (%d lost)\n", how, lost);
+		return;
+	}
+	qsort(waits, n, sizeof(double), compare_waits);
+	printf("[LANES] %-6s %d smoke readings waited min %.0fus p50 %.0fus p99 %.0fus max %.0fus (%d lost)\n",
+			how, n, waits[0], waits[n / 2], waits[(n * 99) / 100], waits[n - 1], lost);
+}
+
+/**
+ * Returns the messages waiting on a queue.
+ */
+unsigned long queue_depth(int queue) {
+	struct msqid_ds info;
+
+	if (msgctl(queue, IPC_STAT, &info) == -1) {
+		return 0;
+	}
+	return info.msg_qnum;
+}
+
+/**
+ * Times how long smoke readings wait for a worker whose queue is saturated
+ * by temperature readings, sent behind the backlog on its queue and then
+ * through its alarm lane.
+ */
+int bench_lanes(int argc, char *argv[]) {
+	struct proc_msg msg;
+	metrics *stats;
+	pid_t flooders[64];
+	double *waits;
+	int n = 50, nflood = 4, msgid, queue, lane, target, i, lost;
+	double start;
+
+	if (argc < 3) {
+		fprintf(stderr, "[ERROR] lanes takes a queue path and optional probes and flooders!\n");
+		exit(INITERR);
+	}
+	if (argc > 3) {
+		n = strtol(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		nflood = strtol(argv[4], NULL, 10);
+	}
+	if (n < 1 || n > 10000 || nflood < 1 || nflood > 64) {
+		fprintf(stderr, "[ERROR] Probes must be between 1 and 10000 and flooders between 1 and 64!\n");
+		exit(INITERR);
+	}
+
+	msgid = msgget(ftok(argv[2], MAINPROJ), 0666);
+	stats = attach_metrics(ftok(argv[2], METRICSPROJ));
+	if (msgid == -1 || stats == NULL) {
+		fprintf(stderr, "[ERROR] Error connecting to the controller: %d\n", errno);
+		exit(MQGERR);
+	}
+	connect_mail(argv[2]);
+
+	// The first worker takes the main queue too, so flood the last one
+	if (stats->nshards < 2) {
+		fprintf(stderr, "[ERROR] lanes needs a controller with at least 2 workers\n");
+		exit(INITERR);
+	}
+	target = stats->nshards - 1;
+	queue = msgget(ftok(argv[2], QUEUEPROJ(target)), 0666);
+	lane = msgget(ftok(argv[2], LANEPROJ(target)), 0666);
+	waits = malloc(sizeof(double) * n);
+	if (queue == -1 || lane == -1 || waits == NULL) {
+		fprintf(stderr, "[ERROR] Error connecting to worker %d: %d\n", target, errno);
+		exit(MQGERR);
+	}
+
+	// Register as the bell the smoke readings ring, every worker knows the actuators
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = INITCODE;
+	msg.pinfo.pid = getpid();
+	msg.pinfo.device = BELL_ACTUATOR_TYPE;
+	msg.pinfo.inbox = -1;
+	strcpy(msg.pinfo.name, "bench_bell");
+	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1 ||
+			msgrcv(mail, (void *)&msg, sizeof(msg.pinfo), MBOX(getpid()), 0) == -1) {
+		fprintf(stderr, "[ERROR] Failed to register with the controller: %d\n", errno);
+		exit(MQSERR);
+	}
+
+	for (i = 0; i < nflood; i++) {
+		flooders[i] = fork();
+		if (flooders[i] == 0) {
+			flood_queue(queue);
+		} else if (flooders[i] == -1) {
+			fprintf(stderr, "[ERROR] Failed to fork flooder: %d\n", errno);
+			exit(INITERR);
+		}
+	}
+	usleep(500000);
+
+	printf("[LANES] Worker %d queue %lu messages deep\n", target, queue_depth(queue));
+	lost = probe_smoke(queue, -1, waits, n);
+	print_waits("queue", waits, n - lost, lost);
+
+	printf("[LANES] Worker %d queue %lu messages deep\n", target, queue_depth(queue));
+	lost = probe_smoke(queue, lane, waits, n);
+	print_waits("lane", waits, n - lost, lost);
+
+	// Let the worker work off the backlog before taking its stops to the flooders
+	for (i = 0; i < nflood; i++) {
+		kill(flooders[i], SIGKILL);
+		waitpid(flooders[i], NULL, 0);
+	}
+	start = now_us();
+	while (queue_depth(queue) > 0 && now_us() - start < 5e6) {
+		usleep(1000);
+	}
+	for (i = 0; i < nflood; i++) {
+		drain_mailbox(flooders[i]);
+	}
+	drain_mailbox(LANEPID);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = QUITCODE;
+	msg.pinfo.pid = getpid();
+	msg.pinfo.device = BELL_ACTUATOR_TYPE;
+	msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0);
+	usleep(100000);
+	drain_mailbox(getpid());
+
+	shmdt(stats);
+	free(waits);
+	return 0;
+}
+
+/**
+ * Prints the rate of n operations that took the given microseconds.
+ */
+void print_rate(char *what, int n, double us) {
+	printf("[REGISTRY] %-8s %d devices in %.1fms (%.0f ops/s)\n", what, n, us / 1000,
+			us > 0 ? n / (us / 1e6) : 0);
+}
+
+/**
+ * Times registering, finding and removing devices in the registry.
+ */
+int bench_registry(int argc, char *argv[]) {
+	registry reg;
+	proc_info info;
+	int n = 100000, i;
+	double start;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	if (!init_registry(&reg)) {
+		exit(MEMERR);
+	}
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "bench");
+
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		info.pid = i + 1;
+		info.device = i % 2 ? TEMP_SENSOR_TYPE : AC_ACTUATOR_TYPE;
+		if (registry_add(&reg, &info) == -1) {
+			exit(MEMERR);
+		}
+	}
+	print_rate("add", n, now_us() - start);
+
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		if (registry_find(&reg, i + 1) == -1) {
+			fprintf(stderr, "[ERROR] Device %d missing from registry\n", i + 1);
+			exit(INITERR);
+		}
+	}
+	print_rate("find", n, now_us() - start);
+
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		registry_remove(&reg, i + 1);
+	}
+	print_rate("remove", n, now_us() - start);
+
+	if (reg.count != 0) {
+		fprintf(stderr, "[ERROR] %d devices left in registry\n", reg.count);
+		exit(INITERR);
+	}
+	free_registry(&reg);
+	return 0;
+}
+
+// Registry the snapshot bench restores into
+registry restored;
+
+/**
+ * Replays a journal entry into the registry being restored.
+ */
+int replay_bench(journal_entry *entry) {
+	if (entry->op != JOURNALADD || registry_add(&restored, &entry->info) != entry->slot) {
+		fprintf(stderr, "[ERROR] Journal entry for device %d did not replay\n", entry->info.pid);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Times journaling registrations, checkpointing a registry and restoring
+ * one the way a restarted controller worker does.
+ */
+int bench_snapshot(int argc, char *argv[]) {
+	char dir[] = "/tmp/bench_state_XXXXXX";
+	registry reg;
+	rule_set set;
+	window *windows;
+	snapshot snap;
+	proc_info info;
+	int n = 100000, more, i, slot, replayed, nwindows;
+	double start, elapsed;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	more = n / 10;
+	init_rules(&set);
+	windows = create_windows(WINDOWSLOTS);
+	if (mkdtemp(dir) == NULL || windows == NULL || !init_registry(&reg) || !init_registry(&restored) ||
+			!open_snapshot(&snap, dir, 1, 0)) {
+		fprintf(stderr, "[ERROR] Could not create bench state: %d\n", errno);
+		exit(SNAPERR);
+	}
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "bench");
+
+	// Every registration is journaled before it would be acknowledged
+	start = now_us();
+	for (i = 0; i < n + more; i++) {
+		if (i == n) {
+			elapsed = now_us() - start;
+			printf("[SNAPSHOT] journal    %d devices in %.1fms (%.0f devices/s)\n", n, elapsed / 1000,
+					n / (elapsed / 1e6));
+
+			// A worker saves the windows of its registry's slots
+			nwindows = reg.capacity < WINDOWSLOTS ? reg.capacity : WINDOWSLOTS;
+			start = now_us();
+			if (!snapshot_take(&snap, 1, 1, &reg, windows, nwindows, &set)) {
+				exit(SNAPERR);
+			}
+			elapsed = now_us() - start;
+			printf("[SNAPSHOT] checkpoint %d devices in %.1fms (%.1fMB)\n", reg.count, elapsed / 1000,
+					(sizeof(snap_header) + sizeof(device) * (double)reg.capacity +
+					sizeof(int) * (double)reg.nbuckets + sizeof(window) * (double)nwindows) / 1e6);
+		}
+		info.pid = i + 1;
+		info.device = i % 2 ? TEMP_SENSOR_TYPE : AC_ACTUATOR_TYPE;
+		slot = registry_add(&reg, &info);
+		if (slot == -1 || !snapshot_log(&snap, JOURNALADD, slot, &info)) {
+			exit(SNAPERR);
+		}
+		reg.slots[slot].rule = rules_attach(&set, &reg.slots[slot].state, info.name, info.device);
+	}
+	close_snapshot(&snap, 1);
+
+	// Restore the way a worker of a restarted controller does
+	start = now_us();
+	if (!open_snapshot(&snap, dir, 1, 0) || !snapshot_restore(&snap, &restored, windows, WINDOWSLOTS) ||
+			(replayed = snapshot_replay(&snap, replay_bench)) != more) {
+		fprintf(stderr, "[ERROR] Could not restore bench state\n");
+		exit(SNAPERR);
+	}
+	elapsed = now_us() - start;
+	printf("[SNAPSHOT] restore    %d devices from the checkpoint and %d journal entries in %.1fms\n",
+			restored.count - replayed, replayed, elapsed / 1000);
+
+	for (i = 0; i < n + more; i++) {
+		slot = registry_find(&reg, i + 1);
+		if (registry_find(&restored, i + 1) != slot ||
+				registry_handle(&restored, slot) != registry_handle(&reg, slot)) {
+			fprintf(stderr, "[ERROR] Device %d restored into the wrong slot\n", i + 1);
+			exit(SNAPERR);
+		}
+	}
+
+	close_snapshot(&snap, 0);
+	rmdir(dir);
+	free_registry(&reg);
+	free_registry(&restored);
+	return 0;
+}
+
+/**
+ * Receives n frames from the message queue.
+ */
+void consume_queue(int msgid, int n) {
+	struct frame_msg frame;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (msgrcv(msgid, (void *)&frame, sizeof(frame.finfo), FRAMCODE, 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed receiving frame: %d\n", errno);
+			exit(MQRERR);
+		}
+	}
+}
+
+/**
+ * Pops n frames from the ring the same way the controller child does,
+ * sleeping on the message queue whenever the ring runs dry.
+ */
+void consume_ring(ring *rng, int msgid, int n) {
+	struct proc_msg bell;
+	frame_info frame;
+	int i = 0;
+
+	while (i < n) {
+		if (ring_pop(rng, &frame)) {
+			i++;
+		} else if (ring_sleep(rng)) {
+			if (msgrcv(msgid, (void *)&bell, 0, RINGCODE, 0) == -1) {
+				fprintf(stderr, "[ERROR] Failed waiting for doorbell: %d\n", errno);
+				exit(MQRERR);
+			}
+			atomic_store(&rng->sleeping, 0);
+		}
+	}
+}
+
+/**
+ * Times sending frames through a message queue against the shared
+ * memory ring, with a forked process on the receiving end.
+ */
+int bench_transport(int argc, char *argv[]) {
+	struct frame_msg frame;
+	struct proc_msg bell;
+	ring *rng;
+	pid_t pid;
+	int n = 200000, msgid, shmid, i, bells = 0;
+	double start, queue_us, ring_us;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	msgid = msgget(IPC_PRIVATE, 0600);
+	rng = create_ring(IPC_PRIVATE, RINGSIZE, 0, &shmid);
+	if (msgid == -1 || rng == NULL) {
+		fprintf(stderr, "[ERROR] Could not create bench queue and ring: %d\n", errno);
+		exit(INITERR);
+	}
+	memset(&frame, 0, sizeof(frame));
+	frame.msg_type = FRAMCODE;
+	bell.msg_type = RINGCODE;
+
+	// One message per frame through the kernel
+	start = now_us();
+	pid = fork();
+	if (pid == 0) {
+		consume_queue(msgid, n);
+		exit(0);
+	}
+	for (i = 0; i < n; i++) {
+		frame.finfo.read.data = i;
+		if (msgsnd(msgid, (void *)&frame, sizeof(frame.finfo), 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed sending frame: %d\n", errno);
+			exit(MQSERR);
+		}
+	}
+	waitpid(pid, NULL, 0);
+	queue_us = now_us() - start;
+
+	// Frames through shared memory, only the doorbells go through the kernel
+	start = now_us();
+	pid = fork();
+	if (pid == 0) {
+		consume_ring(rng, msgid, n);
+		exit(0);
+	}
+	for (i = 0; i < n; i++) {
+		frame.finfo.read.data = i;
+		while (!ring_push(rng, &frame.finfo)) {
+			sched_yield();
+		}
+		if (ring_wake(rng)) {
+			bells++;
+			if (msgsnd(msgid, (void *)&bell, 0, 0) == -1) {
+				fprintf(stderr, "[ERROR] Failed sending doorbell: %d\n", errno);
+				exit(MQSERR);
+			}
+		}
+	}
+	waitpid(pid, NULL, 0);
+	ring_us = now_us() - start;
+
+	printf("[TRANSPORT] queue %d frames in %.1fms (%.0f frames/s)\n", n, queue_us / 1000,
+			n / (queue_us / 1e6));
+	printf("[TRANSPORT] ring  %d frames in %.1fms (%.0f frames/s, %d doorbells)\n", n,
+			ring_us / 1000, n / (ring_us / 1e6), bells);
+
+	msgctl(msgid, IPC_RMID, 0);
+	shmctl(shmid, IPC_RMID, 0);
+	return 0;
+}
+
+/**
+ * Puts mail for made up devices on a queue until it holds depth messages,
+ * the way mail for devices that are slow to take it waits on a queue
+ * shared with other messages. The mail is empty so a queue of the default
+ * size holds thousands, a receive looks past each message the same either way.
+ */
+void fill_mail(int msgid, int from, int depth) {
+	struct proc_msg msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.pinfo.data = STOPCODE;
+	for (i = from; i < depth; i++) {
+		msg.msg_type = MBOX(i + 1);
+		if (msgsnd(msgid, (void *)&msg, 0, IPC_NOWAIT) == -1) {
+			fprintf(stderr, "[ERROR] Failed filling queue to %d messages: %d\n", depth, errno);
+			exit(MQSERR);
+		}
+	}
+}
+
+/**
+ * Returns the nanoseconds it takes to send a message of the given type and
+ * take it back off the queue with the given receive type, over n rounds.
+ */
+double time_receive(int msgid, long int type, long int want, int n) {
+	struct proc_msg msg;
+	double start;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		msg.msg_type = type;
+		if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1 ||
+				msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), want, 0) == -1) {
+			fprintf(stderr, "[ERROR] Failed sending and receiving: %d\n", errno);
+			exit(MQRERR);
+		}
+	}
+	return (now_us() - start) * 1000 / n;
+}
+
+/**
+ * Times a device taking its mail and a worker taking a reading off a queue
+ * that also holds mail for other devices, as the queue gets deeper.
+ */
+int bench_queues(int argc, char *argv[]) {
+	struct msqid_ds ds;
+	int max = 10000, n = 10000, depth, filled = 0, msgid;
+
+	if (argc > 2) {
+		max = strtol(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		n = strtol(argv[3], NULL, 10);
+	}
+	if (max < 1 || n < 1) {
+		fprintf(stderr, "[ERROR] Depth and receives must be at least 1!\n");
+		exit(INITERR);
+	}
+	msgid = msgget(IPC_PRIVATE, 0600);
+	if (msgid == -1) {
+		fprintf(stderr, "[ERROR] Could not create bench queue: %d\n", errno);
+		exit(INITERR);
+	}
+
+	// A queue holds as many messages as it does bytes, beyond the system's
+	// default only with the privilege to raise it
+	if (msgctl(msgid, IPC_STAT, &ds) == 0 && ds.msg_qbytes < (unsigned long)max + sizeof(proc_info)) {
+		ds.msg_qbytes = max + sizeof(proc_info);
+		if (msgctl(msgid, IPC_SET, &ds) == -1) {
+			msgctl(msgid, IPC_STAT, &ds);
+			max = ds.msg_qbytes - sizeof(proc_info);
+			printf("[QUEUES] Queue holds only %d messages\n", max);
+		}
+	}
+
+	// Depth 0 is a queue split by direction, holding only what its reader takes
+	for (depth = 0; filled < max; depth = depth ? depth * 10 : 10) {
+		if (depth > max) {
+			depth = max;
+		}
+		fill_mail(msgid, filled, depth);
+		filled = depth;
+		printf("[QUEUES] depth %6d: mailbox %8.0fns, worker %8.0fns per send and receive\n", depth,
+				time_receive(msgid, MBOX(getpid()), MBOX(getpid()), n),
+				time_receive(msgid, FRAMCODE, -CHILDCODE, n));
+	}
+
+	msgctl(msgid, IPC_RMID, 0);
+	return 0;
+}
+
+// Records found by the store bench's queries
+int store_hits = 0;
+
+/**
+ * Counts the records a query finds.
+ */
+void count_record(store_record *rec) {
+	store_hits++;
+}
+
+/**
+ * Measures how fast the record store takes in alarms and answers
+ * queries for one device over a short time range.
+ */
+int bench_store(int argc, char *argv[]) {
+	char dir[] = "/tmp/bench_store_XXXXXX", path[96];
+	proc_info info;
+	store st;
+	int n = 1000000, queries = 10000, packed_count = 0, i;
+	long long packed_bytes = 0;
+	double start, elapsed;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	if (mkdtemp(dir) == NULL || !open_store(&st, dir, 1)) {
+		fprintf(stderr, "[ERROR] Could not create bench store: %d\n", errno);
+		exit(STOREERR);
+	}
+	memset(&info, 0, sizeof(info));
+	info.device = TEMP_SENSOR_TYPE;
+
+	// A thousand devices each raising an alarm every millisecond
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		info.pid = i % 1000 + 1;
+		info.data = i;
+		if (!store_append(&st, &info, 1, i / 1000)) {
+			exit(STOREERR);
+		}
+	}
+	elapsed = now_us() - start;
+	printf("[STORE] append %d records in %.1fms (%.0f records/s)\n", n, elapsed / 1000,
+			n / (elapsed / 1e6));
+
+	// Ten milliseconds of one device from somewhere in the store
+	start = now_us();
+	for (i = 0; i < queries; i++) {
+		long long from = (long long)i * 7919 % (n / 1000 + 1);
+
+		if (store_query(&st, i % 1000 + 1, from, from + 9, count_record) == -1) {
+			exit(MEMERR);
+		}
+	}
+	elapsed = now_us() - start;
+	printf("[STORE] query %d ranges in %.1fms (%.0f queries/s), %d records found in %d segments\n",
+			queries, elapsed / 1000, queries / (elapsed / 1e6), store_hits, st.nsegs);
+
+	// Open the store again once the packer is done to see what it packed
+	close_store(&st);
+	if (!open_store(&st, dir, 0)) {
+		exit(STOREERR);
+	}
+	for (i = 0; i < st.nsegs; i++) {
+		if (st.segs[i].pack != NULL) {
+			packed_bytes += st.segs[i].pack->size;
+			packed_count += st.segs[i].pack->count;
+		}
+		sprintf(path, SEGNAME, dir, i);
+		unlink(path);
+		sprintf(path, PACKNAME, dir, i);
+		unlink(path);
+	}
+	if (packed_count > 0) {
+		printf("[STORE] packed %d records in %lld bytes (%.2f bytes/record)\n", packed_count,
+				packed_bytes, (double)packed_bytes / packed_count);
+	}
+	close_store(&st);
+	rmdir(dir);
+	return 0;
+}
+
+/**
+ * Measures how long readings take to check against each kind of rule, on
+ * their own and in batches.
+ */
+int bench_rules(int argc, char *argv[]) {
+	const char *kinds[] = {"s1 above threshold", "s2 above 25 below 15", "s3 rise 5",
+			"s4 above 20 count 3 of 5"};
+	int nkinds = sizeof(kinds) / sizeof(kinds[0]);
+	char line[64], name[4];
+	rule_set set;
+	rule_state one, batch;
+	unsigned long long alarms;
+	int *data, n = 1000000, i, j, r, raised;
+	double start, one_us, batch_us;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	n -= n % MAXBATCH;
+	data = malloc(sizeof(int) * n);
+	if (data == NULL) {
+		exit(MEMERR);
+	}
+	srand(1);
+	for (i = 0; i < n; i++) {
+		data[i] = rand() % 40;
+	}
+
+	// Compiling a rule splits up its line, so compile a copy
+	init_rules(&set);
+	for (i = 0; i < nkinds; i++) {
+		strcpy(line, kinds[i]);
+		rules_add(&set, line);
+	}
+
+	for (i = 0; i < nkinds; i++) {
+		sprintf(name, "s%d", i + 1);
+		r = rules_attach(&set, &one, name, TEMP_SENSOR_TYPE);
+
+		start = now_us();
+		for (j = 0; j < n; j++) {
+			rules_check(&set, r, &one, 20, data + j, 1);
+		}
+		one_us = now_us() - start;
+
+		rules_attach(&set, &batch, name, TEMP_SENSOR_TYPE);
+		raised = 0;
+		start = now_us();
+		for (j = 0; j < n; j += MAXBATCH) {
+			alarms = rules_check(&set, r, &batch, 20, data + j, MAXBATCH);
+			raised += __builtin_popcountll(alarms);
+		}
+		batch_us = now_us() - start;
+
+		printf("[RULES] %-26s %6.1fns/reading alone, %5.1fns/reading in batches, %d alarms\n",
+				kinds[i], one_us * 1000 / n, batch_us * 1000 / n, raised);
+	}
+
+	free(data);
+	return 0;
+}
+
+/**
+ * Measures how long readings take to add to a sliding window and how long
+ * its aggregates take to read.
+ */
+int bench_window(int argc, char *argv[]) {
+	window *win = create_windows(1);
+	proc_info info;
+	aggregate agg;
+	int *data, n = 1000000, reads = 100000, i;
+	double start, add_us, read_us;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	n -= n % MAXBATCH;
+	data = malloc(sizeof(int) * n);
+	if (win == NULL || data == NULL || n < WINDOWSIZE) {
+		exit(MEMERR);
+	}
+	srand(1);
+	for (i = 0; i < n; i++) {
+		data[i] = rand() % 40;
+	}
+	memset(&info, 0, sizeof(info));
+	info.pid = 1;
+	info.device = TEMP_SENSOR_TYPE;
+	strcpy(info.name, "s1");
+
+	window_attach(win, &info);
+	start = now_us();
+	for (i = 0; i < n; i += MAXBATCH) {
+		window_add(win, data + i, MAXBATCH);
+	}
+	add_us = now_us() - start;
+
+	start = now_us();
+	for (i = 0; i < reads; i++) {
+		window_read(win, &agg);
+	}
+	read_us = now_us() - start;
+
+	printf("[WINDOW] Added %d readings: %.1fns/reading\n", n, add_us * 1000 / n);
+	printf("[WINDOW] Read aggregates %d times: %.1fns/read, mean %.2f min %d max %d p50 %d p90 %d\n",
+			reads, read_us * 1000 / reads, agg.mean, agg.min, agg.max, agg.p50, agg.p90);
+
+	free(data);
+	return 0;
+}
+
+/**
+ * Measures how many alarms and actions a fleet of sensors hovering at their
+ * threshold is held to by the alarm limits, and what the limits cost.
+ */
+int bench_limit(int argc, char *argv[]) {
+	int sensors = 100, seconds = 60, data[MAXBATCH], i, j;
+	long long int now, end, raised = 0, kept = 0, sent = 0, readings = 0;
+	unsigned long long alarms;
+	rule_set set;
+	rule_state *states;
+	alarm_limit *limits;
+	bucket tokens;
+	double start, us;
+
+	if (argc > 2) {
+		sensors = strtol(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		seconds = strtol(argv[3], NULL, 10);
+	}
+	states = malloc(sizeof(rule_state) * sensors);
+	limits = malloc(sizeof(alarm_limit) * sensors);
+	if (states == NULL || limits == NULL || sensors < 1) {
+		exit(MEMERR);
+	}
+
+	init_rules(&set);
+	for (i = 0; i < sensors; i++) {
+		rules_attach(&set, &states[i], "s", TEMP_SENSOR_TYPE);
+		limit_reset(&limits[i]);
+	}
+	bucket_reset(&tokens, rules_limit(&set, AC_ACTUATOR_TYPE), 0);
+	srand(1);
+
+	// Simulated time moves on 100ms per round of batches
+	start = now_us();
+	for (now = 0, end = seconds * 1000LL; now < end; now += 100) {
+		for (i = 0; i < sensors; i++) {
+			for (j = 0; j < MAXBATCH; j++) {
+				data[j] = 19 + rand() % 3;
+			}
+			alarms = rules_check(&set, 0, &states[i], 20, data, MAXBATCH);
+			raised += __builtin_popcountll(alarms);
+			alarms = limit_alarms(&limits[i], set.rules[0].quiet, now, alarms, MAXBATCH);
+			kept += __builtin_popcountll(alarms);
+			if (alarms && bucket_take(&tokens, rules_limit(&set, AC_ACTUATOR_TYPE), now)) {
+				sent++;
+			}
+			readings += MAXBATCH;
+		}
+	}
+	us = now_us() - start;
+
+	printf("[LIMIT] %d sensors for %ds: %lld readings, %lld alarms by rule, %lld after quiet "
+			"periods, %lld actions sent (%.1f/s)\n", sensors, seconds, readings, raised, kept, sent,
+			(double)sent / seconds);
+	printf("[LIMIT] %.1fns/reading including the readings' rule check and data\n",
+			us * 1000 / readings);
+
+	free(states);
+	free(limits);
+	return 0;
+}
+
+/**
+ * Encodes and decodes one series of readings and prints how small and
+ * how fast it was.
+ *
+ * param what: Name of the series.
+ * param times: Reading times.
+ * param data: Reading data.
+ * param n: Number of readings.
+ */
+void bench_series(char *what, long long *times, int *data, int n) {
+	unsigned char *buf = malloc(CODECBYTES(n));
+	encoder enc;
+	decoder dec;
+	long long time;
+	double start, encode_us, decode_us;
+	int value, i;
+
+	if (buf == NULL) {
+		exit(MEMERR);
+	}
+
+	start = now_us();
+	init_encoder(&enc, buf, CODECBYTES(n));
+	for (i = 0; i < n; i++) {
+		encode_reading(&enc, times[i], data[i]);
+	}
+	encode_us = now_us() - start;
+
+	start = now_us();
+	init_decoder(&dec, buf, encoded_bytes(&enc), n);
+	while (decode_reading(&dec, &time, &value));
+	decode_us = now_us() - start;
+
+	printf("[CODEC] %-7s %d readings in %lld bytes (%.2f bytes/reading, %d raw), "
+			"encode %.1fM/s, decode %.1fM/s\n", what, n, encoded_bytes(&enc),
+			(double)encoded_bytes(&enc) / n, (int)(sizeof(long long) + sizeof(int)),
+			n / encode_us, n / decode_us);
+	free(buf);
+}
+
+/**
+ * Measures the compressed encoding on readings like a sensor's.
+ */
+int bench_codec(int argc, char *argv[]) {
+	long long *times;
+	int *data;
+	int n = 1000000, i;
+
+	if (argc > 2) {
+		n = strtol(argv[2], NULL, 10);
+	}
+	times = malloc(sizeof(long long) * n);
+	data = malloc(sizeof(int) * n);
+	if (times == NULL || data == NULL) {
+		exit(MEMERR);
+	}
+	srand(1);
+
+	// A sensor's period with a little scheduling jitter and random readings
+	// up to twenty past its threshold, as sensor.c sends them
+	times[0] = 1792252900000LL;
+	for (i = 0; i < n; i++) {
+		if (i > 0) {
+			times[i] = times[i - 1] + 2000 + rand() % 3;
+		}
+		data[i] = rand() % 30;
+	}
+	bench_series("sensor", times, data, n);
+
+	// A steady period and a reading that drifts by at most one
+	for (i = 0; i < n; i++) {
+		times[i] = times[0] + 1000LL * i;
+		data[i] = i > 0 ? data[i - 1] + rand() % 3 - 1 : 20;
+	}
+	bench_series("steady", times, data, n);
+
+	free(times);
+	free(data);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc >= 2 && strcmp(argv[1], "idle") == 0) {
+		return bench_idle(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "wake") == 0) {
+		return bench_wake(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "register") == 0) {
+		return bench_register(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "lanes") == 0) {
+		return bench_lanes(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "registry") == 0) {
+		return bench_registry(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "snapshot") == 0) {
+		return bench_snapshot(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "queues") == 0) {
+		return bench_queues(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "transport") == 0) {
+		return bench_transport(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "store") == 0) {
+		return bench_store(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "codec") == 0) {
+		return bench_codec(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "rules") == 0) {
+		return bench_rules(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "window") == 0) {
+		return bench_window(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "limit") == 0) {
+		return bench_limit(argc, argv);
+	}
+
+	fprintf(stderr, "[ERROR] Bench takes a mode: idle PID [seconds] | "
+			"wake QUEUE_PATH [rounds] [gap_ms] | register QUEUE_PATH [devices] [in_flight] | "
+			"lanes QUEUE_PATH [probes] [flooders] | registry [devices] | snapshot [devices] | "
+			"queues [depth] [receives] | transport [frames] | "
+			"store [records] | codec [readings] | rules [readings] | window [readings] | limit [sensors] [seconds]\n");
+	exit(INITERR);
+}
@@ -5,16 +5,59 @@
  * FIFO and is read based on client/server model. Displays
  * the alarm information send from the parent.
  *
+ * Any number of controllers can connect. Each one announces itself with a
+ * hello frame on the server FIFO and then sends its frames on its own
+ * client FIFO. The cloud waits on all of the FIFOs at once with epoll and
+ * does one read per ready FIFO per turn, so a busy controller can't keep
+ * the others waiting.
+ *
+ * Every read takes as much as the FIFO holds and handles every whole frame
+ * in that client's buffer, keeping a partial one until the rest arrives.
+ *
+ * Every alarm is also kept in the record store under /tmp/cloud_store,
+ * which the query program reads. The time each alarm took from its
+ * controller's parent, and from its sensor, is kept in a latency histogram
+ * whose percentiles are printed every LATPERIOD milliseconds. The aggregates of each sensor's recent
+ * readings that controllers send periodically are displayed.
+ *
+ * What the cloud displays goes through the logger (see log.h), so a slow
+ * terminal never holds up reading the FIFOs.
+ *
  *  Created on: Oct 10, 2015
  *      Author: Nicolas McCallum 100936816
  */
 
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 #include "message.h"
+#include "stream.h"
+#include "store.h"
+#include "window.h"
+#include "latency.h"
+#include "log.h"
+
+// Most ready FIFOs handled per wakeup
+#define MAXEVENTS 64
+
+// Controller connected through its client FIFO
+typedef struct client {
+	pid_t pid;
+	char path[64];
+	stream strm;
+} client;
 
 char running = 1;
+int epoll_id;
+int clients = 0;
+store history;
+
+// Time alarms took from the controller's parent, and from their sensor
+histogram from_parent;
+histogram from_sensor;
+unsigned long long reported = 0;
 
 /**
  * Signal handler that checks for the interrupt signal and stops the
@@ -28,9 +71,145 @@ void signal_handler(int signum) {
 	}
 }
 
+/**
+ * Opens the client FIFO of a controller that said hello and starts
+ * watching it.
+ *
+ * param pid: PID of the controller.
+ */
+void add_client(pid_t pid) {
+	client *cli = malloc(sizeof(client));
+	struct epoll_event event;
+	int fd;
+
+	if (cli == NULL) {
+		log_error("[ERROR] Could not allocate controller %d: %d\n", pid, errno);
+		return;
+	}
+	cli->pid = pid;
+	sprintf(cli->path, CLIENT_FIFO_NAME, pid);
+
+	// Don't wait for the controller to open its end, epoll will tell us when it writes
+	fd = open(cli->path, O_RDONLY | O_NONBLOCK);
+	if (fd == -1) {
+		log_error("[ERROR] Could not open client FIFO %s: %d\n", cli->path, errno);
+		free(cli);
+		return;
+	}
+	init_stream(&cli->strm, fd);
+
+	event.events = EPOLLIN;
+	event.data.ptr = cli;
+	if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, fd, &event) == -1) {
+		log_error("[ERROR] Could not watch client FIFO %s: %d\n", cli->path, errno);
+		close(fd);
+		free(cli);
+		return;
+	}
+
+	clients++;
+	log_info("[INIT] Controller %d connected on %s (%d connected)\n", pid, cli->path, clients);
+}
+
+/**
+ * Stops watching a controller's client FIFO and removes it.
+ *
+ * param cli: Controller that disconnected.
+ */
+void remove_client(client *cli) {
+	epoll_ctl(epoll_id, EPOLL_CTL_DEL, cli->strm.fd, NULL);
+	close(cli->strm.fd);
+	unlink(cli->path);
+	clients--;
+	log_info("[INIT] Controller %d disconnected (%d connected)\n", cli->pid, clients);
+	free(cli);
+}
+
+/**
+ * Handles every whole frame in the stream's buffer.
+ *
+ * param strm: Stream read from a FIFO.
+ * param pid: PID of the controller that sent the stream, 0 for the server FIFO.
+ */
+void handle_frames(stream *strm, pid_t pid) {
+	stream_header header;
+	proc_info *pinfo;
+	aggregate *agg;
+	char *records;
+	int offset = 0, i;
+	struct timespec ts;
+	long long now, arrived = latency_now();
+
+	// Everything in one read arrived together, so it is all stored with one time
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+
+	while ((records = stream_next(strm, &header, &offset)) != NULL) {
+		// New controllers say hello on the server FIFO
+		if (header.type == STREAMHELO && header.length == header.count * sizeof(pid_t)) {
+			for (i = 0; i < header.count; i++) {
+				add_client(((pid_t *)records)[i]);
+			}
+			continue;
+		}
+
+		// Aggregates of each sensor's window of readings
+		if (header.type == STREAMAGGR && header.length == header.count * sizeof(aggregate)) {
+			for (i = 0; i < header.count; i++) {
+				agg = (aggregate *)records + i;
+				log_info("[AGGREGATE] Controller %d device %d (%s), type %c, last %d readings: "
+						"mean %.2f min %d max %d p50 %d p90 %d\n", pid, agg->pid, agg->name,
+						agg->type, agg->count, agg->mean, agg->min, agg->max, agg->p50, agg->p90);
+			}
+			continue;
+		}
+
+		if (header.type != STREAMALRM || header.length != header.count * sizeof(proc_info)) {
+			log_error("[ERROR] Unknown frame type %d with %d records skipped\n",
+					header.type, header.count);
+			continue;
+		}
+
+		for (i = 0; i < header.count; i++) {
+			pinfo = (proc_info *)records + i;
+			log_info("[DATA] Controller %d sent data from PID %d (%s), device type %c, "
+					"with data %d and threshold %ld\n", pid, pinfo->pid, pinfo->name, pinfo->device,
+					pinfo->data, pinfo->threshold);
+			if (!store_append(&history, pinfo, pid, now)) {
+				log_error("[ERROR] Could not store alarm from PID %d\n", pinfo->pid);
+			}
+			if (pinfo->stamps.forward != 0) {
+				hist_add(&from_parent, arrived - pinfo->stamps.forward);
+			}
+			if (pinfo->stamps.read != 0) {
+				hist_add(&from_sensor, arrived - pinfo->stamps.read);
+			}
+		}
+	}
+
+	// Keep a partial frame for the next read
+	stream_consume(strm, offset);
+}
+
+/**
+ * Prints the latency of the alarms received, if any arrived since the
+ * last report.
+ */
+void print_latency() {
+	if (from_parent.count + from_sensor.count == reported) {
+		return;
+	}
+	hist_print("Cloud", "parent -> cloud", &from_parent);
+	hist_print("Cloud", "sensor -> cloud", &from_sensor);
+	reported = from_parent.count + from_sensor.count;
+}
+
 int main(int argc, char *argv[]) {
-	int server_fifo_id;
-	struct proc_info pinfo;
+	long long int next_report = latency_now() + LATPERIOD * 1000LL, wait;
+	int server_fifo_id, keep_open_id, ready, nread, i;
+	struct epoll_event event, events[MAXEVENTS];
+	static stream server;
+	client *cli;
 
 	// Set up the signal handler
 	struct sigaction new_signal;
@@ -51,29 +230,78 @@ int main(int argc, char *argv[]) {
 	}
 	printf("[INIT] Server FIFO created successfully...\n");
 
-	// Open the server FIFO in read only mode
-	server_fifo_id = open(SERVER_FIFO_NAME, O_RDONLY);
-	if (server_fifo_id == -1) {
-		// If there was an interrupt let the handler deal with it
-		if (errno != EINTR) {
-			fprintf(stderr, "[ERROR] Could not open server FIFO: %d\n", errno);
-	    	exit(FIOPERR);
-		}
+	if (!open_store(&history, STOREDIR, 1)) {
+		fprintf(stderr, "[ERROR] Could not open record store %s\n", STOREDIR);
+		unlink(SERVER_FIFO_NAME);
+		exit(STOREERR);
+	}
+	printf("[INIT] Record store opened with %d segments...\n", history.nsegs);
+
+	// Open the server FIFO in read only mode without waiting for a controller, and
+	// hold a write end ourselves so it never reads end of file between controllers
+	server_fifo_id = open(SERVER_FIFO_NAME, O_RDONLY | O_NONBLOCK);
+	keep_open_id = open(SERVER_FIFO_NAME, O_WRONLY);
+	if (server_fifo_id == -1 || keep_open_id == -1) {
+		fprintf(stderr, "[ERROR] Could not open server FIFO: %d\n", errno);
+		exit(FIOPERR);
+	}
+	init_stream(&server, server_fifo_id);
+
+	epoll_id = epoll_create1(0);
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_id == -1 || epoll_ctl(epoll_id, EPOLL_CTL_ADD, server_fifo_id, &event) == -1) {
+		fprintf(stderr, "[ERROR] Could not watch server FIFO: %d\n", errno);
+		exit(FIOPERR);
 	}
 	printf("[INIT] Starting read on server FIFO...\n");
+	if (!log_init()) {
+		exit(INITERR);
+	}
 
 	while(running) {
-		if (read(server_fifo_id, &pinfo, sizeof(pinfo)) > 0) {
-			printf("[DATA] Controller sent data from PID %d (%s), device type %c, "
-					"with data %d and threshold %ld\n", pinfo.pid, pinfo.name, pinfo.device, pinfo.data,
-					pinfo.threshold);
+		// Block until a controller says hello or sends something, or the next report is due
+		wait = (next_report - latency_now()) / 1000;
+		ready = epoll_wait(epoll_id, events, MAXEVENTS, wait < 0 ? 0 : wait);
+		if (latency_now() >= next_report) {
+			print_latency();
+			next_report += LATPERIOD * 1000LL;
+		}
+		if (ready == -1) {
+			if (errno != EINTR) {
+				log_error("[ERROR] Could not wait on FIFOs: %d\n", errno);
+				running = 0;
+			}
+			continue;
+		}
+
+		// One read for each ready FIFO, then back to waiting on all of them
+		for (i = 0; i < ready; i++) {
+			cli = events[i].data.ptr;
+			if (cli == NULL) {
+				if (stream_read(&server) > 0) {
+					handle_frames(&server, 0);
+				}
+				continue;
+			}
+
+			nread = stream_read(&cli->strm);
+			if (nread > 0) {
+				handle_frames(&cli->strm, cli->pid);
+			} else if (nread == 0 || errno != EAGAIN) {
+				// Controller closed its end of the FIFO
+				remove_client(cli);
+			}
 		}
 	}
 
 	// Unlink the FIFO and release resources
+	print_latency();
 	printf("[STOPPING] Closing server FIFO...\n");
+	close(epoll_id);
+	close(keep_open_id);
 	close(server_fifo_id);
 	unlink(SERVER_FIFO_NAME);
+	close_store(&history);
 	exit(0);
 }
-
@@ -0,0 +1,199 @@
+/*
+ * codec.c
+ *
+ * Encodes and decodes a device's readings as described in codec.h. Bits
+ * are packed most significant first, a byte at a time.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include "codec.h"
+
+/**
+ * Appends the low nbits of value to the encoder's buffer.
+ */
+static void put_bits(encoder *enc, unsigned long long value, int nbits) {
+	int used, room, take;
+
+	while (nbits > 0) {
+		used = enc->bits & 7;
+		room = 8 - used;
+		take = nbits < room ? nbits : room;
+		if (used == 0) {
+			enc->buf[enc->bits >> 3] = 0;
+		}
+		enc->buf[enc->bits >> 3] |= ((value >> (nbits - take)) & ((1u << take) - 1)) << (room - take);
+		enc->bits += take;
+		nbits -= take;
+	}
+}
+
+/**
+ * Reads the next nbits from the decoder's buffer. Bits past its end read
+ * as zeros and leave the decoder past the end.
+ */
+static unsigned long long get_bits(decoder *dec, int nbits) {
+	unsigned long long value = 0;
+	int used, room, take;
+
+	if (dec->bits + nbits > dec->size * 8) {
+		dec->bits = dec->size * 8 + 1;
+		return 0;
+	}
+	while (nbits > 0) {
+		used = dec->bits & 7;
+		room = 8 - used;
+		take = nbits < room ? nbits : room;
+		value = (value << take) |
+				((dec->buf[dec->bits >> 3] >> (room - take)) & ((1u << take) - 1));
+		dec->bits += take;
+		nbits -= take;
+	}
+	return value;
+}
+
+/**
+ * Reads a prefix of up to max one bits ended by a zero bit.
+ *
+ * return: Number of one bits
+ */
+static int get_prefix(decoder *dec, int max) {
+	int ones = 0;
+
+	while (ones < max && get_bits(dec, 1)) {
+		ones++;
+	}
+	return ones;
+}
+
+/**
+ * Sign extends the low nbits of value.
+ */
+static long long sign_extend(unsigned long long value, int nbits) {
+	return (long long)(value << (64 - nbits)) >> (64 - nbits);
+}
+
+void init_encoder(encoder *enc, unsigned char *buf, long long size) {
+	enc->buf = buf;
+	enc->size = size;
+	enc->bits = 0;
+	enc->time = 0;
+	enc->delta = 0;
+	enc->data = 0;
+	enc->count = 0;
+}
+
+int encode_reading(encoder *enc, long long time, int data) {
+	long long delta = time - enc->time, dod = delta - enc->delta;
+	unsigned int diff = (unsigned int)data - (unsigned int)enc->data;
+	unsigned int zigzag = (diff << 1) ^ (unsigned int)((int)diff >> 31);
+
+	if (enc->bits + CODECMAXBITS > enc->size * 8) {
+		return 0;
+	}
+
+	if (dod == 0) {
+		put_bits(enc, 0, 1);
+	} else if (dod >= -64 && dod < 64) {
+		put_bits(enc, 2, 2);
+		put_bits(enc, dod, 7);
+	} else if (dod >= -256 && dod < 256) {
+		put_bits(enc, 6, 3);
+		put_bits(enc, dod, 9);
+	} else if (dod >= -2048 && dod < 2048) {
+		put_bits(enc, 14, 4);
+		put_bits(enc, dod, 12);
+	} else {
+		put_bits(enc, 15, 4);
+		put_bits(enc, dod, 64);
+	}
+
+	if (zigzag == 0) {
+		put_bits(enc, 0, 1);
+	} else if (zigzag < 1u << 6) {
+		put_bits(enc, 2, 2);
+		put_bits(enc, zigzag, 6);
+	} else if (zigzag < 1u << 13) {
+		put_bits(enc, 6, 3);
+		put_bits(enc, zigzag, 13);
+	} else {
+		put_bits(enc, 7, 3);
+		put_bits(enc, diff, 32);
+	}
+
+	enc->time = time;
+	enc->delta = delta;
+	enc->data = data;
+	enc->count++;
+	return 1;
+}
+
+long long encoded_bytes(encoder *enc) {
+	return (enc->bits + 7) / 8;
+}
+
+void init_decoder(decoder *dec, const unsigned char *buf, long long size, int count) {
+	dec->buf = buf;
+	dec->size = size;
+	dec->bits = 0;
+	dec->time = 0;
+	dec->delta = 0;
+	dec->data = 0;
+	dec->left = count;
+}
+
+int decode_reading(decoder *dec, long long *time, int *data) {
+	unsigned int zigzag, diff;
+
+	if (dec->left == 0) {
+		return 0;
+	}
+	dec->left--;
+
+	switch (get_prefix(dec, 4)) {
+	case 0:
+		break;
+	case 1:
+		dec->delta += sign_extend(get_bits(dec, 7), 7);
+		break;
+	case 2:
+		dec->delta += sign_extend(get_bits(dec, 9), 9);
+		break;
+	case 3:
+		dec->delta += sign_extend(get_bits(dec, 12), 12);
+		break;
+	default:
+		dec->delta += (long long)get_bits(dec, 64);
+		break;
+	}
+	dec->time += dec->delta;
+
+	switch (get_prefix(dec, 3)) {
+	case 0:
+		diff = 0;
+		break;
+	case 1:
+		zigzag = get_bits(dec, 6);
+		diff = (zigzag >> 1) ^ -(zigzag & 1);
+		break;
+	case 2:
+		zigzag = get_bits(dec, 13);
+		diff = (zigzag >> 1) ^ -(zigzag & 1);
+		break;
+	default:
+		diff = get_bits(dec, 32);
+		break;
+	}
+	dec->data = (int)((unsigned int)dec->data + diff);
+
+	// The reading was cut off by the end of the buffer
+	if (dec->bits > dec->size * 8) {
+		dec->left = 0;
+		return 0;
+	}
+
+	*time = dec->time;
+	*data = dec->data;
+	return 1;
+}
@@ -0,0 +1,68 @@
+/*
+ * codec.h
+ *
+ * Header file for the compressed encoding of a device's readings. Readings
+ * are written as a stream of bits, each one only as long as it needs to be
+ * to tell it apart from the reading before it:
+ *
+ *   time  Delta of the delta from the previous reading's time, which is
+ *         zero for a sensor reading on a steady period.
+ *            0                     no change
+ *            10   + 7 bits         -64 to 63
+ *            110  + 9 bits         -256 to 255
+ *            1110 + 12 bits        -2048 to 2047
+ *            1111 + 64 bits        anything else
+ *
+ *   data  Difference from the previous reading's data, zigzagged so small
+ *         differences of either sign have few bits.
+ *            0                     no change
+ *            10   + 6 bits
+ *            110  + 13 bits
+ *            111  + 32 bits        the difference as it is
+ *
+ * The first reading is encoded against a time and data of zero. A stream
+ * can be decoded from its start while it is still being written. Decoders
+ * never read past the bytes they are given, a reading that would end past
+ * them is not decoded.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+// Most bits one reading can take, encoders stop before a reading this
+// size would not fit
+#define CODECMAXBITS (4 + 64 + 3 + 32)
+
+// Bytes needed to be sure count readings fit
+#define CODECBYTES(count) (((long long)(count) * CODECMAXBITS + 7) / 8)
+
+typedef struct encoder {
+	unsigned char *buf;
+	long long size;		// Bytes in the buffer
+	long long bits;		// Bits written
+	long long time;		// Previous reading's time
+	long long delta;	// Previous reading's time less the one before it
+	int data;			// Previous reading's data
+	int count;			// Readings written
+} encoder;
+
+typedef struct decoder {
+	const unsigned char *buf;
+	long long size;		// Bytes in the buffer
+	long long bits;		// Bits read, past the end once a reading ran over it
+	long long time;
+	long long delta;
+	int data;
+	int left;			// Readings still to decode
+} decoder;
+
+extern void init_encoder(encoder *enc, unsigned char *buf, long long size);
+extern int encode_reading(encoder *enc, long long time, int data);
+extern long long encoded_bytes(encoder *enc);
+extern void init_decoder(decoder *dec, const unsigned char *buf, long long size, int count);
+extern int decode_reading(decoder *dec, long long *time, int *data);
+
+#endif /* CODEC_H_ */
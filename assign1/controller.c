@@ -5,97 +5,321 @@
  *
  * The child process reads from the message queue all device data and
  * handles alarms being sent to actuators to trigger an action. Also
- * sends alarm to parent and sends data via the message queue.
+ * sends alarm to parent through a pipe.
+ *
+ * Started with the optional transport 'shm', the controller also creates a
+ * shared memory ring that sensors push their readings into instead of the
+ * message queue. The child drains the ring in bulk before each receive.
+ *
+ * Given a number of workers, the controller forks that many children and
+ * shards the devices over them by PID. Each worker has its own registry,
+ * queue and ring, so readings are handled on as many cores as there are
+ * workers. The first worker reads the main queue and passes registrations
+ * and quits on: a sensor goes only to its home worker, whose queue it is
+ * told to send readings to in the acknowledge, and an actuator goes to
+ * every worker so any of them can send it an action. Acknowledges, stops
+ * and actions go the other way on the mail queue, to each device's mailbox,
+ * or to the inbox queue of its own an actuator registers with, so neither
+ * a worker nor a device receiving ever looks past messages meant for the
+ * other direction or another device.
+ *
+ * Smoke sensors send their readings to their worker's alarm lane, a queue
+ * of its own, and ring the worker's queue after each. A worker takes all
+ * that is on its lane after every LANEPOLL messages, every LANEFRAMES ring
+ * frames and every ring of its queue, so a smoke alarm waits behind at most
+ * that many temperature readings however deep the backlog.
+ *
+ * A worker takes every init already waiting on its queue in one go, so a
+ * storm of devices registering at once is not spread over passes of its
+ * loop. A device restarting with the session token from its acknowledge
+ * (see session.h) is moved over to its new PID and acknowledged under the
+ * handle it had.
+ *
+ * Each worker checkpoints its registry and windows and journals the devices
+ * registered in between (see snapshot.h). A controller started after one
+ * crashed or was sent SIGTERM restores them and carries on in its session
+ * on the queues and rings it left, so running devices don't notice.
+ *
+ * Readings are checked against the alarm rules from an optional rule file
+ * (see rules.h), by default a reading raises an alarm above its sensor's
+ * threshold. Batches are checked all at once. A sensor only raises its
+ * first alarm in each quiet period and every actuator has a rate limit
+ * (see limit.h), so a sensor hovering at its level can't cause a storm.
+ *
+ * Alarms are stamped with the time they pass each hop (see trace in
+ * message.h). Workers time the hops from the sensor to the actuator's
+ * acknowledge and the parent the hop to the cloud, and each prints the
+ * percentiles of its hops every LATPERIOD milliseconds and when it closes.
+ *
+ * Workers and the parent print what they handle through the logger (see
+ * log.h), so a slow terminal never holds up a message.
+ *
+ * Workers and the parent count what they do in a shared memory segment
+ * (see metrics.h) that the stats program reads while the controller runs.
+ *
+ * Each worker also keeps a sliding window over every sensor's last
+ * readings in memory it shares with the parent (see window.h). Every
+ * AGGPERIOD milliseconds the parent reads the mean, minimum, maximum and
+ * percentiles of each window and forwards them to the cloud.
  *
  * Parent process will start monitoring after Control+C is pressed.
- * It then waits for alarm to be sent from the child process and will
- * print the alarm data from the message queue. Will communicate it to the
- * cloud via server FIFO.
+ * It then blocks on the alarm pipe from the child process, reading as many
+ * alarms as are waiting at once, and will print the alarm data. Will
+ * communicate it to the cloud via its own client FIFO, announced to the
+ * cloud on the server FIFO, one frame per batch of alarms. If the cloud
+ * falls behind, frames wait in the parent until its buffer fills, then
+ * the parent stops reading alarms so the child blocks.
  *
  *  Created on: Oct 3, 2015
  *      Author: Nicolas McCallum 100936816
  */
 
 #include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <limits.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include "message.h"
+#include "registry.h"
+#include "pending.h"
+#include "ring.h"
+#include "stream.h"
+#include "rules.h"
+#include "window.h"
+#include "latency.h"
+#include "metrics.h"
+#include "log.h"
+#include "snapshot.h"
 
-// Define max registered devices at one time to be 15
-#define MAX_DEVICES 15
-
-static int message_sent = 0;
 static int started = 0;
 static int running = 1;
-proc_info device_list[MAX_DEVICES];
-int devices = 0;
+static int handover = 0;
+// Most alarms the parent takes from the alarm pipe in one read
+#define ALARMBATCH 64
+
+// Milliseconds between the aggregates the parent sends the cloud
+#define AGGPERIOD 5000
+
+// Most inits a worker takes off its queue in one go during a registration storm,
+// and microseconds to wait for room on the mail queue for acknowledges
+#define REGBATCH 256
+#define ACKRETRY 1000
+
+// Messages a worker handles, and frames it takes from the ring, between looks
+// at its alarm lane when no doorbell says something is waiting there
+#define LANEPOLL 16
+#define LANEFRAMES 256
+
+// Hops of an alarm the workers and parent time
+#define HOPREAD 0		// Sensor sent the reading until its worker received it
+#define HOPDISPATCH 1	// Worker received the reading until it sent the action
+#define HOPACTION 2		// Worker sent the action until the actuator acknowledged
+#define HOPACK 3		// Actuator acknowledged until its worker received that
+#define HOPFORWARD 4	// Worker received the reading until the parent sent the alarm on
+#define HOPS 5
+
+// Receive buffer large enough for any message the child reads
+union child_msg {
+	long int msg_type;
+	struct proc_msg proc;
+	struct frame_msg frame;
+	struct batch_msg batch;
+};
+
+registry devices;
+rule_set rules;
+pending actions;
+long long int timer_deadline = -1;
+ring *readings = NULL;
 int msgid;
+int mail;
+int alarm_pipe[2];
+
+// Session devices resume under after a restart, new each time the controller starts
+unsigned int session;
+
+// Acknowledges waiting for room on the mail queue, from acks_head on
+struct proc_msg *acks = NULL;
+int acks_head = 0, acks_count = 0, acks_capacity = 0;
+
+// Workers and the queue and ring of each, a worker's own are msgid and readings
+int shard = 0;
+int nshards = 1;
+int queues[MAXSHARDS];
+int lanes[MAXSHARDS];
+int lane;
+int shmids[MAXSHARDS];
+ring *rings[MAXSHARDS];
+window *windows[MAXSHARDS];
+
+// Checkpoint and journal of each worker, and this worker's own
+snapshot snaps[MAXSHARDS];
+snapshot *state;
+
+// Metrics the stats program reads, and this worker's slot of them
+metrics *stats;
+int stats_shmid;
+worker_metrics *mine;
+
+// Latency of each hop, and when the message being handled was received
+histogram hops[HOPS];
+const char *hop_names[HOPS] = {"sensor -> worker", "worker -> action sent", "action -> actuator ack",
+		"actuator ack -> worker", "worker -> parent -> cloud"};
+unsigned long long hops_reported[HOPS];
+long long int received_at;
 
 /**
- * Adds device to device list given the message from the message queue.
+ * Returns the worker that keeps a sensor and receives its readings.
+ */
+int home_shard(pid_t pid) {
+	return ((unsigned int)pid * 2654435761u >> 16) % nshards;
+}
+
+/**
+ * Returns the worker that keeps a device sending a message. A device that
+ * was acknowledged in this session stays with the worker named in the
+ * acknowledge, even once it restarts under a PID that hashes elsewhere.
  *
- * param msg: Message from message queue to add to device list.
+ * param info: Init or quit from the device.
  */
-void add_device(struct proc_msg msg) {
-    int i;
-    char flag = 0;
+int device_home(proc_info *info) {
+	if (info->session == session && info->shard >= 0 && info->shard < nshards) {
+		return info->shard;
+	}
+	return home_shard(info->pid);
+}
 
-    // Check if the device is registered in the device list yet
-    for (i = 0; i < devices; i++) {
-        if (device_list[i].pid == msg.pinfo.pid) {
-            flag = 1;
-            break;
-        }
-    }
+/**
+ * Returns the windows in use, one for each slot of the registry up to the
+ * windows in the slab.
+ */
+int window_count() {
+	return devices.capacity < WINDOWSLOTS ? devices.capacity : WINDOWSLOTS;
+}
 
-    // Add to the list if it doesn't already exist
-    if (!flag) {
-        // Update the info
-    	device_list[devices] = msg.pinfo;
-        //device_list[devices].device = msg.pinfo.device;
-        //device_list[devices].pid = msg.pinfo.pid;
-        //device_list[devices].threshold = msg.pinfo.threshold;
-        //strcpy(device_list[devices].name, msg.pinfo.name);
-
-        // Alert user that device was registered
-        printf("[Device Registered] PID: %d, Type: %c, Threshold: %ld, Name: %s\n",
-        		device_list[devices].pid,device_list[devices].device,
-				device_list[devices].threshold, device_list[devices].name);
-
-    	// Increase the devices counter
-        devices++;
-    }
+/**
+ * Starts the rule, alarm and rate limit state of a device just added to the
+ * registry, and its window if it is a sensor. A sensor past the last window
+ * is counted and reported, it has no aggregates.
+ *
+ * param i: Registry slot of the device.
+ */
+void reset_device(int i) {
+	device *dev = &devices.slots[i];
+	action_limit *limit;
+
+	dev->rule = rules_attach(&rules, &dev->state, dev->info.name, dev->info.device);
+	limit_reset(&dev->limit);
+	if ((limit = rules_limit(&rules, dev->info.device)) != NULL) {
+		bucket_reset(&dev->tokens, limit, now_ms());
+	}
+
+	// The registry may have grown, the parent reads as many windows as it has slots
+	mine->windows = window_count();
+	if (dev->info.device != TEMP_SENSOR_TYPE && dev->info.device != SMOKE_SENSOR_TYPE) {
+		return;
+	}
+	if (i < WINDOWSLOTS) {
+		window_attach(&windows[shard][i], &dev->info);
+	} else {
+		mine->unwindowed++;
+		log_warn("[WARNING] Sensor %s [%d] is past the %d windows of worker %d, it has no aggregates\n",
+				dev->info.name, dev->info.pid, WINDOWSLOTS, shard);
+	}
 }
 
 /**
- * Removes device from the registered device list given the process ID
- * of the device.
+ * Adds device to the registry given the message from the message queue.
+ * The device is journaled before it is acknowledged, so a controller that
+ * restarts after has it too.
  *
- * param pid: PID of the device to remove.
+ * param msg: Message from message queue to add to the registry.
+ * return: Registry slot of the device
  */
-void remove_device(pid_t pid) {
+int add_device(struct proc_msg msg) {
 	int i;
-	char flag = 0;
 
-	// Check for the device in the array
-	for (i = 0; i < devices; i++) {
-		if (device_list[i].pid == pid) {
-			flag = 1;
-		    break;
+	// Add to the registry if it doesn't already exist
+	i = registry_find(&devices, msg.pinfo.pid);
+	if (i == -1) {
+		i = registry_add(&devices, &msg.pinfo);
+		if (i == -1) {
+			exit(MEMERR);
 		}
+		reset_device(i);
+		snapshot_log(state, JOURNALADD, i, &msg.pinfo);
+
+		// Alert user that device was registered
+		log_info("[Device Registered] PID: %d, Type: %c, Threshold: %ld, Name: %s\n",
+				devices.slots[i].info.pid, devices.slots[i].info.device,
+				devices.slots[i].info.threshold, devices.slots[i].info.name);
 	}
+	return i;
+}
+
+/**
+ * Removes device from the registry given the process ID of the device.
+ *
+ * param pid: PID of the device to remove.
+ */
+void remove_device(pid_t pid) {
+	int i = registry_find(&devices, pid);
 
-	// If the devices exists remove it and shift N-1 to the index of the deleted item
-	if (flag) {
+	// If the devices exists remove it
+	if (i != -1) {
 		// Alert user that device was deleted
-		printf("[Device Stopped] PID: %d, Type: %c, Threshold: %ld, Name: %s\n",
-				device_list[i].pid, device_list[i].device, device_list[i].threshold,
-				device_list[i].name);
-		device_list[i] = device_list[devices - 1];
+		log_info("[Device Stopped] PID: %d, Type: %c, Threshold: %ld, Name: %s\n",
+				devices.slots[i].info.pid, devices.slots[i].info.device,
+				devices.slots[i].info.threshold, devices.slots[i].info.name);
+		if (i < WINDOWSLOTS) {
+			window_detach(&windows[shard][i]);
+		}
+		snapshot_log(state, JOURNALREMOVE, i, &devices.slots[i].info);
+		registry_remove(&devices, pid);
+	}
+}
 
-		// Decrease counter
-		devices--;
+/**
+ * Sends a message to a device's mailbox, in the device's own inbox if it
+ * has one and on the mail queue otherwise.
+ *
+ * param msg: Message addressed to the device's mailbox.
+ * param inbox: Inbox of the device, -1 if it has none.
+ * param flags: IPC_NOWAIT to not wait for room.
+ * return: 1 if sent, 0 if there was no room, -1 if the device's inbox is gone
+ */
+int send_mail(struct proc_msg *msg, int inbox, int flags) {
+	if (msgsnd(inbox != -1 ? inbox : mail, (void *)msg, sizeof(msg->pinfo), flags) == 0) {
+		return 1;
+	}
+	if (errno == EAGAIN) {
+		return 0;
+	}
+
+	// An actuator removes its inbox when it quits
+	if (inbox != -1 && (errno == EINVAL || errno == EIDRM)) {
+		return -1;
+	}
+	log_error("[ERROR] Could not send mail to PID %ld: %d\n", msg->msg_type - MBOXBASE, errno);
+	exit(MQSERR);
+}
+
+/**
+ * Removes the inbox of an actuator that died without removing it, which
+ * would otherwise be left in the kernel for good.
+ *
+ * param info: Actuator being stopped.
+ */
+void drop_inbox(proc_info *info) {
+	if (info->inbox != -1 && kill(info->pid, 0) == -1 && errno == ESRCH &&
+			msgctl(info->inbox, IPC_RMID, 0) == 0) {
+		log_info("[STOPPING] Removed inbox %d of dead actuator %s [%d]\n", info->inbox,
+				info->name, info->pid);
 	}
 }
 
@@ -107,40 +331,80 @@ void remove_device(pid_t pid) {
  */
 void send_stop(pid_t pid) {
 	struct proc_msg msg;
+	int i = registry_find(&devices, pid);
 
 	// Send the message to the device process with the stop code
-	msg.msg_type = pid;
+	msg.msg_type = MBOX(pid);
 	msg.pinfo.data = STOPCODE;
 
-	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
-		fprintf(stderr, "[ERROR] Stop signal failed to be sent to PID %d: %d\n",
-                pid, errno);
-		exit(MQSERR);
+	if (send_mail(&msg, i != -1 ? devices.slots[i].info.inbox : -1, 0) == -1) {
+		log_error("[ERROR] Stop signal failed to be sent to PID %d, its inbox is gone\n", pid);
+	} else if (i != -1) {
+		drop_inbox(&devices.slots[i].info);
 	}
 
 	// Delete PID from list
 	remove_device(pid);
 }
 
+/**
+ * Sends the acknowledges waiting for room on the mail queue, oldest first,
+ * until the queue is full again.
+ */
+void flush_acks() {
+	struct proc_msg *msg;
+	int sent;
+
+	while (acks_head < acks_count) {
+		msg = &acks[acks_head];
+		sent = send_mail(msg, msg->pinfo.inbox, IPC_NOWAIT);
+		if (sent == 0) {
+			return;
+		} else if (sent == -1) {
+			log_error("[ERROR] Acknowledge signal failed to be sent to PID %d, its inbox is gone\n",
+					msg->pinfo.pid);
+		} else {
+			log_info("[DEVICE INIT] Sent acknowledge signal for PID %d (Name: %s)!\n",
+					msg->pinfo.pid, msg->pinfo.name);
+		}
+		acks_head++;
+	}
+	acks_head = acks_count = 0;
+}
+
 /**
  * Sends acknowledge signal back to device via the message queue so the
- * device can start reading data.
+ * device can start reading data. The acknowledge carries the handle the
+ * device sends its readings under and the worker it sends them to.
+ *
+ * The worker never waits for room on the mail queue to acknowledge: during
+ * a registration storm the queue can fill with acknowledges devices have
+ * not taken yet, so acknowledges that don't fit wait in order until they
+ * do, while the worker carries on taking inits off its own queue.
  *
  * param msg: Initialization message from the device to send back with
  *            acknowledge signal.
  */
 void send_ack(struct proc_msg msg) {
+	struct proc_msg *grown;
+
 	// Send the message to the device with the acknowledge code
-    msg.msg_type = msg.pinfo.pid;
+    msg.msg_type = MBOX(msg.pinfo.pid);
     msg.pinfo.data = ACKCODE;
+    msg.pinfo.shard = shard;
+    msg.pinfo.session = session;
 
-    if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
-		fprintf(stderr, "[ERROR] Acknowledge signal failed to be sent to PID %d: %d\n",
-				msg.pinfo.pid, errno);
-	    exit(MQSERR);
-	}
-    printf("[DEVICE INIT] Sent acknowledge signal for PID %d (Name: %s)!\n",
-    		msg.pinfo.pid, msg.pinfo.name);
+    if (acks_count == acks_capacity) {
+    	grown = realloc(acks, sizeof(struct proc_msg) * (acks_capacity ? acks_capacity * 2 : REGBATCH));
+    	if (grown == NULL) {
+    		log_error("[ERROR] Could not hold acknowledge for PID %d: %d\n", msg.pinfo.pid, errno);
+    		exit(MEMERR);
+    	}
+    	acks = grown;
+    	acks_capacity = acks_capacity ? acks_capacity * 2 : REGBATCH;
+    }
+    acks[acks_count++] = msg;
+    flush_acks();
 }
 
 /**
@@ -148,8 +412,10 @@ void send_ack(struct proc_msg msg) {
  * interrupt signal sent (Controler+C) and stop the child and parent
  * processes on the second interrupt signal.
  *
- * Also checks for alarm signal and sets static flag for parent to
- * read the message from the child off the message queue.
+ * Also catches the alarm signal from the child's action timeout timer,
+ * which only needs to interrupt the blocking receive, and the terminate
+ * signal, which stops the controller leaving its queues and state for the
+ * next one to take over.
  *
  * param signum: Signal identifier to check for
  */
@@ -157,9 +423,14 @@ void alarm_handler(int signum) {
 	// Check the interrupt
 	switch(signum) {
 
-	// Alarm sent from child
+	// Action timer ran out in the child
 	case SIGALRM:
-		message_sent = 1;
+		break;
+
+	// Restart, the next controller carries on with the devices
+	case SIGTERM:
+		handover = 1;
+		running = 0;
 		break;
 
 	// Control+C was pressed
@@ -194,35 +465,63 @@ char get_actuator_code(char device) {
  * and sends an action for it to perform. If actuator not found
  * program will display an error but continue to run.
  *
- * If actuator is found, after sending the action to perform it
- * waits until acknowledgment is sent back from device.
+ * When several actuators of the type are registered, the one with the
+ * least outstanding actions is used, round robin between equals. The
+ * action is dropped if that actuator is over its rate limit.
+ *
+ * The action is tracked in the pending table under a correlation ID and
+ * the child goes back to reading the queue, the acknowledge is matched
+ * when it arrives in handle_ack().
  *
  * param msg: Message that contains data > threshold from
  * 			  message queue.
+ * return: Time the action was sent, 0 if none was
  */
-void activate_actuator(struct proc_msg msg) {
-	// Set data to start
-	msg.pinfo.data = DATACODE;
-	msg.msg_type = -1;
-
+long long int activate_actuator(struct proc_msg msg) {
 	// Find PID of actuator if it exists otherwise print error
 	char actuator = get_actuator_code(msg.pinfo.device);
-	int i;
+	int i = registry_pick(&devices, actuator);
+	device *dev;
+
+	// Check that a match was found
+	if (i == -1) {
+		log_error("[ERROR] No actuator could be found for device %s\n",
+				msg.pinfo.name);
+		return 0;
+	}
 
-	for (i = 0; i < MAX_DEVICES; i++) {
-		// If we found the one we want, send the message to its PID
-		if (device_list[i].device == actuator) {
-			msg.msg_type = device_list[i].pid;
+	// Drop the action if the actuator was already sent its share, only saying
+	// so for the first action dropped so a storm doesn't flood the output too
+	dev = &devices.slots[i];
+	if (!bucket_take(&dev->tokens, rules_limit(&rules, actuator), now_ms())) {
+		mine->dropped++;
+		if (dev->tokens.dropped == 1) {
+			log_error("[ERROR] Actuator %s [%d] is over its rate limit, dropping actions\n",
+					dev->info.name, dev->info.pid);
 		}
+		return 0;
+	}
+	if (dev->tokens.dropped > 0) {
+		log_info("[CHILD] Actuator %s [%d] back under its rate limit, %d actions were dropped\n",
+				dev->info.name, dev->info.pid, dev->tokens.dropped);
+		dev->tokens.dropped = 0;
 	}
 
-	// Check that a match was found
-	if (msg.msg_type == -1) {
-		fprintf(stderr, "[ERROR] No actuator could be found for device %s\n",
-				msg.pinfo.name);
-		return;
+	// Track the action before sending so the acknowledge can always be matched
+	msg.pinfo.stamps.dispatch = latency_now();
+	if (msg.pinfo.stamps.receive != 0) {
+		hist_add(&hops[HOPDISPATCH], msg.pinfo.stamps.dispatch - msg.pinfo.stamps.receive);
+	}
+	msg.pinfo.seq = pending_add(&actions, i, devices.slots[i].info.pid, &msg.pinfo);
+	if (msg.pinfo.seq == -1) {
+		exit(MEMERR);
 	}
 
+	// Set data to start and send to the actuator's PID, which acknowledges to this worker
+	msg.pinfo.data = DATACODE;
+	msg.pinfo.shard = shard;
+	msg.msg_type = MBOX(devices.slots[i].info.pid);
+
 	// Send the appropriate action to the actuator
 	if (actuator == AC_ACTUATOR_TYPE) {
 		strcpy(msg.pinfo.action, "start ac");
@@ -230,170 +529,1061 @@ void activate_actuator(struct proc_msg msg) {
 		strcpy(msg.pinfo.action, "ring smoke alarm");
 	}
 
-	// Send the message over the message queue
-	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
-		fprintf(stderr, "[ERROR] Could not send message to actuator (PID %ld): %d\n",
-				msg.msg_type, errno);
-	    exit(MQSERR);
+	// Send the message to the actuator's inbox
+	if (send_mail(&msg, devices.slots[i].info.inbox, 0) == -1) {
+		log_error("[ERROR] Could not send action to actuator %s [%d], its inbox is gone\n",
+				dev->info.name, dev->info.pid);
+		pending_done(&actions, msg.pinfo.seq);
+		return 0;
 	}
+	devices.slots[i].outstanding++;
+	mine->actions++;
+	return msg.pinfo.stamps.dispatch;
+}
 
-	// Wait for the acknowledge signal back
-	if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), AACKCODE, 0) == -1) {
-	    fprintf(stderr, "[ERROR] Failed during receiving the acknowledge signal "
-	    		"from actuator (PID %ld): %d\n", msg.msg_type, errno);
-	    exit(MQRERR);
-	} else {
-		printf("[ACTUATOR ACKNOWLEDGE] Actuator %s [%d] sent acknowledge after performing action \"%s\"\n",
-				msg.pinfo.name, msg.pinfo.pid, msg.pinfo.action);
+/**
+ * Releases an action from the pending table and the actuator it was
+ * sent to, if the actuator is still registered.
+ *
+ * param act: Action to release.
+ */
+void release_action(action *act) {
+	device *dev = &devices.slots[act->slot];
+
+	if (dev->used && dev->info.pid == act->actuator) {
+		dev->outstanding--;
 	}
+	pending_done(&actions, act->seq);
 }
 
 /**
- * Sends message on the message queue for the parent to read and
- * sends alarm signal so the parent knows it should read message
- * from message queue.
+ * Matches an actuator's acknowledge to the action it was sent for.
+ *
+ * param msg: Acknowledge message from the actuator.
+ */
+void handle_ack(struct proc_msg msg) {
+	action *act = pending_find(&actions, msg.pinfo.seq);
+
+	// The action already timed out, nothing is waiting on it anymore
+	if (act == NULL) {
+		log_info("[ACTUATOR ACKNOWLEDGE] Late acknowledge from actuator %s [%d] ignored (ID %d)\n",
+				msg.pinfo.name, msg.pinfo.pid, msg.pinfo.seq);
+		return;
+	}
+
+	log_info("[ACTUATOR ACKNOWLEDGE] Actuator %s [%d] sent acknowledge after performing action \"%s\""
+			" for device %s\n", msg.pinfo.name, msg.pinfo.pid, msg.pinfo.action, act->alarm.name);
+
+	// Actuators built before tracing leave their hop unstamped
+	if (msg.pinfo.stamps.ack != 0) {
+		hist_add(&hops[HOPACTION], msg.pinfo.stamps.ack - act->alarm.stamps.dispatch);
+		hist_add(&hops[HOPACK], received_at - msg.pinfo.stamps.ack);
+	}
+	release_action(act);
+}
+
+/**
+ * Gives up on every action whose actuator did not acknowledge in time
+ * and arms the interval timer for the next deadline so a blocking
+ * receive is interrupted when it passes.
+ */
+void expire_actions() {
+	struct itimerval timer;
+	long long int now = now_ms(), deadline;
+	action *act;
+
+	while ((act = pending_expired(&actions, now)) != NULL) {
+		mine->timeouts++;
+		log_error("[ERROR] Actuator (PID %d) did not acknowledge action for device %s "
+				"within %dms (ID %d)\n", act->actuator, act->alarm.name, ACKTIMEOUT, act->seq);
+		release_action(act);
+	}
+
+	// Only touch the timer when the earliest deadline changed
+	deadline = pending_deadline(&actions);
+	if (deadline == timer_deadline) {
+		return;
+	}
+	timer_deadline = deadline;
+
+	memset(&timer, 0, sizeof(timer));
+	if (deadline != -1) {
+		timer.it_value.tv_sec = (deadline - now) / 1000;
+		timer.it_value.tv_usec = (deadline - now) % 1000 * 1000 + 1;
+	}
+	if (setitimer(ITIMER_REAL, &timer, NULL) == -1) {
+		log_error("[ERROR] Could not set action timeout timer: %d\n", errno);
+	}
+}
+
+/**
+ * Writes the alarm to the parent through the alarm pipe. Writes smaller
+ * than PIPE_BUF are atomic so alarms never interleave, and the write
+ * blocks rather than losing an alarm if the parent falls behind.
  *
  * param msg: Message to send to parent with alarm data.
  */
 void send_to_parent(struct proc_msg msg) {
-	// Add message to message queue with the action taken
-	msg.msg_type = PRNTCODE;
-	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
-		fprintf(stderr, "[ERROR] Could not send alarm message to parent: %d\n", errno);
-	    exit(MQSERR);
+	if (write(alarm_pipe[1], &msg.pinfo, sizeof(msg.pinfo)) != sizeof(msg.pinfo)) {
+		log_error("[ERROR] Could not send alarm to parent: %d\n", errno);
+	    exit(PIPEERR);
+	}
+	log_info("[CHILD] Sent alarm to parent...\n");
+}
+
+/**
+ * Checks readings from a sensor against its rule and adds them to its window.
+ * Alarms the sensor raises in its quiet period are suppressed.
+ *
+ * param slot: Registry slot of the sensor, -1 if it is not registered.
+ * param info: Details of the sensor.
+ * param data: Readings in the order they were taken.
+ * param count: Number of readings, at most MAXBATCH.
+ * return: Mask with bit i set if reading i raises an alarm
+ */
+unsigned long long check_readings(int slot, proc_info *info, const int *data, int count) {
+	unsigned long long alarms;
+	device *dev;
+	int suppressed, raised;
+	char active;
+
+	// Unregistered devices have no rule state, check them the original way
+	mine->readings += count;
+	if (slot == -1) {
+		mine->alarms += data[0] > info->threshold;
+		return data[0] > info->threshold;
+	}
+	dev = &devices.slots[slot];
+	if (slot < WINDOWSLOTS) {
+		window_add(&windows[shard][slot], data, count);
+	}
+	alarms = rules_check(&rules, dev->rule, &dev->state, info->threshold, data, count);
+
+	// Only the sensor's first alarm in its quiet period is raised. Report the
+	// alarms suppressed before this one, or all of them once it clears
+	active = dev->limit.active;
+	suppressed = dev->limit.suppressed;
+	raised = __builtin_popcountll(alarms);
+	alarms = limit_alarms(&dev->limit, rules.rules[dev->rule].quiet, alarms ? now_ms() : 0,
+			alarms, count);
+	mine->alarms += __builtin_popcountll(alarms);
+	mine->suppressed += raised - __builtin_popcountll(alarms);
+	if (active && !dev->limit.active) {
+		suppressed = dev->limit.suppressed;
+	}
+	if ((alarms || (active && !dev->limit.active)) && suppressed > 0) {
+		log_info("[CHILD] Suppressed %d repeat alarms from device [%d] %s\n",
+				suppressed, info->pid, info->name);
+		dev->limit.suppressed -= suppressed;
+	}
+	if (active && !dev->limit.active) {
+		log_info("[CHILD] Device [%d] %s is out of alarm\n", info->pid, info->name);
+	}
+	return alarms;
+}
+
+/**
+ * Handles a data message from a device. Prints the reading, activates the
+ * actuator and alerts the parent if the reading raises an alarm under the
+ * device's rule.
+ *
+ * param msg: Data message from the message queue.
+ * param slot: Registry slot of the device, -1 if it is not registered.
+ */
+void handle_data(struct proc_msg msg, int slot) {
+    // Print the info received from the device
+    log_info("[CHILD] Message received from device [%d] %s (type %c) with data %d (threshold %ld)\n",
+    		msg.pinfo.pid, msg.pinfo.name, msg.pinfo.device, msg.pinfo.data, msg.pinfo.threshold);
+
+    // Activate alarm if the rule says so, by default if the data > threshold
+    if (check_readings(slot, &msg.pinfo, &msg.pinfo.data, 1)) {
+    	msg.pinfo.stamps.dispatch = activate_actuator(msg);
+     	send_to_parent(msg);
+    }
+}
+
+/**
+ * Handles a compact frame from a sensor. The sensor's details come from
+ * the registry entry its handle resolves to.
+ *
+ * param finfo: Frame from the message queue.
+ * return: PID of the sensor, or -1 if the handle did not resolve
+ */
+pid_t handle_frame(frame_info *finfo) {
+	struct proc_msg msg;
+	int i = registry_resolve(&devices, finfo->handle);
+
+	// Frames only carry the handle so the device must still be registered
+	if (i == -1) {
+		log_error("[ERROR] Reading for unknown device handle %#x dropped\n", finfo->handle);
+		return -1;
+	}
+	msg.pinfo = devices.slots[i].info;
+	msg.pinfo.data = finfo->read.data;
+	memset(&msg.pinfo.stamps, 0, sizeof(trace));
+	msg.pinfo.stamps.read = READEXPAND(finfo->read.time, received_at);
+	msg.pinfo.stamps.receive = received_at;
+	hist_add(&hops[HOPREAD], received_at - msg.pinfo.stamps.read);
+
+	handle_data(msg, i);
+	return msg.pinfo.pid;
+}
+
+/**
+ * Handles a batch of readings from a sensor. The sensor's details come
+ * from the registry entry its handle resolves to and the whole batch is
+ * checked against its rule at once.
+ *
+ * param binfo: Batch from the message queue.
+ * return: PID of the sensor, or -1 if the handle did not resolve
+ */
+pid_t handle_batch(batch_info *binfo) {
+	struct proc_msg msg;
+	int i = registry_resolve(&devices, binfo->handle), j, count;
+	int data[MAXBATCH];
+	unsigned long long alarms;
+
+	// Batches only carry the handle so the device must still be registered
+	if (i == -1) {
+		log_error("[ERROR] Batch of %d readings for unknown device handle %#x dropped\n",
+				binfo->count, binfo->handle);
+		return -1;
+	}
+	msg.pinfo = devices.slots[i].info;
+
+	log_info("[CHILD] Batch of %d readings received from device [%d] %s (type %c) (threshold %ld)\n",
+			binfo->count, msg.pinfo.pid, msg.pinfo.name, msg.pinfo.device, msg.pinfo.threshold);
+
+	count = binfo->count < MAXBATCH ? binfo->count : MAXBATCH;
+	if (count < 1) {
+		return msg.pinfo.pid;
+	}
+	for (j = 0; j < count; j++) {
+		data[j] = binfo->readings[j].data;
+		hist_add(&hops[HOPREAD], received_at - READEXPAND(binfo->readings[j].time, received_at));
+	}
+	memset(&msg.pinfo.stamps, 0, sizeof(trace));
+	msg.pinfo.stamps.receive = received_at;
+
+	alarms = check_readings(i, &msg.pinfo, data, count);
+	for (j = 0; j < count; j++) {
+		if ((alarms >> j) & 1) {
+			msg.pinfo.data = data[j];
+			msg.pinfo.stamps.read = READEXPAND(binfo->readings[j].time, received_at);
+			msg.pinfo.stamps.dispatch = activate_actuator(msg);
+			send_to_parent(msg);
+		}
+	}
+	return msg.pinfo.pid;
+}
+
+/**
+ * Handles a message of readings, whichever form they came in.
+ *
+ * param buf: Data, frame or batch message.
+ * return: PID of the sensor, or -1 if it is unknown
+ */
+pid_t handle_readings(union child_msg *buf) {
+	switch (buf->msg_type) {
+
+	// Reading from a device with all its details
+	case DATACODE:
+		buf->proc.pinfo.stamps.receive = received_at;
+		handle_data(buf->proc, registry_find(&devices, buf->proc.pinfo.pid));
+		return buf->proc.pinfo.pid;
+
+	// Reading from a registered sensor
+	case FRAMCODE:
+		return handle_frame(&buf->frame.finfo);
+
+	// Several readings from a registered sensor
+	case BTCHCODE:
+		return handle_batch(&buf->batch.binfo);
+	}
+	return -1;
+}
+
+/**
+ * Handles every reading waiting in the alarm lane, so smoke readings are
+ * never held up by the temperature readings waiting on the worker's queue.
+ *
+ * return: Number of messages handled
+ */
+int drain_lane() {
+	union child_msg buf;
+	int handled = 0;
+
+	while (msgrcv(lane, (void *)&buf, sizeof(buf) - sizeof(long int), -CHILDCODE, IPC_NOWAIT) != -1) {
+		received_at = latency_now();
+		mine->lane++;
+		if (buf.msg_type >= INITCODE && buf.msg_type <= CHILDCODE) {
+			mine->messages[METRICTYPE(buf.msg_type)]++;
+		}
+		handle_readings(&buf);
+		handled++;
+	}
+	return handled;
+}
+
+/**
+ * Handles the frames waiting in the shared memory ring. At most one ring's
+ * worth is taken at a time so sensors that keep it full can't hold off
+ * the messages on the queue, and the alarm lane is looked at every
+ * LANEFRAMES frames.
+ *
+ * return: Number of frames handled
+ */
+int drain_ring() {
+	frame_info frame;
+	int frames = 0;
+
+	while (frames < readings->size && ring_pop(readings, &frame)) {
+		received_at = latency_now();
+		handle_frame(&frame);
+		if (++frames % LANEFRAMES == 0) {
+			drain_lane();
+		}
+	}
+	return frames;
+}
+
+/**
+ * Passes a registration or quit from the main queue on to the workers that
+ * keep the device. Sensors are kept only by their home worker and
+ * actuators by every worker. Only the first worker reads the main queue,
+ * the others keep everything they receive.
+ *
+ * param msg: Init or quit message from a device.
+ * return: 1 if this worker keeps the device too, 0 if not
+ */
+int route_device(struct proc_msg msg) {
+	int actuator = msg.pinfo.device == AC_ACTUATOR_TYPE || msg.pinfo.device == BELL_ACTUATOR_TYPE;
+	int home = device_home(&msg.pinfo), s;
+
+	if (shard != 0) {
+		return 1;
+	}
+
+	for (s = 1; s < nshards; s++) {
+		if ((actuator || s == home) && msgsnd(queues[s], (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+			log_error("[ERROR] Could not pass device %d on to worker %d: %d\n",
+					msg.pinfo.pid, s, errno);
+			exit(MQSERR);
+		}
+	}
+	return actuator || home == 0;
+}
+
+/**
+ * Moves a device that restarted over to its new PID if it is still
+ * registered under its old one in this session and the old PID is gone.
+ * Sensors must also give the handle they had, which this worker gave out.
+ * A second device started under the name of a running one registers anew
+ * rather than taking over the running one's slot.
+ *
+ * param info: Init from the device carrying its session token.
+ * return: 1 if the device resumed, 0 if it has to register in full
+ */
+int resume_device(proc_info *info) {
+	device *dev;
+	int i;
+
+	if (info->session != session || (i = registry_find(&devices, info->previous)) == -1) {
+		return 0;
+	}
+	dev = &devices.slots[i];
+	if (dev->info.device != info->device || strcmp(dev->info.name, info->name) != 0) {
+		return 0;
+	}
+	if (kill(info->previous, 0) == 0 || errno != ESRCH) {
+		return 0;
+	}
+	if ((info->device == TEMP_SENSOR_TYPE || info->device == SMOKE_SENSOR_TYPE) &&
+			registry_handle(&devices, i) != info->handle) {
+		return 0;
+	}
+
+	registry_rekey(&devices, i, info->pid);
+	dev->info.inbox = info->inbox;
+	if (i < WINDOWSLOTS && dev->info.device != AC_ACTUATOR_TYPE &&
+			dev->info.device != BELL_ACTUATOR_TYPE) {
+		window_rekey(&windows[shard][i], info->pid);
+	}
+	snapshot_log(state, JOURNALREKEY, i, info);
+	mine->resumed++;
+	log_info("[Device Resumed] PID: %d (was %d), Type: %c, Name: %s\n", info->pid, info->previous,
+			info->device, info->name);
+	return 1;
+}
+
+/**
+ * Registers a device, or resumes it if it restarted with a session token,
+ * and acknowledges it if this is the device's home worker. A resumed device
+ * waits for the acknowledge too, so it never sends under a handle or to a
+ * worker this controller doesn't know it by.
+ *
+ * param msg: Init message from the device.
+ */
+void register_device(struct proc_msg msg) {
+	if (!route_device(msg)) {
+		return;
 	}
 
-    kill(getppid(), SIGALRM);
-	printf("[CHILD] Sent alarm to parent...\n");
-	return;
+	// A token that didn't resume is no use, the device is registered as new
+	if (msg.pinfo.session == 0 || !resume_device(&msg.pinfo)) {
+		msg.pinfo.handle = registry_handle(&devices, add_device(msg));
+		if (device_home(&msg.pinfo) == shard) {
+			mine->registered++;
+		}
+	}
+	if (device_home(&msg.pinfo) == shard) {
+		send_ack(msg);
+	}
+}
+
+/**
+ * Registers a device and then every other init already waiting on the
+ * queue, up to REGBATCH of them, so a storm of devices registering at once
+ * is taken in one go rather than one per pass around the worker's loop.
+ *
+ * param msg: First init message.
+ */
+void register_devices(struct proc_msg msg) {
+	struct proc_msg next;
+	int n = 1;
+
+	register_device(msg);
+	while (n < REGBATCH && msgrcv(msgid, (void *)&next, sizeof(next.pinfo), INITCODE, IPC_NOWAIT) != -1) {
+		mine->messages[METRICTYPE(INITCODE)]++;
+		register_device(next);
+		n++;
+	}
+}
+
+/**
+ * Checkpoints this worker's registry, windows and rules so a controller
+ * restarted after this has everything up to now, and empties the journal.
+ */
+void checkpoint() {
+	long long int start = latency_now();
+
+	if (snapshot_take(state, session, nshards, &devices, windows[shard], window_count(), &rules)) {
+		mine->checkpoints++;
+		log_debug("[CHILD] Checkpointed %d devices in %.1fms\n", devices.count,
+				(latency_now() - start) / 1000.0);
+	}
+}
+
+/**
+ * Applies an entry of the journal left by the last controller to the
+ * registry restored from its checkpoint. A device registered or resumed
+ * since the checkpoint that is still running is acknowledged again, since
+ * the last controller may have stopped before its acknowledge was sent.
+ *
+ * param entry: Journal entry to apply.
+ * return: 1 if it applied, 0 if the journal does not follow the checkpoint
+ */
+int replay_device(journal_entry *entry) {
+	struct proc_msg msg;
+	device *dev;
+	int i = entry->slot;
+
+	switch (entry->op) {
+	case JOURNALADD:
+		if (registry_add(&devices, &entry->info) != i) {
+			break;
+		}
+		reset_device(i);
+		msg.pinfo = entry->info;
+		msg.pinfo.handle = registry_handle(&devices, i);
+		if (device_home(&msg.pinfo) == shard && kill(msg.pinfo.pid, 0) == 0) {
+			send_ack(msg);
+		}
+		return 1;
+
+	case JOURNALREMOVE:
+		if (i == -1 || registry_find(&devices, entry->info.pid) != i) {
+			break;
+		}
+		if (i < WINDOWSLOTS) {
+			window_detach(&windows[shard][i]);
+		}
+		return registry_remove(&devices, entry->info.pid);
+
+	case JOURNALREKEY:
+		if (i < 0 || i >= devices.capacity || !devices.slots[i].used ||
+				devices.slots[i].info.pid != entry->info.previous) {
+			break;
+		}
+		dev = &devices.slots[i];
+		registry_rekey(&devices, i, entry->info.pid);
+		dev->info.inbox = entry->info.inbox;
+		if (i < WINDOWSLOTS && dev->info.device != AC_ACTUATOR_TYPE &&
+				dev->info.device != BELL_ACTUATOR_TYPE) {
+			window_rekey(&windows[shard][i], entry->info.pid);
+		}
+		msg.pinfo = entry->info;
+		if (device_home(&msg.pinfo) == shard && kill(msg.pinfo.pid, 0) == 0) {
+			send_ack(msg);
+		}
+		return 1;
+	}
+	log_error("[ERROR] Journal entry for device %d does not follow the checkpoint, "
+			"replay stopped\n", entry->info.pid);
+	return 0;
+}
+
+/**
+ * Restores the registry, windows and alarm state this worker had when the
+ * last controller stopped, from its checkpoint and the journal after it,
+ * then checkpoints so the journal starts over. Devices keep the slots and
+ * handles they were acknowledged with. If the rules changed since, the
+ * devices are attached to the new ones and their rule state starts over.
+ */
+void restore_state() {
+	long long int start = latency_now();
+	int same, replayed, i;
+
+	same = state->saved->rules.count == rules.count &&
+			memcmp(state->saved->rules.rules, rules.rules, sizeof(rule) * rules.count) == 0;
+	if (same) {
+		memcpy(rules.watches, state->saved->rules.watches, sizeof(rules.watches));
+	}
+	if (!snapshot_restore(state, &devices, windows[shard], WINDOWSLOTS)) {
+		exit(MEMERR);
+	}
+
+	// Actions sent before the restart are no longer pending
+	for (i = 0; i < devices.capacity; i++) {
+		if (devices.slots[i].used) {
+			devices.slots[i].outstanding = 0;
+			if (!same) {
+				devices.slots[i].rule = rules_attach(&rules, &devices.slots[i].state,
+						devices.slots[i].info.name, devices.slots[i].info.device);
+			}
+		}
+	}
+	mine->windows = window_count();
+	replayed = snapshot_replay(state, replay_device);
+
+	log_info("[CHILD] Worker %d restored %d devices from its checkpoint and %d journal entries "
+			"in %.1fms\n", shard, devices.count, replayed, (latency_now() - start) / 1000.0);
+	checkpoint();
+}
+
+/**
+ * Prints the latency of each hop that has new samples since the last report.
+ *
+ * param who: Worker or parent the hops were timed by.
+ * param first: First hop to print.
+ * param last: Last hop to print.
+ */
+void print_latency(const char *who, int first, int last) {
+	int h;
+
+	for (h = first; h <= last; h++) {
+		if (hops[h].count != hops_reported[h]) {
+			hist_print(who, hop_names[h], &hops[h]);
+			hops_reported[h] = hops[h].count;
+		}
+	}
+}
+
+/**
+ * Stops every actuator that takes its mail from an inbox of its own. The
+ * inboxes outlive the controller's queues, so an actuator waiting on one
+ * would otherwise never notice the controller closed. The inbox of one that
+ * died is removed.
+ */
+void stop_actuators() {
+	struct proc_msg msg;
+	int i;
+
+	msg.pinfo.data = STOPCODE;
+	for (i = 0; i < devices.capacity; i++) {
+		if (devices.slots[i].used && devices.slots[i].info.inbox != -1) {
+			msg.msg_type = MBOX(devices.slots[i].info.pid);
+			if (send_mail(&msg, devices.slots[i].info.inbox, IPC_NOWAIT) != -1) {
+				drop_inbox(&devices.slots[i].info);
+			}
+		}
+	}
+}
+
+/**
+ * Prints the CPU time the child used against the time it was running so
+ * the idle cost of the receive loop can be compared between builds.
+ *
+ * param start: Monotonic time the child started at.
+ * param wakeups: Number of times the child woke up from the message queue.
+ */
+void print_usage(struct timespec start, long int wakeups) {
+	struct rusage usage;
+	struct timespec end;
+	double wall, cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (getrusage(RUSAGE_SELF, &usage) == -1) {
+		log_error("[ERROR] Could not read child resource usage: %d\n", errno);
+		return;
+	}
+
+	wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		  usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	log_info("[CHILD] Used %.3fs CPU over %.3fs running (%.2f%%) with %ld wakeups\n",
+			cpu, wall, wall > 0 ? 100 * cpu / wall : 0, wakeups);
 }
 
 void run_child() {
+    union child_msg buf;
     struct proc_msg msg;
-    int messages = 0;
+    struct timespec start;
+    int messages = 0, flags, ringing, since_lane = LANEPOLL;
+    pid_t last = -1;
+    long int wakeups = 0;
+    long long int next_report = latency_now() + LATPERIOD * 1000LL;
+    long long int next_checkpoint = now_ms() + SNAPPERIOD;
+    unsigned long long checkpointed = 0;
+    ssize_t received;
+    char who[32];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sprintf(who, "Worker %d", shard);
+    log_info("[CHILD] Worker %d of %d started with PID %d\n", shard, nshards, getpid());
 
     // Run until control+c is pressed
     while(running) {
+    	// Drop actions that timed out and wake up for the next one to
+    	expire_actions();
+    	mine->devices = devices.count;
+    	mine->outstanding = actions.count;
+
+    	// Checkpoint every so often if anything was handled since the last one
+    	if (now_ms() >= next_checkpoint) {
+    		if (checkpointed != wakeups + mine->readings) {
+    			checkpoint();
+    			checkpointed = wakeups + mine->readings;
+    		}
+    		next_checkpoint = now_ms() + SNAPPERIOD;
+    	}
+
+    	// Smoke readings first. The lane is looked at after a doorbell and every
+    	// LANEPOLL messages, in case a full queue had no room for the doorbell
+    	if (since_lane >= LANEPOLL) {
+    		drain_lane();
+    		since_lane = 0;
+    	}
+
+    	// Empty the ring, then only block on the queue if it is still empty once
+    	// the sensors have been told to ring the doorbell
+    	flags = 0;
+    	if (readings != NULL) {
+    		drain_ring();
+    		if (!ring_sleep(readings)) {
+    			flags = IPC_NOWAIT;
+    		}
+    	}
+    	ringing = flags;
+
+    	// Acknowledges that found no room try again, without blocking on the queue
+    	if (acks_head < acks_count) {
+    		flush_acks();
+    		if (acks_head < acks_count) {
+    			flags = IPC_NOWAIT;
+    		}
+    	}
+
+    	// Block until an init, quit, acknowledge or data message arrives. The negative
+    	// type takes the lowest type first so data is handled last
+    	received = msgrcv(msgid, (void *)&buf, sizeof(buf) - sizeof(long int), -CHILDCODE, flags);
+
+    	// Awake again so sensors no longer need to ring the doorbell
+    	if (readings != NULL) {
+    		atomic_store(&readings->sleeping, 0);
+    	}
+
+    	if (received == -1) {
+    		// More frames are in the ring or acknowledges to send, and nothing is
+    		// waiting on the queue. Give the devices a moment to take their
+    		// acknowledges rather than spin
+    		if (errno == ENOMSG) {
+    			if (!ringing) {
+    				usleep(ACKRETRY);
+    			}
+    			continue;
+    		}
+
+    		// Interrupted by a signal or action timer, let the loop check if we should stop
+    		if (errno == EINTR) {
+    			continue;
+    		}
+
+    		// The parent already removed the message queue while closing
+    		if (errno == EIDRM) {
+    			break;
+    		}
+
+    		log_error("[ERROR] Failed during checking the device messages: %d\n", errno);
+    		running = 0;
+    		exit(MQRERR);
+    	}
+    	wakeups++;
+    	since_lane++;
+    	msg = buf.proc;
+    	if (buf.msg_type >= INITCODE && buf.msg_type <= CHILDCODE) {
+    		mine->messages[METRICTYPE(buf.msg_type)]++;
+    	}
+    	received_at = latency_now();
+
+    	// Report the hops this worker times every so often while it is busy
+    	if (received_at >= next_report) {
+    		print_latency(who, HOPREAD, HOPACK);
+    		next_report = received_at + LATPERIOD * 1000LL;
+    	}
+
+    	switch(buf.msg_type) {
+
+    	// Register the devices waiting and send the acknowledges back to those this
+    	// worker is home to
+    	case INITCODE:
+    		register_devices(msg);
+    		break;
+
+    	// Remove the device from the registered devices list
+    	case QUITCODE:
+    		if (route_device(msg)) {
+    			remove_device(msg.pinfo.pid);
+    		}
+    		break;
+
+    	// Actuator finished an action
+    	case AACKCODE:
+    		handle_ack(msg);
+    		break;
+
+    	// Doorbell from a sensor, the ring and lane are drained at the top of the loop
+    	case RINGCODE:
+    		since_lane = LANEPOLL;
+    		continue;
+
+    	// Readings from a device
+    	case DATACODE:
+    	case FRAMCODE:
+    	case BTCHCODE:
+    		last = handle_readings(&buf);
+    		break;
 
-		// Check for the init message on the message queue in non-blocking mode
-        if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), INITCODE, IPC_NOWAIT) == -1) {
-            // Check that it is not an expected error from blank message
-            if (errno != ENOMSG && errno != EAGAIN) {
-    		    fprintf(stderr, "[ERROR] Failed during checking the init messages: %d\n", errno);
-    		    running = 0;
-    		    exit(MQRERR);
-            }
-    	} else {
-    		// Send the acknowledge signal back and register the device
-            send_ack(msg);
-            add_device(msg);
-        }
-
-        // Check if there has been a message from a device that quit
-        if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), QUITCODE, IPC_NOWAIT) == -1) {
-        	// Check that it is not an expected error from blank message
-        	if (errno != ENOMSG && errno != EAGAIN) {
-        	    fprintf(stderr, "[ERROR] Failed during checking the quit messages: %d\n", errno);
-        	    running = 0;
-        	    exit(MQRERR);
-        	}
-        } else {
-        	// Remove the device from the registered devices list
-        	remove_device(msg.pinfo.pid);
-        }
-
-    	// Look for message on the message queue from device
-    	if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), DATACODE, IPC_NOWAIT) == -1) {
-            // Check that it is not an expected error from blank message
-            if (errno != ENOMSG && errno != EAGAIN) {
-    		    fprintf(stderr, "[ERROR] Failed during checking the device messages: %d\n", errno);
-    		    running = 0;
-    		    exit(MQRERR);
-            }
-    	} else {
-            // Print the info received from the device
-    	    printf("[CHILD] Message received from device [%d] %s (type %c) with data %d (threshold %ld)\n",
-    	    		msg.pinfo.pid, msg.pinfo.name, msg.pinfo.device, msg.pinfo.data, msg.pinfo.threshold);
-
-    	    // Add to the total messages received
-    	    messages++;
-
-    	    // Activate alarm if the data > threshold
-    	    if (msg.pinfo.data > msg.pinfo.threshold) {
-    	    	activate_actuator(msg);
-    	     	send_to_parent(msg);
-    	    }
-        }
+    	default:
+    		continue;
+    	}
 
     	// If 10 messages are received, send stop to last device to send a message
     	// Used to show stop code working
-    	if (messages > 10) {
+    	if (buf.msg_type >= DATACODE && ++messages > 10 && last != -1) {
     		messages = 0;
-    		send_stop(msg.pinfo.pid);
+    		send_stop(last);
     	}
     }
 
-    printf("[CHILD] Child closing...\n");
+    print_latency(who, HOPREAD, HOPACK);
+    print_usage(start, wakeups);
+
+    // Handing over to the next controller leaves it everything up to now, a
+    // controller that closes leaves nothing
+    if (handover) {
+    	checkpoint();
+    } else if (shard == 0) {
+    	stop_actuators();
+    }
+    close_snapshot(state, handover);
+    log_info("[CHILD] Child closing...\n");
+}
+
+/**
+ * Makes this controller's client FIFO and says hello to the cloud on the
+ * server FIFO so it starts reading it.
+ *
+ * param path: Filled with the path of the client FIFO.
+ * return: File descriptor of the client FIFO opened for writing
+ */
+int connect_cloud(char *path) {
+	stream_header hello;
+	pid_t pid = getpid();
+	char frame[sizeof(stream_header) + sizeof(pid_t)];
+	int server_fifo_id, client_fifo_id;
+
+	sprintf(path, CLIENT_FIFO_NAME, pid);
+	if (mkfifo(path, 0777) != 0 && errno != EEXIST) {
+		log_error("[ERROR] Parent could not create client FIFO: %d\n", errno);
+		exit(FICRERR);
+	}
+
+	// Open the server FIFO in write only mode
+	server_fifo_id = open(SERVER_FIFO_NAME, O_WRONLY);
+	if (server_fifo_id == -1) {
+		log_error("[ERROR] Parent could not open server FIFO: %d\n", errno);
+		exit(FIOPERR);
+	}
+
+	// Send the hello in one write so it can't mix with another controller's
+	hello.magic = STREAMMAGIC;
+	hello.type = STREAMHELO;
+	hello.count = 1;
+	hello.length = sizeof(pid_t);
+	memcpy(frame, &hello, sizeof(hello));
+	memcpy(frame + sizeof(hello), &pid, sizeof(pid));
+	if (write(server_fifo_id, frame, sizeof(frame)) != sizeof(frame)) {
+		log_error("[ERROR] Parent could not write to server FIFO: %d\n", errno);
+		exit(FIWRERR);
+	}
+	close(server_fifo_id);
+
+	// Wait for the cloud to open the other end
+	client_fifo_id = open(path, O_WRONLY);
+	if (client_fifo_id == -1) {
+		log_error("[ERROR] Parent could not open client FIFO: %d\n", errno);
+		exit(FIOPERR);
+	}
+	return client_fifo_id;
+}
+
+/**
+ * Returns the time from a monotonic clock in milliseconds.
+ */
+long long int parent_now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/**
+ * Sends one frame of aggregates to the cloud, unless the pipe is full.
+ *
+ * returns: 1 if the frame was sent, 0 otherwise.
+ */
+int send_frame(stream *cloud, aggregate *aggs, int n) {
+	if (stream_full(cloud)) {
+		return 0;
+	}
+	if (!stream_send(cloud, STREAMAGGR, aggs, n, sizeof(aggregate))) {
+		log_error("[ERROR] Parent could not write to client FIFO: %d\n", errno);
+		running = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Reads the window of every sensor the workers keep and sends their
+ * aggregates to the cloud, as many to a frame as fit. Skipped while the
+ * stream is full, the next period's aggregates will be newer anyway.
+ *
+ * param cloud: Stream to the cloud.
+ * return: Number of aggregates sent
+ */
+int send_aggregates(stream *cloud) {
+	static aggregate aggs[STREAMMAXLEN / sizeof(aggregate)];
+	int max = sizeof(aggs) / sizeof(aggregate), n = 0, sent = 0, s, i;
+
+	// Only the windows each worker has in use, the rest of its slab is untouched
+	for (s = 0; s < nshards; s++) {
+		for (i = 0; i < stats->workers[s].windows; i++) {
+			if (window_read(&windows[s][i], &aggs[n])) {
+				n++;
+			}
+			if (n == max) {
+				if (!send_frame(cloud, aggs, n)) {
+					return sent;
+				}
+				sent += n;
+				n = 0;
+			}
+		}
+	}
+	if (n > 0 && send_frame(cloud, aggs, n)) {
+		sent += n;
+	}
+	return sent;
 }
 
 void run_parent() {
-	int server_fifo_id;
-	struct proc_msg msg;
+	int client_fifo_id;
+	char client_fifo_name[64];
+	proc_info alarms[ALARMBATCH];
+	char *buf = (char *)alarms;
+	struct pollfd fds[2];
+	stream cloud;
+	ssize_t nread;
+	long long int next_aggs, next_report;
+	int held = 0, open_pipe = 1, i, timeout;
 
 	// Wait until Control+C is pressed to start monitoring
-	while(!started) {
+	while(!started && running) {
 		// Sleep to not keep CPU time
 		sleep(1);
 	}
+	if (!running) {
+		return;
+	}
 
-	// Open the server FIFO in read only mode
-	server_fifo_id = open(SERVER_FIFO_NAME, O_WRONLY);
-	if (server_fifo_id == -1) {
-		// If there was an interrupt let the handler deal with it
-		if (errno != EINTR) {
-			fprintf(stderr, "[ERROR] Parent could not open server FIFO: %d\n", errno);
-	    	exit(FIOPERR);
+	// Connect to the cloud through our own FIFO
+	client_fifo_id = connect_cloud(client_fifo_name);
+
+	// Writes to the cloud must never block, what it can't take waits in the stream
+	fcntl(client_fifo_id, F_SETFL, O_NONBLOCK);
+	init_stream(&cloud, client_fifo_id);
+
+	log_info("[PARENT] Parent is now monitoring...\n");
+	next_aggs = parent_now() + AGGPERIOD;
+	next_report = parent_now() + LATPERIOD;
+	while(running && (open_pipe || cloud.len > 0)) {
+		// Only take alarms from the child while the stream has room for them. When
+		// it doesn't, the child blocks on the full pipe until the cloud catches up
+		fds[0].fd = open_pipe && !stream_full(&cloud) ? alarm_pipe[0] : -1;
+		fds[0].events = POLLIN;
+		fds[1].fd = cloud.len > 0 ? client_fifo_id : -1;
+		fds[1].events = POLLOUT;
+		timeout = next_aggs - parent_now();
+		if (poll(fds, 2, timeout < 0 ? 0 : timeout) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error("[ERROR] Parent failed waiting for alarms: %d\n", errno);
+			exit(PIPEERR);
+		}
+
+		// Send what the cloud had no room for before
+		if (fds[1].revents && !stream_flush(&cloud)) {
+			log_error("[ERROR] Parent could not write to client FIFO: %d\n", errno);
+			running = 0;
+		}
+		stats->buffered = cloud.len;
+
+		// Forward the windows' aggregates instead of every reading
+		if (open_pipe && parent_now() >= next_aggs) {
+			i = send_aggregates(&cloud);
+			stats->aggregates += i;
+			log_info("[PARENT] Sent aggregates of %d sensors to cloud\n", i);
+			if (parent_now() >= next_report) {
+				print_latency("Parent", HOPFORWARD, HOPFORWARD);
+				next_report = parent_now() + LATPERIOD;
+			}
+			next_aggs += AGGPERIOD;
+			if (next_aggs < parent_now()) {
+				next_aggs = parent_now() + AGGPERIOD;
+			}
+		}
+
+		if (!fds[0].revents) {
+			continue;
 		}
-	}
 
+		// Take as many alarms as are waiting. The child closing its end of the
+		// pipe means it has stopped
+		nread = read(alarm_pipe[0], buf + held, sizeof(alarms) - held);
+		if (nread == 0) {
+			open_pipe = 0;
+			continue;
+		} else if (nread == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error("[ERROR] Failed reading alarms from child: %d\n", errno);
+			running = 0;
+		    exit(PIPEERR);
+		}
+		held += nread;
 
-	printf("[PARENT] Parent is now monitoring...\n");
-	while(running) {
-		// If the alarm has been received read the message from the queue
-		if (message_sent == 1) {
-			if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), PRNTCODE, 0) == -1) {
-				fprintf(stderr, "[ERROR] Failed reading message from child: %d\n", errno);
-				running = 0;
-			    exit(MQRERR);
+		for (i = 0; i < held / (int)sizeof(proc_info); i++) {
+			// Stamp the alarm as it goes on to the cloud
+			alarms[i].stamps.forward = latency_now();
+			if (alarms[i].stamps.receive != 0) {
+				hist_add(&hops[HOPFORWARD], alarms[i].stamps.forward - alarms[i].stamps.receive);
 			}
 
 			// Print the data
-			printf("[PARENT] Alarm received from device [%d] %s (type %c) with data %d (threshold %ld)"
+			log_info("[PARENT] Alarm received from device [%d] %s (type %c) with data %d (threshold %ld)"
 					" dealt with by action \"%s\"\n",
-					msg.pinfo.pid, msg.pinfo.name, msg.pinfo.device, msg.pinfo.data, msg.pinfo.threshold,
-					msg.pinfo.action);
-
-			// Send the data to the cloud
-			if(write(server_fifo_id, &msg.pinfo, sizeof(msg.pinfo)) != 0) {
-				if (errno != EINTR) {
-					fprintf(stderr, "[ERROR] Parent could not write to server FIFO: %d\n", errno);
-					running = 0;
-				}
-			}
-			message_sent = 0;
+					alarms[i].pid, alarms[i].name, alarms[i].device, alarms[i].data, alarms[i].threshold,
+					alarms[i].action);
 		}
+
+		// Send the data to the cloud in one frame
+		if (i > 0 && !stream_send(&cloud, STREAMALRM, alarms, i, sizeof(proc_info))) {
+			log_error("[ERROR] Parent could not write to client FIFO: %d\n", errno);
+			running = 0;
+		}
+		stats->forwarded += i;
+
+		// Keep any part of an alarm that has not fully arrived yet
+		memmove(buf, buf + i * sizeof(proc_info), held - i * sizeof(proc_info));
+		held -= i * sizeof(proc_info);
 	}
 
-	printf("[PARENT] Parent closing...\n");
-	close(server_fifo_id);
+	print_latency("Parent", HOPFORWARD, HOPFORWARD);
+	log_info("[PARENT] Parent closing...\n");
+	close(client_fifo_id);
+	unlink(client_fifo_name);
+}
+
+/**
+ * Opens the checkpoint and journal of every worker. The state a controller
+ * that crashed or handed over left is only restored if every worker has a
+ * checkpoint from the same session with as many workers, since the devices
+ * are sharded by the number of workers.
+ *
+ * param path: Message queue path the files are named after.
+ * return: 1 if the state is restored, 0 if the controller starts afresh
+ */
+int open_state(const char *path) {
+	snap_header *first;
+	int s, whole = 1, found = 0;
+
+	for (s = 0; s < nshards; s++) {
+		if (!open_snapshot(&snaps[s], SNAPDIR, ftok(path, MAINPROJ), s)) {
+			exit(SNAPERR);
+		}
+		found |= snaps[s].saved != NULL;
+	}
+	first = snaps[0].saved;
+	for (s = 0; s < nshards; s++) {
+		if (first == NULL || snaps[s].saved == NULL || snaps[s].saved->nshards != nshards ||
+				snaps[s].saved->session != first->session) {
+			whole = 0;
+		}
+	}
+
+	if (whole) {
+		session = first->session;
+		printf("[INIT] Restoring state of session %x from %s\n", session, SNAPDIR);
+	} else if (found) {
+		printf("[INIT] State in %s is not from a controller with %d workers, starting afresh\n",
+				SNAPDIR, nshards);
+	}
+	return whole;
 }
 
 int main(int argc, char *argv[]) {
-	pid_t pid;
+	pid_t pid = 0, workers[MAXSHARDS];
+	int s, restoring;
 
 	// Check to make sure the correct amount of arguments were passed
-	if (argc != 2) {
-		fprintf(stderr, "[ERROR] Controller takes exactly 1 argument (Message Queue Path)!");
+	if (argc < 2 || argc > 5) {
+		fprintf(stderr, "[ERROR] Controller takes 1 argument (Message Queue Path) "
+				"and optionally the Transport (msg or shm), number of Workers and Rule file!");
+		exit(INITERR);
+	}
+	if (argc > 2 && strcmp(argv[2], "msg") != 0 && strcmp(argv[2], "shm") != 0) {
+		fprintf(stderr, "[ERROR] Invalid transport entered. Must be one of: msg, shm!\n");
+		exit(INITERR);
+	}
+	if (argc > 3) {
+		nshards = strtol(argv[3], NULL, 10);
+	}
+	if (nshards < 1 || nshards > MAXSHARDS) {
+		fprintf(stderr, "[ERROR] Number of workers must be between 1 and %d!\n", MAXSHARDS);
 		exit(INITERR);
 	}
 
@@ -403,6 +1593,9 @@ int main(int argc, char *argv[]) {
 	sigemptyset(&new_signal.sa_mask);
 	new_signal.sa_flags = SA_RESTART;
 
+	// A cloud that went away shows up as a failed write instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+
 	// Add the handler to handle SIGALRM and SIGINT
 	if (sigaction(SIGALRM, &new_signal, NULL) != 0) {
 		fprintf(stderr, "[ERROR] Could not handle SIGALRM");
@@ -412,36 +1605,226 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "[ERROR] Could not handle SIGINT");
 		exit(INITERR);
 	}
+	if (sigaction(SIGTERM, &new_signal, NULL) != 0) {
+		fprintf(stderr, "[ERROR] Could not handle SIGTERM");
+		exit(INITERR);
+	}
+
+	// Set up the empty device registry
+	if (!init_registry(&devices) || !init_pending(&actions)) {
+		exit(MEMERR);
+	}
+
+	// Compile the alarm rules, without a file every sensor alarms above its threshold
+	init_rules(&rules);
+	if (argc > 4) {
+		if (!load_rules(&rules, argv[4])) {
+			exit(INITERR);
+		}
+		printf("[INIT] Loaded %d alarm rules from %s\n", rules.count - 1, argv[4]);
+	}
+
+	// Create the mail queue the workers send devices their acknowledges, stops
+	// and actions on
+	mail = msgget(ftok(argv[1], MAILPROJ), 0666 | IPC_CREAT);
+	if (mail == -1) {
+		fprintf(stderr, "[ERROR] Could not create mail queue: %d\n", errno);
+		exit(MQGERR);
+	}
+	printf("[INIT] Connecting to mail queue: %d, key %d\n", mail, ftok(argv[1], MAILPROJ));
+
+	// Create the message queue of each worker if it doesn't already exist, the
+	// first is the main queue devices register on
+	for (s = 0; s < nshards; s++) {
+		queues[s] = msgget(ftok(argv[1], QUEUEPROJ(s)), 0666 | IPC_CREAT);
+		if (queues[s] == -1) {
+			fprintf(stderr, "[ERROR] Could not create message queue of worker %d: %d\n", s, errno);
+			exit(MQGERR);
+		}
+		printf("[INIT] Connecting to message queue: %d, key %d\n", queues[s],
+				ftok(argv[1], QUEUEPROJ(s)));
+
+		// And the alarm lane smoke sensors send to
+		lanes[s] = msgget(ftok(argv[1], LANEPROJ(s)), 0666 | IPC_CREAT);
+		if (lanes[s] == -1) {
+			fprintf(stderr, "[ERROR] Could not create alarm lane of worker %d: %d\n", s, errno);
+			exit(MQGERR);
+		}
+	}
+
+	// Map each worker's windows before forking so the parent shares them
+	for (s = 0; s < nshards; s++) {
+		windows[s] = create_windows(WINDOWSLOTS);
+		if (windows[s] == NULL) {
+			exit(MEMERR);
+		}
+	}
 
-	// Create the message queue if it doesn't already exist
-	msgid = msgget(ftok(argv[1], 1), 0666 | IPC_CREAT);
-	printf("[INIT] Connecting to message queue: %d, key %d\n", msgid, ftok(argv[1], 1));
+	// Carry on in the session of the controller that left its state behind. In a
+	// new session, devices acknowledged by an earlier controller can't resume
+	restoring = open_state(argv[1]);
+	if (!restoring) {
+		session = (unsigned int)(latency_now() ^ getpid() << 16) | 1;
+		for (s = 0; s < nshards; s++) {
+			if (!snapshot_take(&snaps[s], session, nshards, &devices, windows[s], window_count(), &rules)) {
+				exit(SNAPERR);
+			}
+		}
+	}
 
-	pid = fork();
+	// Create the ring sensors of this session will find and use instead of the
+	// message queue. Without one, a ring an earlier controller left is closed so
+	// sensors still attached to it stop pushing where nobody drains
+	for (s = 0; s < nshards; s++) {
+		shmids[s] = -1;
+		rings[s] = NULL;
+		if (argc > 2 && strcmp(argv[2], "shm") == 0) {
+			rings[s] = create_ring(ftok(argv[1], RINGPROJ(s)), RINGSIZE, session, &shmids[s]);
+			if (rings[s] == NULL) {
+				exit(SHMERR);
+			}
+			printf("[INIT] Created shared memory ring: %d, %d frames\n", shmids[s], RINGSIZE);
+		} else {
+			remove_ring(ftok(argv[1], RINGPROJ(s)));
+		}
+	}
+
+	// Create the metrics the stats program reads, with a slot for each worker
+	stats = create_metrics(ftok(argv[1], METRICSPROJ), nshards, &stats_shmid);
+	if (stats == NULL) {
+		exit(SHMERR);
+	}
+	stats->started = latency_now();
+	stats->mail = mail;
+	for (s = 0; s < nshards; s++) {
+		stats->workers[s].queue = queues[s];
+		stats->workers[s].windows = window_count();
+	}
+	printf("[INIT] Created metrics: %d\n", stats_shmid);
 
-	switch(pid) {
-		case -1:
+	// Create the pipe the workers send alarms to the parent through
+	if (pipe(alarm_pipe) == -1) {
+		fprintf(stderr, "[ERROR] Could not create alarm pipe: %d\n", errno);
+		exit(PIPEERR);
+	}
+
+	// Fork a child for each worker, with nothing printed left for each to print again
+	fflush(stdout);
+	for (s = 0; s < nshards; s++) {
+		pid = fork();
+		if (pid == -1) {
 			// Process creation failed
 			fprintf(stderr, "[ERROR] Controller process creation failed!");
 			exit(INITERR);
-		case 0:
-			// Child process
-			run_child();
-			break;
-		default:
-			// Parent process
-			run_parent();
+		} else if (pid == 0) {
+			shard = s;
 			break;
+		}
+		workers[s] = pid;
+	}
+	msgid = queues[shard];
+	lane = lanes[shard];
+	readings = rings[shard];
+	mine = &stats->workers[shard];
+	state = &snaps[shard];
+
+	// Each worker keeps its own files open, the parent none
+	for (s = 0; s < nshards; s++) {
+		if (pid != 0 || s != shard) {
+			close_snapshot(&snaps[s], 1);
+		}
+	}
+	if (pid == 0) {
+		mine->pid = getpid();
+	}
+
+	// Each process logs through its own flusher, started once it is forked
+	if (!log_init()) {
+		exit(INITERR);
 	}
 
-	if (msgctl(msgid, IPC_RMID, 0) == -1) {
-		// If the message queue has already been deleted it will throw EINVAL
-		if (errno != EINVAL) {
-			fprintf(stderr, "[ERROR] Could not delete message queue!: %d\n", errno);
-	    	exit(MQGERR);
+	if (pid == 0) {
+		// Child process only writes alarms, once it has picked up where the last
+		// controller left off
+		close(alarm_pipe[0]);
+		if (restoring) {
+			restore_state();
 		}
+		run_child();
+		close(alarm_pipe[1]);
 	} else {
-		printf("[STOPPING] Closed message queue...\n");
+		// Parent process only reads alarms, once every worker closed the pipe it is done
+		close(alarm_pipe[1]);
+		run_parent();
+
+		// The workers checkpoint before the next controller is started, none of
+		// them is left blocked on the alarm pipe meanwhile
+		if (handover) {
+			close(alarm_pipe[0]);
+			for (s = 0; s < nshards; s++) {
+				kill(workers[s], SIGTERM);
+				waitpid(workers[s], NULL, 0);
+			}
+		}
+	}
+
+	// Workers remove their own queue and the parent removes all of them. On a
+	// handover the devices keep sending to them for the next controller
+	for (s = 0; s < nshards && !handover; s++) {
+		if (pid == 0 && s != shard) {
+			continue;
+		}
+
+		if (msgctl(queues[s], IPC_RMID, 0) == -1) {
+			// If the message queue has already been deleted it will throw EINVAL
+			if (errno != EINVAL && errno != EIDRM) {
+				fprintf(stderr, "[ERROR] Could not delete message queue!: %d\n", errno);
+				exit(MQGERR);
+			}
+		} else {
+			printf("[STOPPING] Closed message queue %d...\n", queues[s]);
+		}
+		if (msgctl(lanes[s], IPC_RMID, 0) == -1 && errno != EINVAL && errno != EIDRM) {
+			fprintf(stderr, "[ERROR] Could not delete alarm lane!: %d\n", errno);
+			exit(MQGERR);
+		}
+
+		// Parent closes and removes the rings, sensors still attached stop pushing into
+		// them once they see it closed
+		if (pid != 0 && shmids[s] != -1) {
+			ring_close(rings[s]);
+			if (shmctl(shmids[s], IPC_RMID, 0) == 0) {
+				printf("[STOPPING] Closed shared memory ring %d...\n", shmids[s]);
+			} else if (errno != EINVAL && errno != EIDRM) {
+				fprintf(stderr, "[ERROR] Could not delete shared memory ring!: %d\n", errno);
+				exit(SHMERR);
+			}
+		}
+	}
+
+	// The first worker and the parent remove the mail queue like the main queue,
+	// which stops the sensors still checking it for their stop
+	if (!handover && (pid != 0 || shard == 0)) {
+		if (msgctl(mail, IPC_RMID, 0) == 0) {
+			printf("[STOPPING] Closed mail queue %d...\n", mail);
+		} else if (errno != EINVAL && errno != EIDRM) {
+			fprintf(stderr, "[ERROR] Could not delete mail queue!: %d\n", errno);
+			exit(MQGERR);
+		}
+	}
+
+	if (handover && pid != 0) {
+		printf("[STOPPING] Left message queues and state for the next controller...\n");
+	}
+
+	// Parent removes the metrics, a stats program still attached keeps its copy
+	if (pid != 0) {
+		if (shmctl(stats_shmid, IPC_RMID, 0) == 0) {
+			printf("[STOPPING] Closed metrics %d...\n", stats_shmid);
+		} else if (errno != EINVAL && errno != EIDRM) {
+			fprintf(stderr, "[ERROR] Could not delete metrics!: %d\n", errno);
+			exit(SHMERR);
+		}
 	}
 
 	exit(0);
@@ -20,6 +20,11 @@
 #define FICRERR 5	// Error during FIFO creation
 #define FIOPERR 6	// Error during FIFO opening
 #define FIWRERR 7	// Error during FIFO write
+#define MEMERR 8	// Error during memory allocation
+#define SHMERR 9	// Error during creation/attaching to shared memory
+#define PIPEERR 10	// Error during alarm pipe creation, read or write
+#define STOREERR 11	// Error during opening or writing the record store
+#define SNAPERR 12	// Error during opening or writing the controller's saved state
 
 
 #endif /* ERROR_TYPES_H_ */
@@ -0,0 +1,619 @@
+/*
+ * fleet.c
+ *
+ * Load generator for the controller. Simulates a fleet of sensors and
+ * actuators from a few threads, each device speaking the same protocol as
+ * sensor.c and actuator.c under a made up PID: it registers with an init
+ * message, waits for the acknowledge in its mailbox on the mail queue, then
+ * sends readings (or acknowledges the actions it is sent) until it is
+ * stopped, and quits when the fleet is closed. A sensor the controller
+ * stops registers again, as a restarted sensor would. Simulated actuators
+ * take their actions from the mail queue too, rather than an inbox each.
+ *
+ * Attributes are given via the command line: Message Queue Path, and
+ * optionally the number of Sensors and Actuators, Threads, Readings per
+ * second of each sensor, Percentage of readings above the threshold, Data
+ * distribution (uniform or normal), Batch size and Seconds to run.
+ *
+ * Readings go to the queue of the worker that keeps each sensor, or its
+ * alarm lane for a smoke sensor, as frames or in batches. They are sent without waiting so a full queue never holds
+ * up the fleet, readings that don't fit are counted instead. Every second
+ * the messages and readings sent, actions acknowledged and the depth of
+ * each of the controller's queues are printed.
+ *
+ * Control+C closes the fleet early. Every device quits before it exits,
+ * unless the controller's main queue stays full for FLEETQUITS seconds.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/msg.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include "message.h"
+
+// Defaults for the optional arguments
+#define FLEETSENSORS 1000
+#define FLEETACTUATORS 10
+#define FLEETTHREADS 4
+#define FLEETRATE 10		// Readings per second of each sensor
+#define FLEETALARM 5		// Percentage of readings above the threshold
+#define FLEETBATCH 1		// Readings per message, 1 sends frames
+#define FLEETSECONDS 10
+
+// Threshold of every simulated sensor
+#define FLEETTHRESH 50
+
+// Made up PIDs start above any real PID, spread out by the fleet's own PID
+// so several fleets can run against one controller
+#define FLEETPID(i) (1000000000 + (getpid() % 1000) * 1000000 + (i))
+
+// Registrations each thread has waiting on an acknowledge at once. Real
+// devices each wait on theirs, and a fleet filling the main queue with
+// inits would leave no room for other devices' inits or the first worker's readings
+#define FLEETINFLIGHT 8
+
+// Seconds the fleet tries to quit its devices for before giving up
+#define FLEETQUITS 2
+
+// States of a simulated device
+#define SIMNEW 0	// Init not sent yet
+#define SIMINIT 1	// Init sent, waiting on the acknowledge
+#define SIMRUN 2	// Registered
+
+// Simulated device
+typedef struct sim {
+	pid_t pid;
+	char type;
+	char state;
+	unsigned int handle;	// Handle from the acknowledge
+	int shard;				// Worker from the acknowledge
+} sim;
+
+// Thread and the devices it simulates
+typedef struct fleet_thread {
+	pthread_t thread;
+	sim *sensors;
+	int nsensors;
+	sim *actuators;
+	int nactuators;
+	unsigned int seed;
+	int inflight;			// Inits waiting on an acknowledge
+	int queues[MAXSHARDS];	// Queue of each controller worker, -1 until used
+	int lanes[MAXSHARDS];	// Alarm lane of each controller worker, -1 until used
+	atomic_long messages;	// Messages sent, including inits and acknowledges
+	atomic_long readings;	// Readings sent
+	atomic_long full;		// Readings dropped because the queue was full
+	atomic_long registered;	// Acknowledges received
+	atomic_long stops;		// Stops received
+	atomic_long actions;	// Actions acknowledged
+	int unquit;				// Devices that could not quit
+} fleet_thread;
+
+char *path;
+int msgid;
+int mail;
+int sensors = FLEETSENSORS;
+int actuators = FLEETACTUATORS;
+int nthreads = FLEETTHREADS;
+int rate = FLEETRATE;
+int alarm_pct = FLEETALARM;
+int normal = 0;
+int batch_size = FLEETBATCH;
+int seconds = FLEETSECONDS;
+volatile sig_atomic_t running = 1;
+
+/**
+ * Returns the time from a monotonic clock in seconds.
+ */
+double now_s() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the queue of a controller worker, connecting to it the first time.
+ *
+ * param ft: Thread the queue is used from.
+ * param shard: Worker to connect to.
+ * return: Queue ID or -1 if the worker has no queue
+ */
+int shard_queue(fleet_thread *ft, int shard) {
+	if (shard < 0 || shard >= MAXSHARDS) {
+		return -1;
+	}
+	if (ft->queues[shard] == -1) {
+		ft->queues[shard] = msgget(ftok(path, QUEUEPROJ(shard)), 0666);
+		if (ft->queues[shard] == -1) {
+			fprintf(stderr, "[ERROR] Error connecting to worker %d queue: %d\n", shard, errno);
+		}
+	}
+	return ft->queues[shard];
+}
+
+/**
+ * Returns the alarm lane of a controller worker, connecting to it the first
+ * time.
+ *
+ * param ft: Thread the lane is used from.
+ * param shard: Worker to connect to.
+ * return: Queue ID or -1 if the worker has no lane
+ */
+int shard_lane(fleet_thread *ft, int shard) {
+	if (shard < 0 || shard >= MAXSHARDS) {
+		return -1;
+	}
+	if (ft->lanes[shard] == -1) {
+		ft->lanes[shard] = msgget(ftok(path, LANEPROJ(shard)), 0666);
+	}
+	return ft->lanes[shard];
+}
+
+/**
+ * Sends an init or quit message for a device on the main queue without
+ * waiting on a full queue. Inits are only sent while the thread has room
+ * for another in flight.
+ *
+ * param ft: Thread simulating the device.
+ * param dev: Device the message is for.
+ * param code: INITCODE or QUITCODE.
+ * return: 1 if the message was sent, 0 if not
+ */
+int send_control(fleet_thread *ft, sim *dev, long int code) {
+	struct proc_msg msg;
+
+	if (code == INITCODE && ft->inflight == FLEETINFLIGHT) {
+		return 0;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = code;
+	msg.pinfo.pid = dev->pid;
+	msg.pinfo.device = dev->type;
+	msg.pinfo.threshold = dev->type == TEMP_SENSOR_TYPE || dev->type == SMOKE_SENSOR_TYPE ?
+			FLEETTHRESH : 0;
+	snprintf(msg.pinfo.name, sizeof(msg.pinfo.name), "fleet%d", dev->pid % 1000000);
+	msg.pinfo.inbox = -1;
+
+	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), IPC_NOWAIT) == -1) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return 0;
+		}
+		fprintf(stderr, "[ERROR] Failed to send %s for device %d: %d\n",
+				code == INITCODE ? "init" : "quit", dev->pid, errno);
+		exit(MQSERR);
+	}
+	ft->messages++;
+	if (code == INITCODE) {
+		dev->state = SIMINIT;
+		ft->inflight++;
+	} else {
+		dev->state = SIMNEW;
+	}
+	return 1;
+}
+
+/**
+ * Sends the quits of the devices the controller knows.
+ *
+ * param ft: Thread simulating the devices.
+ * param devs: Devices to quit.
+ * param count: Number of devices.
+ * return: Number of devices that could not quit yet
+ */
+int quit_devices(fleet_thread *ft, sim *devs, int count) {
+	int left = 0, i;
+
+	for (i = 0; i < count; i++) {
+		if (devs[i].state != SIMNEW && !send_control(ft, &devs[i], QUITCODE)) {
+			left++;
+		}
+	}
+	return left;
+}
+
+/**
+ * Takes the next message waiting in a device's mailbox and acts on it like
+ * the device would: registers on an acknowledge, registers again after a
+ * stop, and acknowledges an action.
+ *
+ * param ft: Thread simulating the device.
+ * param dev: Device to check the mailbox of.
+ * return: 1 if a message was taken, 0 if the mailbox was empty
+ */
+int check_mailbox(fleet_thread *ft, sim *dev) {
+	struct proc_msg msg;
+	int queue;
+
+	if (msgrcv(mail, (void *)&msg, sizeof(msg.pinfo), MBOX(dev->pid), IPC_NOWAIT) == -1) {
+		if (errno != ENOMSG && errno != EINTR) {
+			fprintf(stderr, "[ERROR] Failed checking the mailbox of device %d: %d\n",
+					dev->pid, errno);
+			exit(MQRERR);
+		}
+		return 0;
+	}
+
+	switch (msg.pinfo.data) {
+	case ACKCODE:
+		if (dev->state == SIMINIT) {
+			ft->inflight--;
+		}
+		dev->handle = msg.pinfo.handle;
+		dev->shard = msg.pinfo.shard;
+		dev->state = SIMRUN;
+		ft->registered++;
+		break;
+
+	// The device restarts, so it registers again under the same PID
+	case STOPCODE:
+		if (dev->state == SIMINIT) {
+			ft->inflight--;
+		}
+		ft->stops++;
+		dev->state = SIMNEW;
+		break;
+
+	// Action for an actuator, acknowledged to the worker that sent it
+	case DATACODE:
+		msg.msg_type = AACKCODE;
+		msg.pinfo.pid = dev->pid;
+		msg.pinfo.stamps.ack = (long long int)(now_s() * 1000000);
+		snprintf(msg.pinfo.name, sizeof(msg.pinfo.name), "fleet%d", dev->pid % 1000000);
+		queue = shard_queue(ft, msg.pinfo.shard);
+		if (queue != -1 && msgsnd(queue, (void *)&msg, sizeof(msg.pinfo), 0) == 0) {
+			ft->messages++;
+			ft->actions++;
+		}
+		break;
+	}
+	return 1;
+}
+
+/**
+ * Sends the inits of the devices that are not registered yet and takes the
+ * acknowledges that came back.
+ *
+ * param ft: Thread simulating the devices.
+ * param devs: Devices to register.
+ * param count: Number of devices.
+ */
+void register_devices(fleet_thread *ft, sim *devs, int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (devs[i].state == SIMINIT) {
+			while (check_mailbox(ft, &devs[i]));
+		}
+		if (devs[i].state == SIMNEW) {
+			send_control(ft, &devs[i], INITCODE);
+		}
+	}
+}
+
+/**
+ * Returns a reading for a sensor, above the threshold for the given
+ * percentage of readings, spread over the distribution below or above it.
+ *
+ * param ft: Thread whose random seed is used.
+ */
+int make_reading(fleet_thread *ft) {
+	int above = rand_r(&ft->seed) % 100 < alarm_pct;
+	double u1, u2, g;
+
+	if (!normal) {
+		return above ? FLEETTHRESH + 1 + rand_r(&ft->seed) % 20 : rand_r(&ft->seed) % (FLEETTHRESH + 1);
+	}
+
+	// Box-Muller gives a normally distributed value
+	u1 = (rand_r(&ft->seed) + 1.0) / (RAND_MAX + 2.0);
+	u2 = (rand_r(&ft->seed) + 1.0) / (RAND_MAX + 2.0);
+	g = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+	if (above) {
+		return FLEETTHRESH + 1 + (int)(fabs(g) * 5);
+	}
+	g = FLEETTHRESH / 2.0 + g * FLEETTHRESH / 6.0;
+	return g < 0 ? 0 : g > FLEETTHRESH ? FLEETTHRESH : (int)g;
+}
+
+/**
+ * Sends the next message of readings from a registered sensor, a frame
+ * or a batch, without waiting on a full queue. A smoke sensor's go in the
+ * alarm lane, followed by a doorbell on the queue as sensor.c sends.
+ *
+ * param ft: Thread simulating the sensor.
+ * param dev: Sensor to send for.
+ */
+void send_readings(fleet_thread *ft, sim *dev) {
+	struct frame_msg frame;
+	struct batch_msg batch;
+	struct proc_msg bell;
+	unsigned int now = READTIME((long long int)(now_s() * 1000000));
+	int queue = shard_queue(ft, dev->shard), lane = -1, i, sent;
+
+	if (queue == -1) {
+		return;
+	}
+	if (dev->type == SMOKE_SENSOR_TYPE) {
+		lane = shard_lane(ft, dev->shard);
+	}
+
+	if (batch_size == 1) {
+		frame.msg_type = FRAMCODE;
+		frame.finfo.handle = dev->handle;
+		frame.finfo.read.data = make_reading(ft);
+		frame.finfo.read.time = now;
+		sent = msgsnd(lane != -1 ? lane : queue, (void *)&frame, sizeof(frame.finfo), IPC_NOWAIT);
+	} else {
+		batch.msg_type = BTCHCODE;
+		batch.binfo.handle = dev->handle;
+		batch.binfo.count = batch_size;
+		for (i = 0; i < batch_size; i++) {
+			batch.binfo.readings[i].data = make_reading(ft);
+			batch.binfo.readings[i].time = now;
+		}
+		sent = msgsnd(lane != -1 ? lane : queue, (void *)&batch, BATCHSIZE(batch_size), IPC_NOWAIT);
+	}
+
+	if (sent == 0) {
+		ft->messages++;
+		ft->readings += batch_size;
+		bell.msg_type = RINGCODE;
+		if (lane != -1 && msgsnd(queue, (void *)&bell, 0, IPC_NOWAIT) == 0) {
+			ft->messages++;
+		}
+	} else if (errno == EAGAIN) {
+		ft->full += batch_size;
+	} else if (errno != EINTR) {
+		fprintf(stderr, "[ERROR] Failed to send readings to message queue: %d\n", errno);
+		exit(MQSERR);
+	}
+}
+
+/**
+ * Runs the devices of one thread. Sensors take turns sending so the
+ * thread's messages keep to the schedule the rate sets, and between
+ * turns every actuator's mailbox is checked.
+ *
+ * param arg: Thread to run.
+ */
+void *run_thread(void *arg) {
+	fleet_thread *ft = arg;
+	double start = now_s(), per_s = (double)ft->nsensors * rate / batch_size;
+	long int turns = 0;
+	int next = 0, left, i;
+	double stop;
+
+	while (running) {
+		register_devices(ft, ft->actuators, ft->nactuators);
+		register_devices(ft, ft->sensors, ft->nsensors);
+
+		// Give sensors their turns until the thread is back on schedule
+		while (running && ft->nsensors > 0 && turns < (now_s() - start) * per_s) {
+			sim *dev = &ft->sensors[next];
+
+			if (dev->state == SIMRUN) {
+				while (check_mailbox(ft, dev));
+			}
+			if (dev->state == SIMRUN) {
+				send_readings(ft, dev);
+			}
+			next = (next + 1) % ft->nsensors;
+			turns++;
+		}
+
+		for (i = 0; i < ft->nactuators; i++) {
+			if (ft->actuators[i].state == SIMRUN) {
+				while (check_mailbox(ft, &ft->actuators[i]));
+			}
+		}
+		usleep(1000);
+	}
+	stop = now_s();
+
+	// Every device the controller knows quits so it forgets the fleet, giving up
+	// on a controller that stopped taking messages
+	for (left = 1; left > 0 && now_s() < stop + FLEETQUITS; usleep(1000)) {
+		left = quit_devices(ft, ft->actuators, ft->nactuators) +
+				quit_devices(ft, ft->sensors, ft->nsensors);
+	}
+	ft->unquit = left;
+	return NULL;
+}
+
+/**
+ * Prints the depth of each of the controller's queues that exists.
+ */
+void print_depths() {
+	struct msqid_ds stat;
+	int s, queue;
+
+	printf("[FLEET] Queue depth:");
+	for (s = 0; s < MAXSHARDS; s++) {
+		queue = msgget(ftok(path, QUEUEPROJ(s)), 0666);
+		if (queue == -1 || msgctl(queue, IPC_STAT, &stat) == -1) {
+			break;
+		}
+		printf(" worker %d %lu msgs", s, (unsigned long)stat.msg_qnum);
+	}
+	if (msgctl(mail, IPC_STAT, &stat) == 0) {
+		printf(" mail %lu msgs", (unsigned long)stat.msg_qnum);
+	}
+	printf("\n");
+}
+
+/**
+ * Signal handler that closes the fleet on Control+C.
+ */
+void signal_handler(int signum) {
+	if (signum == SIGINT) {
+		running = 0;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	fleet_thread *threads;
+	sim *devices;
+	long int messages, readings, full, registered, stops, actions, unquit;
+	long int last_messages = 0, last_readings = 0, last_actions = 0;
+	double start, elapsed;
+	int i, t;
+
+	// Check that correct command line args were passed
+	if (argc < 2 || argc > 10) {
+		fprintf(stderr, "[ERROR] Fleet takes 1 argument (Path for Message Queue) and optionally "
+				"Sensors, Actuators, Threads, Rate, Alarm %%, Distribution, Batch size, Seconds!\n");
+		exit(INITERR);
+	}
+	path = argv[1];
+	if (argc > 2) {
+		sensors = strtol(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		actuators = strtol(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		nthreads = strtol(argv[4], NULL, 10);
+	}
+	if (argc > 5) {
+		rate = strtol(argv[5], NULL, 10);
+	}
+	if (argc > 6) {
+		alarm_pct = strtol(argv[6], NULL, 10);
+	}
+	if (argc > 7) {
+		if (strcmp(argv[7], "normal") == 0) {
+			normal = 1;
+		} else if (strcmp(argv[7], "uniform") != 0) {
+			fprintf(stderr, "[ERROR] Invalid distribution entered. Must be one of: uniform, normal!\n");
+			exit(INITERR);
+		}
+	}
+	if (argc > 8) {
+		batch_size = strtol(argv[8], NULL, 10);
+	}
+	if (argc > 9) {
+		seconds = strtol(argv[9], NULL, 10);
+	}
+	if (sensors < 0 || actuators < 0 || sensors + actuators > 1000000 || nthreads < 1 ||
+			rate < 1 || alarm_pct < 0 || alarm_pct > 100 || batch_size < 1 ||
+			batch_size > MAXBATCH || seconds < 1) {
+		fprintf(stderr, "[ERROR] Fleet arguments out of range, at most 1000000 devices and "
+				"a batch size from 1 to %d!\n", MAXBATCH);
+		exit(INITERR);
+	}
+
+	// Set up the signal handler
+	struct sigaction new_signal;
+	new_signal.sa_handler = signal_handler;
+	sigemptyset(&new_signal.sa_mask);
+	new_signal.sa_flags = 0;
+	if (sigaction(SIGINT, &new_signal, NULL) != 0) {
+		fprintf(stderr, "[ERROR] Could not handle SIGINT\n");
+		exit(INITERR);
+	}
+
+	// Connect to the main queue the controller made
+	msgid = msgget(ftok(path, MAINPROJ), 0666);
+	if (msgid == -1) {
+		fprintf(stderr, "[ERROR] Error connecting to message queue: %d\n", errno);
+		exit(MQGERR);
+	}
+	printf("[INIT] Connecting to message queue: %d, key %d\n", msgid, ftok(path, MAINPROJ));
+	mail = msgget(ftok(path, MAILPROJ), 0666);
+	if (mail == -1) {
+		fprintf(stderr, "[ERROR] Error connecting to mail queue: %d\n", errno);
+		exit(MQGERR);
+	}
+
+	// Alternate the types of the devices so both kinds of alarm are raised
+	threads = calloc(nthreads, sizeof(fleet_thread));
+	devices = calloc(sensors + actuators, sizeof(sim));
+	if (threads == NULL || devices == NULL) {
+		exit(MEMERR);
+	}
+	for (i = 0; i < sensors + actuators; i++) {
+		devices[i].pid = FLEETPID(i);
+		if (i < sensors) {
+			devices[i].type = i % 2 ? SMOKE_SENSOR_TYPE : TEMP_SENSOR_TYPE;
+		} else {
+			devices[i].type = i % 2 ? BELL_ACTUATOR_TYPE : AC_ACTUATOR_TYPE;
+		}
+	}
+
+	// Split the sensors and actuators into one run for each thread
+	for (t = 0; t < nthreads; t++) {
+		threads[t].sensors = devices + (long)sensors * t / nthreads;
+		threads[t].nsensors = (long)sensors * (t + 1) / nthreads - (long)sensors * t / nthreads;
+		threads[t].actuators = devices + sensors + (long)actuators * t / nthreads;
+		threads[t].nactuators = (long)actuators * (t + 1) / nthreads -
+				(long)actuators * t / nthreads;
+		threads[t].seed = t + 1;
+		memset(threads[t].queues, -1, sizeof(threads[t].queues));
+		memset(threads[t].lanes, -1, sizeof(threads[t].lanes));
+		threads[t].queues[0] = msgid;
+	}
+
+	printf("[INIT] Simulating %d sensors and %d actuators on %d threads, %d readings/s each, "
+			"%d%% alarms, %s data, %d readings per message, for %ds\n", sensors, actuators,
+			nthreads, rate, alarm_pct, normal ? "normal" : "uniform", batch_size, seconds);
+	for (t = 0; t < nthreads; t++) {
+		if (pthread_create(&threads[t].thread, NULL, run_thread, &threads[t]) != 0) {
+			fprintf(stderr, "[ERROR] Could not start fleet thread %d\n", t);
+			exit(INITERR);
+		}
+	}
+
+	start = now_s();
+	while (running && now_s() - start < seconds) {
+		sleep(1);
+
+		messages = readings = full = registered = stops = actions = 0;
+		for (t = 0; t < nthreads; t++) {
+			messages += threads[t].messages;
+			readings += threads[t].readings;
+			full += threads[t].full;
+			registered += threads[t].registered;
+			stops += threads[t].stops;
+			actions += threads[t].actions;
+		}
+		printf("[FLEET] %ld msgs/s, %ld readings/s, %ld actions/s, %ld readings dropped on a "
+				"full queue, %ld registrations, %ld stops\n", messages - last_messages,
+				readings - last_readings, actions - last_actions, full, registered, stops);
+		print_depths();
+		last_messages = messages;
+		last_readings = readings;
+		last_actions = actions;
+	}
+	elapsed = now_s() - start;
+
+	running = 0;
+	for (t = 0; t < nthreads; t++) {
+		pthread_join(threads[t].thread, NULL);
+	}
+
+	messages = readings = full = actions = unquit = 0;
+	for (t = 0; t < nthreads; t++) {
+		messages += threads[t].messages;
+		readings += threads[t].readings;
+		full += threads[t].full;
+		actions += threads[t].actions;
+		unquit += threads[t].unquit;
+	}
+	printf("[STOPPING] Sent %ld messages (%.0f/s) with %ld readings (%.0f/s), acknowledged %ld "
+			"actions, %ld readings dropped on a full queue over %.1fs\n", messages,
+			messages / elapsed, readings, readings / elapsed, actions, full, elapsed);
+	if (unquit > 0) {
+		fprintf(stderr, "[ERROR] %ld devices could not quit, the controller stopped taking "
+				"messages\n", unquit);
+	}
+
+	free(threads);
+	free(devices);
+	exit(0);
+}
@@ -0,0 +1,80 @@
+/*
+ * latency.c
+ *
+ * Log-linear histograms of latencies in microseconds.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <time.h>
+#include "latency.h"
+#include "log.h"
+
+long long int latency_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Returns the bucket a latency is counted in.
+ */
+static int bucket(long long int us) {
+	int top;
+
+	if (us < LATSUB) {
+		return us < 0 ? 0 : us;
+	}
+	top = 63 - __builtin_clzll(us) - 5;
+	if (top >= LATPOWERS) {
+		return LATBUCKETS - 1;
+	}
+	return LATSUB + top * LATSUB + ((us >> top) & (LATSUB - 1));
+}
+
+/**
+ * Returns the largest latency counted in a bucket.
+ */
+static long long int bucket_end(int b) {
+	if (b < LATSUB) {
+		return b;
+	}
+	return ((long long int)(LATSUB + (b - LATSUB) % LATSUB + 1) << ((b - LATSUB) / LATSUB)) - 1;
+}
+
+void hist_add(histogram *hist, long long int us) {
+	hist->buckets[bucket(us)]++;
+	hist->count++;
+	if (us > hist->max) {
+		hist->max = us;
+	}
+}
+
+long long int hist_percentile(histogram *hist, double p) {
+	unsigned long long want = hist->count * p / 100, seen = 0;
+	long long int end;
+	int b;
+
+	if (want >= hist->count) {
+		want = hist->count - 1;
+	}
+	for (b = 0; b < LATBUCKETS; b++) {
+		seen += hist->buckets[b];
+		if (seen > want) {
+			break;
+		}
+	}
+	end = bucket_end(b);
+	return end < hist->max ? end : hist->max;
+}
+
+void hist_print(const char *who, const char *hop, histogram *hist) {
+	if (hist->count == 0) {
+		return;
+	}
+	log_info("[LATENCY] %s %-26s %8llu samples, p50 %8lldus p99 %8lldus p999 %8lldus max %8lldus\n",
+			who, hop, hist->count, hist_percentile(hist, 50), hist_percentile(hist, 99),
+			hist_percentile(hist, 99.9), hist->max);
+}
@@ -0,0 +1,40 @@
+/*
+ * latency.h
+ *
+ * Header file for the latency histograms the controller and cloud keep of
+ * each hop an alarm takes, from the sensor sending the reading to the
+ * cloud receiving the alarm (see trace in message.h).
+ *
+ * Latencies are in microseconds. A histogram has LATSUB buckets for each
+ * power of two, so a percentile read from it is within about 3% of the
+ * latency recorded, however large, and adding one is a few instructions.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "message.h"
+
+// Buckets for each power of two, and powers of two covered, about 19 hours
+#define LATSUB 32
+#define LATPOWERS 36
+#define LATBUCKETS (LATSUB * (LATPOWERS + 1))
+
+// Milliseconds between the latency reports the controller and cloud print
+#define LATPERIOD 10000
+
+typedef struct histogram {
+	unsigned long long count;
+	long long int max;
+	unsigned long long buckets[LATBUCKETS];
+} histogram;
+
+extern long long int latency_now();
+extern void hist_add(histogram *hist, long long int us);
+extern long long int hist_percentile(histogram *hist, double p);
+extern void hist_print(const char *who, const char *hop, histogram *hist);
+
+#endif /* LATENCY_H_ */
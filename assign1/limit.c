@@ -0,0 +1,60 @@
+/*
+ * limit.c
+ *
+ * Alarm suppression for sensors and token buckets for actuators.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include "limit.h"
+
+void limit_reset(alarm_limit *lim) {
+	lim->active = 0;
+	lim->last = -1;
+	lim->suppressed = 0;
+}
+
+unsigned long long limit_alarms(alarm_limit *lim, int quiet, long long int now,
+		unsigned long long alarms, int count) {
+	unsigned long long raised = 0;
+
+	lim->active = (alarms >> (count - 1)) & 1;
+	if (alarms == 0) {
+		return 0;
+	}
+
+	// Readings of a batch all arrive at once, so at most the first raises an alarm
+	if (lim->last == -1 || now - lim->last >= quiet) {
+		raised = alarms & -alarms;
+		lim->last = now;
+	}
+	lim->suppressed += __builtin_popcountll(alarms & ~raised);
+	return raised;
+}
+
+void bucket_reset(bucket *bkt, action_limit *limit, long long int now) {
+	bkt->tokens = limit->burst * 1000;
+	bkt->last = now;
+	bkt->dropped = 0;
+}
+
+int bucket_take(bucket *bkt, action_limit *limit, long long int now) {
+	long long int tokens;
+
+	if (limit->rate == 0) {
+		return 1;
+	}
+
+	// A rate per second fills a thousandth of an action per millisecond
+	tokens = bkt->tokens + (now - bkt->last) * limit->rate;
+	bkt->tokens = tokens > limit->burst * 1000LL ? limit->burst * 1000 : tokens;
+	bkt->last = now;
+
+	if (bkt->tokens < 1000) {
+		bkt->dropped++;
+		return 0;
+	}
+	bkt->tokens -= 1000;
+	return 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * limit.h
+ *
+ * Header file for the limits the controller puts on alarms so a sensor
+ * sitting just over its level can't flood the actuators and the cloud.
+ *
+ * Each sensor remembers whether it is in alarm and when it last raised
+ * one. Once a sensor raises an alarm, its further alarms are suppressed
+ * for its rule's quiet period, however often its readings breach, and it
+ * is reported cleared when a reading leaves it out of alarm.
+ *
+ * Each actuator has a token bucket that fills at its type's rate up to
+ * its burst. An action takes a token and is dropped when there is none.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef LIMIT_H_
+#define LIMIT_H_
+
+#include "message.h"
+
+// Milliseconds a sensor's alarms are suppressed after it raises one, unless
+// its rule gives its own
+#define LIMITQUIET 5000
+
+// Actions per second and in a burst each actuator is sent, unless the rule
+// file gives its type its own
+#define LIMITRATE 10
+#define LIMITBURST 20
+
+// Alarm state of a sensor
+typedef struct alarm_limit {
+	char active;			// Whether the sensor's last reading was in alarm
+	long long int last;		// Monotonic milliseconds of its last alarm raised, -1 for none
+	int suppressed;			// Alarms suppressed since its last alarm raised
+} alarm_limit;
+
+// Token bucket of an actuator
+typedef struct bucket {
+	int tokens;				// Thousandths of an action
+	long long int last;		// Monotonic milliseconds the bucket was last filled
+	int dropped;			// Actions dropped since the last one sent
+} bucket;
+
+// Rate limit of the actuators of a type
+typedef struct action_limit {
+	int rate;				// Actions per second, 0 for no limit
+	int burst;				// Most actions sent at once
+} action_limit;
+
+extern void limit_reset(alarm_limit *lim);
+extern unsigned long long limit_alarms(alarm_limit *lim, int quiet, long long int now,
+		unsigned long long alarms, int count);
+extern void bucket_reset(bucket *bkt, action_limit *limit, long long int now);
+extern int bucket_take(bucket *bkt, action_limit *limit, long long int now);
+
+#endif /* LIMIT_H_ */
@@ -0,0 +1,218 @@
+/*
+ * log.c
+ *
+ * Single-producer single-consumer ring of log lines and the thread that
+ * writes them out. The logging thread moves the head along once a line is
+ * formatted and the flusher the tail once it has copied it out, so neither
+ * waits on the other while the ring has lines and room in it.
+ *
+ * When the ring is empty the flusher marks itself asleep and waits on a
+ * semaphore, which the next line logged posts.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "log.h"
+
+typedef struct log_entry {
+	int level;
+	int len;
+	char text[LOGLINE];
+} log_entry;
+
+int log_threshold = LOGINFO;
+
+static log_entry entries[LOGSLOTS];
+// Each end on its own cache line so the two threads don't pass one back and forth
+static _Alignas(64) atomic_uint head;	// Next line to format, only the logging thread moves it
+static _Alignas(64) atomic_uint tail;	// Next line to write out, only the flusher moves it
+static atomic_int sleeping;			// Set while the flusher waits for a line
+static atomic_int stopping;
+static atomic_ulong dropped;		// Lines lost to a full ring since the last report
+static sem_t wake;
+static pthread_t flusher;
+static int started = 0, registered = 0;
+
+/**
+ * Writes all of a buffer to a stream, however many writes it takes.
+ */
+static void write_all(int fd, const char *buf, int len) {
+	int n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * Writes the ring out until the logger closes, gathering the lines for each
+ * stream so a busy process makes one write for many lines.
+ */
+static void *flush_entries(void *arg) {
+	static char out[LOGBATCH], err[LOGBATCH];
+	unsigned int pos, end;
+	unsigned long lost;
+	log_entry *entry;
+	int nout = 0, nerr = 0;
+
+	while (1) {
+		pos = atomic_load_explicit(&tail, memory_order_relaxed);
+		end = atomic_load_explicit(&head, memory_order_acquire);
+
+		// Nothing left to copy, write out what was gathered and wait for more
+		if (pos == end) {
+			write_all(STDOUT_FILENO, out, nout);
+			nout = 0;
+			write_all(STDERR_FILENO, err, nerr);
+			nerr = 0;
+
+			// Reported from an empty buffer so the report can't run past its end
+			lost = atomic_exchange(&dropped, 0);
+			if (lost > 0) {
+				nerr = snprintf(err, LOGBATCH, "[ERROR] Log was full, %lu lines dropped\n", lost);
+				write_all(STDERR_FILENO, err, nerr);
+				nerr = 0;
+			}
+
+			if (atomic_load(&stopping)) {
+				break;
+			}
+			atomic_store(&sleeping, 1);
+			if (atomic_load(&head) == pos && !atomic_load(&stopping)) {
+				while (sem_wait(&wake) == -1 && errno == EINTR);
+			}
+			atomic_store(&sleeping, 0);
+			continue;
+		}
+
+		for (; pos != end; pos++) {
+			entry = &entries[pos & (LOGSLOTS - 1)];
+			if (entry->level >= LOGWARN) {
+				if (nerr + entry->len > LOGBATCH) {
+					write_all(STDERR_FILENO, err, nerr);
+					nerr = 0;
+				}
+				memcpy(err + nerr, entry->text, entry->len);
+				nerr += entry->len;
+			} else {
+				if (nout + entry->len > LOGBATCH) {
+					write_all(STDOUT_FILENO, out, nout);
+					nout = 0;
+				}
+				memcpy(out + nout, entry->text, entry->len);
+				nout += entry->len;
+			}
+			atomic_store_explicit(&tail, pos + 1, memory_order_release);
+		}
+	}
+	return NULL;
+}
+
+int log_init() {
+	const char *names[] = {"debug", "info", "warn", "error"};
+	const char *level = getenv("LOGLEVEL");
+	sigset_t all, old;
+	int i;
+
+	if (started) {
+		return 1;
+	}
+	for (i = 0; level != NULL && i <= LOGERROR; i++) {
+		if (strcmp(level, names[i]) == 0) {
+			log_threshold = i;
+		}
+	}
+
+	// Lines printed before now go out first
+	fflush(stdout);
+	atomic_init(&head, 0);
+	atomic_init(&tail, 0);
+	atomic_init(&sleeping, 0);
+	atomic_init(&stopping, 0);
+	atomic_init(&dropped, 0);
+	if (sem_init(&wake, 0, 0) == -1) {
+		fprintf(stderr, "[ERROR] Could not create log semaphore: %d\n", errno);
+		return 0;
+	}
+
+	// The flusher takes no signals, they must still interrupt the process's waits
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	i = pthread_create(&flusher, NULL, flush_entries, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (i != 0) {
+		fprintf(stderr, "[ERROR] Could not start log flusher: %d\n", i);
+		sem_destroy(&wake);
+		return 0;
+	}
+	started = 1;
+	if (!registered) {
+		registered = atexit(log_close) == 0;
+	}
+	return 1;
+}
+
+void log_write(int level, const char *format, ...) {
+	log_entry *entry;
+	unsigned int pos;
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	if (!started) {
+		vfprintf(level >= LOGWARN ? stderr : stdout, format, args);
+		va_end(args);
+		return;
+	}
+
+	// A full ring drops the line rather than waiting for the flusher
+	pos = atomic_load_explicit(&head, memory_order_relaxed);
+	if (pos - atomic_load_explicit(&tail, memory_order_acquire) == LOGSLOTS) {
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		va_end(args);
+		return;
+	}
+	entry = &entries[pos & (LOGSLOTS - 1)];
+	len = vsnprintf(entry->text, LOGLINE, format, args);
+	va_end(args);
+
+	// A line cut short still ends the line
+	if (len >= LOGLINE) {
+		len = LOGLINE - 1;
+		entry->text[len - 1] = '\n';
+	}
+	entry->len = len < 0 ? 0 : len;
+	entry->level = level;
+	atomic_store(&head, pos + 1);
+
+	// Wake the flusher if it went to sleep on an empty ring
+	if (atomic_load(&sleeping) && atomic_exchange(&sleeping, 0)) {
+		sem_post(&wake);
+	}
+}
+
+void log_close() {
+	if (!started) {
+		return;
+	}
+
+	// Let the flusher write out every line left before it stops
+	atomic_store(&stopping, 1);
+	sem_post(&wake);
+	pthread_join(flusher, NULL);
+	sem_destroy(&wake);
+	started = 0;
+}
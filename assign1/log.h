@@ -0,0 +1,56 @@
+/*
+ * log.h
+ *
+ * Header file for the logger the controller, cloud, sensor and actuator
+ * print what they handle through. A line is formatted into a ring in the
+ * process's own memory and a flusher thread writes the ring out to stdout,
+ * or stderr for warnings and errors, many lines to a write. Handling a
+ * message never waits on a slow terminal or pipe: when the ring is full
+ * the line is dropped and counted, and the flusher reports how many were.
+ *
+ * Only one thread of a process logs, and never from a signal handler, so
+ * the ring needs no lock. Before log_init and after log_close lines are
+ * printed straight away.
+ *
+ * Lines below the level named in the LOGLEVEL environment variable (debug,
+ * info, warn or error, info by default) are skipped before being formatted.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include "message.h"
+
+// Levels of a line, from the least to the most important
+#define LOGDEBUG 0
+#define LOGINFO 1
+#define LOGWARN 2
+#define LOGERROR 3
+
+// Lines the ring holds, must be a power of two, and the longest line kept
+#define LOGSLOTS 4096
+#define LOGLINE 248
+
+// Bytes the flusher gathers for each stream before writing them
+#define LOGBATCH 65536
+
+extern int log_threshold;
+
+#define log_at(level, ...) do { \
+		if ((level) >= log_threshold) { \
+			log_write((level), __VA_ARGS__); \
+		} \
+	} while (0)
+#define log_debug(...) log_at(LOGDEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOGINFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOGWARN, __VA_ARGS__)
+#define log_error(...) log_at(LOGERROR, __VA_ARGS__)
+
+extern int log_init();
+extern void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+extern void log_close();
+
+#endif /* LOG_H_ */
@@ -22,6 +22,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include "error_types.h"
 
@@ -31,19 +32,58 @@
 #define AC_ACTUATOR_TYPE 'c'
 #define BELL_ACTUATOR_TYPE 'd'
 
-// Define constants for message type
+// Define constants for message type. Codes read by the controller child are
+// kept lowest so it can block on all of them with one receive of -CHILDCODE
 #define INITCODE 1000
-#define DATACODE 1001
-#define STOPCODE 1002
-#define ACKCODE 1003	// Sensor acknowledge code
-#define PRNTCODE 1004
-#define QUITCODE 1005
-#define AACKCODE 1006 	// Actuator acknowledge code
+#define QUITCODE 1001
+#define AACKCODE 1002 	// Actuator acknowledge code
+#define RINGCODE 1003	// Readings are waiting in the shared memory ring
+#define DATACODE 1004
+#define FRAMCODE 1005	// Compact reading from a registered sensor
+#define BTCHCODE 1006	// Batch of readings from a registered sensor
+#define STOPCODE 1007
+#define ACKCODE 1008	// Sensor acknowledge code
+#define CHILDCODE BTCHCODE	// Highest message type the controller child reads
+
+// Device mailboxes are addressed above every code so no PID can collide with them
+#define MBOXBASE 10000
+#define MBOX(pid) (MBOXBASE + (long int)(pid))
+
+// Most worker processes a controller can shard its devices over
+#define MAXSHARDS 64
+
+// Project IDs used with ftok on the message queue path. The first worker
+// reads the main queue, which devices register on, and every other worker
+// has a queue of its own for the readings and acknowledges of the devices
+// it keeps. What the controller sends devices goes the other way on the
+// mail queue, to each device's mailbox, so a receive never has to look
+// past messages going the other way
+#define MAINPROJ 1
+#define MAILPROJ 4
+#define SHARDPROJ 16
+#define QUEUEPROJ(shard) ((shard) == 0 ? MAINPROJ : SHARDPROJ + 2 * (shard))
+
+// Each worker also has an alarm lane, a queue only smoke sensors send their
+// readings to. The worker takes everything waiting in its lane before the
+// rest of its queue, and a flood of temperature readings filling the queue
+// leaves the lane room, so smoke readings never wait behind them
+#define LANEPROJ(shard) (SHARDPROJ + 2 * MAXSHARDS + (shard))
 
 // Define FIFO constants
 #define SERVER_FIFO_NAME "/tmp/serv_fifo"
 #define CLIENT_FIFO_NAME "/tmp/cli_%d_fifo"
 
+// Times an alarm passed each hop on the way from its sensor to the cloud,
+// in microseconds on the monotonic clock every process on the machine shares.
+// A hop not passed is 0
+typedef struct trace {
+	long long int read;			// Sensor sent the reading
+	long long int receive;		// Controller worker received it
+	long long int dispatch;		// Worker sent the action to the actuator
+	long long int ack;			// Actuator acknowledged the action
+	long long int forward;		// Controller parent sent the alarm to the cloud
+} trace;
+
 // Define structures for message queue and device data
 typedef struct proc_info {
 	pid_t pid;
@@ -52,6 +92,13 @@ typedef struct proc_info {
 	char device;
 	int data;
 	long int threshold;
+	int seq;	// Correlation ID echoed back in an actuator's acknowledge
+	unsigned int handle;	// Device handle given back in the acknowledge
+	int shard;	// Worker to send readings to, or an actuator's acknowledge to
+	unsigned int session;	// Controller session the handle and worker belong to, 0 for none
+	pid_t previous;	// PID a device resuming its session had before it restarted
+	int inbox;	// Queue of its own an actuator takes its mail from, -1 to use the mail queue
+	trace stamps;	// When the alarm passed each hop
 } proc_info;
 
 struct proc_msg {
@@ -59,6 +106,48 @@ struct proc_msg {
 	proc_info pinfo;
 };
 
+// Once registered, sensors send readings keyed by the handle from their
+// acknowledge instead of a whole proc_info. Reading times are the low 32
+// bits of the microseconds on the monotonic clock, which the controller
+// expands against its own clock since a reading is never half an hour old.
+#define READTIME(us) ((unsigned int)(us))
+#define READEXPAND(time, now) ((now) - (unsigned int)((unsigned int)(now) - (time)))
+
+// Single reading and the time it was taken
+typedef struct reading {
+	int data;
+	unsigned int time;
+} reading;
+
+// Compact frame carrying one reading
+typedef struct frame_info {
+	unsigned int handle;
+	reading read;
+} frame_info;
+
+struct frame_msg {
+	long int msg_type;
+	frame_info finfo;
+};
+
+// Most readings a sensor sends in one batch message
+#define MAXBATCH 64
+
+// Batch of readings from a registered sensor, only the first count
+// readings are sent so the message size is given by BATCHSIZE(count)
+typedef struct batch_info {
+	unsigned int handle;
+	int count;
+	reading readings[MAXBATCH];
+} batch_info;
+
+#define BATCHSIZE(count) (offsetof(batch_info, readings) + sizeof(reading) * (count))
+
+struct batch_msg {
+	long int msg_type;
+	batch_info binfo;
+};
+
 #endif /* MESSAGE_H_ */
 
 
@@ -0,0 +1,54 @@
+/*
+ * metrics.c
+ *
+ * Shared memory segment holding the controller's metrics.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/shm.h>
+#include "metrics.h"
+
+metrics *create_metrics(key_t key, int nshards, int *shmid) {
+	metrics *stats;
+
+	*shmid = shmget(key, sizeof(metrics), 0666 | IPC_CREAT);
+	if (*shmid == -1) {
+		fprintf(stderr, "Metrics shared memory could not be created! Error Code: %d\n", errno);
+		return NULL;
+	}
+	stats = shmat(*shmid, NULL, 0);
+	if (stats == (void *)-1) {
+		fprintf(stderr, "Metrics shared memory could not be attached! Error Code: %d\n", errno);
+		return NULL;
+	}
+
+	// A segment left by a controller that crashed starts over
+	memset(stats, 0, sizeof(metrics));
+	stats->nshards = nshards;
+	stats->parent = getpid();
+	stats->magic = METRICSMAGIC;
+	return stats;
+}
+
+metrics *attach_metrics(key_t key) {
+	metrics *stats;
+	int shmid = shmget(key, 0, 0);
+
+	if (shmid == -1) {
+		fprintf(stderr, "No controller metrics found! Error Code: %d\n", errno);
+		return NULL;
+	}
+	stats = shmat(shmid, NULL, SHM_RDONLY);
+	if (stats == (void *)-1) {
+		fprintf(stderr, "Metrics shared memory could not be attached! Error Code: %d\n", errno);
+		return NULL;
+	}
+	if (stats->magic != METRICSMAGIC) {
+		fprintf(stderr, "Metrics shared memory is not laid out as expected!\n");
+		shmdt(stats);
+		return NULL;
+	}
+	return stats;
+}
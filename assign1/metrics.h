@@ -0,0 +1,70 @@
+/*
+ * metrics.h
+ *
+ * Header file for the controller's live metrics. The controller keeps its
+ * counters and gauges in a System V shared memory segment next to its
+ * message queue, which the stats program attaches to and reads while the
+ * controller runs.
+ *
+ * Each worker only writes its own slot, and the parent only the parent's
+ * fields, so counting is a plain add to memory the writer already has in
+ * cache. Slots are a cache line apart so workers never share one. Readers
+ * take a copy and work out rates from the change between two copies.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <sys/ipc.h>
+#include "message.h"
+
+// Project ID used with ftok on the message queue path for the segment
+#define METRICSPROJ 3
+
+// Marks the segment as laid out like this header
+#define METRICSMAGIC 0x4d455431
+
+// Message types a worker counts, from INITCODE to CHILDCODE
+#define METRICTYPES (CHILDCODE - INITCODE + 1)
+#define METRICTYPE(code) ((code) - INITCODE)
+
+// What one worker has done and has on hand
+typedef struct worker_metrics {
+	unsigned long long messages[METRICTYPES];	// Messages received of each type
+	unsigned long long readings;		// Readings checked, from any message or the ring
+	unsigned long long alarms;			// Alarms raised
+	unsigned long long suppressed;		// Alarms suppressed in a sensor's quiet period
+	unsigned long long actions;			// Actions sent to actuators
+	unsigned long long dropped;			// Actions dropped over an actuator's rate limit
+	unsigned long long timeouts;		// Actions never acknowledged
+	unsigned long long registered;		// Devices registered with a full handshake
+	unsigned long long resumed;			// Devices that resumed their session after a restart
+	unsigned long long lane;			// Messages taken from the alarm lane
+	unsigned long long checkpoints;		// Checkpoints of the worker's state taken
+	unsigned long long unwindowed;		// Sensors registered past the last window
+	int devices;						// Devices registered
+	int windows;						// Windows in use, the parent reads these
+	int outstanding;					// Actions waiting on an acknowledge
+	pid_t pid;
+	int queue;							// Queue the worker reads
+} __attribute__((aligned(64))) worker_metrics;
+
+typedef struct metrics {
+	unsigned int magic;
+	int nshards;
+	pid_t parent;
+	long long int started;				// Monotonic microseconds the controller started
+	unsigned long long forwarded;		// Alarms the parent sent the cloud
+	unsigned long long aggregates;		// Aggregates the parent sent the cloud
+	int buffered;						// Bytes waiting for the cloud to take them
+	int mail;							// Queue the workers send devices their mail on
+	worker_metrics workers[MAXSHARDS];
+} metrics;
+
+extern metrics *create_metrics(key_t key, int nshards, int *shmid);
+extern metrics *attach_metrics(key_t key);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,120 @@
+/*
+ * pending.c
+ *
+ * Table of outstanding actuator actions. Acknowledgements are matched to
+ * their action by correlation ID in constant time, and expired actions
+ * are found by looking only at the oldest ones.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <time.h>
+#include "pending.h"
+
+long long int now_ms() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Doubles the ring so IDs from oldest to next_seq still fit.
+ *
+ * return: 1 on success, 0 if memory could not be allocated
+ */
+static int grow_pending(pending *table) {
+	action *actions;
+	int i, size = table->size * 2;
+
+	actions = calloc(size, sizeof(action));
+	if (actions == NULL) {
+		fprintf(stderr, "Pending actions could not grow past %d! Error Code: %d\n",
+				table->size, errno);
+		return 0;
+	}
+	for (i = 0; i < table->size; i++) {
+		if (table->actions[i].seq != 0) {
+			actions[table->actions[i].seq & (size - 1)] = table->actions[i];
+		}
+	}
+
+	free(table->actions);
+	table->actions = actions;
+	table->size = size;
+	return 1;
+}
+
+int init_pending(pending *table) {
+	table->size = PENDINITSIZ;
+	table->oldest = 1;
+	table->next_seq = 1;
+	table->count = 0;
+	table->actions = calloc(table->size, sizeof(action));
+	if (table->actions == NULL) {
+		fprintf(stderr, "Pending actions could not be allocated! Error Code: %d\n", errno);
+		return 0;
+	}
+	return 1;
+}
+
+int pending_add(pending *table, int slot, pid_t actuator, proc_info *alarm) {
+	action *act;
+
+	if (table->next_seq - table->oldest == table->size && !grow_pending(table)) {
+		return -1;
+	}
+
+	act = &table->actions[table->next_seq & (table->size - 1)];
+	act->seq = table->next_seq++;
+	act->slot = slot;
+	act->actuator = actuator;
+	act->deadline = now_ms() + ACKTIMEOUT;
+	act->alarm = *alarm;
+	table->count++;
+	return act->seq;
+}
+
+action *pending_find(pending *table, int seq) {
+	action *act;
+
+	if (seq < table->oldest || seq >= table->next_seq) {
+		return NULL;
+	}
+	act = &table->actions[seq & (table->size - 1)];
+	return act->seq == seq ? act : NULL;
+}
+
+void pending_done(pending *table, int seq) {
+	action *act = pending_find(table, seq);
+
+	if (act == NULL) {
+		return;
+	}
+	act->seq = 0;
+	table->count--;
+
+	// Move past every finished action at the old end of the ring
+	while (table->oldest < table->next_seq &&
+			table->actions[table->oldest & (table->size - 1)].seq == 0) {
+		table->oldest++;
+	}
+}
+
+action *pending_expired(pending *table, long long int now) {
+	action *act;
+
+	if (table->count == 0) {
+		return NULL;
+	}
+	act = &table->actions[table->oldest & (table->size - 1)];
+	return act->deadline <= now ? act : NULL;
+}
+
+long long int pending_deadline(pending *table) {
+	if (table->count == 0) {
+		return -1;
+	}
+	return table->actions[table->oldest & (table->size - 1)].deadline;
+}
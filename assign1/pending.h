@@ -0,0 +1,52 @@
+/*
+ * pending.h
+ *
+ * Header file for the table of actuator actions the controller is still
+ * waiting on. Every action gets a correlation ID that the actuator sends
+ * back in its acknowledgement, and a deadline after which the controller
+ * stops waiting for it.
+ *
+ * IDs are handed out in order and every action gets the same timeout, so
+ * the oldest action in the table always has the earliest deadline.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef PENDING_H_
+#define PENDING_H_
+
+#include "message.h"
+
+// Starting size of the table, doubles when more actions are outstanding
+#define PENDINITSIZ 64
+
+// Milliseconds an actuator has to acknowledge an action
+#define ACKTIMEOUT 3000
+
+// Action sent to an actuator that has not been acknowledged yet
+typedef struct action {
+	int seq;				// Correlation ID, 0 when the entry is free
+	int slot;				// Registry slot of the actuator
+	pid_t actuator;			// PID of the actuator the action went to
+	long long int deadline;	// Monotonic milliseconds the acknowledge is due by
+	proc_info alarm;		// Alarm that caused the action
+} action;
+
+typedef struct pending {
+	action *actions;	// Ring indexed by ID, always a power of two long
+	int size;
+	int oldest;			// Oldest ID that may still be outstanding
+	int next_seq;		// ID given to the next action
+	int count;			// Number of outstanding actions
+} pending;
+
+extern long long int now_ms();
+extern int init_pending(pending *table);
+extern int pending_add(pending *table, int slot, pid_t actuator, proc_info *alarm);
+extern action *pending_find(pending *table, int seq);
+extern void pending_done(pending *table, int seq);
+extern action *pending_expired(pending *table, long long int now);
+extern long long int pending_deadline(pending *table);
+
+#endif /* PENDING_H_ */
@@ -0,0 +1,102 @@
+/*
+ * query.c
+ *
+ * Reads the alarms the cloud has stored. Can be run while the cloud is
+ * running, it sees every record stored before it started.
+ *
+ *   ./query
+ *       Lists each segment with its number of records, devices and the
+ *       times of its first and last record, and its size once packed.
+ *
+ *   ./query PID [from_ms [to_ms]]
+ *       Prints the alarms of one device stored between two times, given
+ *       in milliseconds since the epoch. Leaving out a time leaves that
+ *       end of the range open.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <limits.h>
+#include <time.h>
+#include "message.h"
+#include "store.h"
+
+/**
+ * Prints a time in milliseconds since the epoch as local time.
+ */
+void print_time(long long ms) {
+	time_t secs = ms / 1000;
+	char buf[32];
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+	printf("%s.%03lld (%lld)", buf, ms % 1000, ms);
+}
+
+/**
+ * Prints one record found by a query.
+ */
+void print_record(store_record *rec) {
+	print_time(rec->time);
+	printf(" controller %d device %d type %c data %d\n", rec->controller, rec->device,
+			rec->type, rec->data);
+}
+
+int main(int argc, char *argv[]) {
+	long long from = 0, to = LLONG_MAX;
+	store st;
+	segment *raw;
+	packed *pack;
+	pid_t pid;
+	int i, found;
+
+	if (argc > 4) {
+		fprintf(stderr, "[ERROR] Query takes: [PID [from_ms [to_ms]]]\n");
+		exit(INITERR);
+	}
+	if (!open_store(&st, STOREDIR, 0)) {
+		exit(STOREERR);
+	}
+
+	if (argc == 1) {
+		for (i = 0; i < st.nsegs; i++) {
+			if (st.segs[i].raw != NULL) {
+				raw = st.segs[i].raw;
+				printf("[DATA] Segment %d: %d records from %d devices, ", i,
+						atomic_load(&raw->count), raw->ndevices);
+				print_time(raw->first);
+				printf(" to ");
+				print_time(raw->last);
+				printf("\n");
+				continue;
+			}
+
+			pack = st.segs[i].pack;
+			printf("[DATA] Segment %d: %d records in %d device runs packed in %lld bytes "
+					"(%.2f bytes/record), ", i, pack->count, pack->ndevices, pack->size,
+					pack->count ? (double)pack->size / pack->count : 0);
+			print_time(pack->first);
+			printf(" to ");
+			print_time(pack->last);
+			printf("\n");
+		}
+		close_store(&st);
+		exit(0);
+	}
+
+	pid = strtol(argv[1], NULL, 10);
+	if (argc > 2) {
+		from = strtoll(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		to = strtoll(argv[3], NULL, 10);
+	}
+
+	found = store_query(&st, pid, from, to, print_record);
+	if (found == -1) {
+		exit(MEMERR);
+	}
+	printf("[DATA] %d records for device %d in %d segments\n", found, pid, st.nsegs);
+	close_store(&st);
+	exit(0);
+}
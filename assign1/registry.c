@@ -0,0 +1,259 @@
+/*
+ * registry.c
+ *
+ * Device registry used by the controller. Looking up, adding and
+ * removing a device by PID and finding the devices of a type are all
+ * constant time on average, and the registry grows instead of
+ * overflowing when more devices register.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include "registry.h"
+
+/**
+ * Returns the bucket for a PID in a table of nbuckets buckets.
+ */
+static int hash_pid(pid_t pid, int nbuckets) {
+	return ((unsigned int)pid * 2654435761u) & (nbuckets - 1);
+}
+
+/**
+ * Chains slots from start up to the capacity onto the free list.
+ */
+static void free_slots(registry *reg, int start) {
+	int i;
+
+	for (i = reg->capacity - 1; i >= start; i--) {
+		reg->slots[i].used = 0;
+		reg->slots[i].gen = 0;
+		reg->slots[i].hnext = reg->free_slot;
+		reg->free_slot = i;
+	}
+}
+
+/**
+ * Doubles the slot array and the PID table and rehashes the devices.
+ *
+ * return: 1 on success, 0 if memory could not be allocated
+ */
+static int grow_registry(registry *reg) {
+	device *slots;
+	int *buckets;
+	int i, h, old = reg->capacity;
+
+	// Slots past the handle bits could not be told apart by their handles
+	if (old == 1 << HANDLEBITS) {
+		fprintf(stderr, "Registry is full at %d devices!\n", old);
+		return 0;
+	}
+
+	slots = realloc(reg->slots, sizeof(device) * old * 2);
+	if (slots == NULL) {
+		fprintf(stderr, "Registry could not grow past %d devices! Error Code: %d\n", old, errno);
+		return 0;
+	}
+	reg->slots = slots;
+
+	buckets = malloc(sizeof(int) * reg->nbuckets * 2);
+	if (buckets == NULL) {
+		fprintf(stderr, "Registry could not grow past %d devices! Error Code: %d\n", old, errno);
+		return 0;
+	}
+	free(reg->buckets);
+	reg->buckets = buckets;
+	reg->nbuckets *= 2;
+	reg->capacity *= 2;
+
+	// Rehash every registered device into the bigger table
+	for (i = 0; i < reg->nbuckets; i++) {
+		reg->buckets[i] = -1;
+	}
+	for (i = 0; i < old; i++) {
+		h = hash_pid(reg->slots[i].info.pid, reg->nbuckets);
+		reg->slots[i].hnext = reg->buckets[h];
+		reg->buckets[h] = i;
+	}
+
+	// The registry only grows when full so every new slot is free
+	free_slots(reg, old);
+	return 1;
+}
+
+int init_registry(registry *reg) {
+	int i;
+
+	reg->capacity = REGINITSIZ;
+	reg->nbuckets = REGINITSIZ;
+	reg->count = 0;
+	reg->free_slot = -1;
+	reg->slots = malloc(sizeof(device) * reg->capacity);
+	reg->buckets = malloc(sizeof(int) * reg->nbuckets);
+	if (reg->slots == NULL || reg->buckets == NULL) {
+		fprintf(stderr, "Registry could not be allocated! Error Code: %d\n", errno);
+		return 0;
+	}
+
+	for (i = 0; i < reg->nbuckets; i++) {
+		reg->buckets[i] = -1;
+	}
+	for (i = 0; i < REGTYPES; i++) {
+		reg->type_head[i] = -1;
+		reg->type_count[i] = 0;
+		reg->type_next[i] = -1;
+	}
+	free_slots(reg, 0);
+	return 1;
+}
+
+void free_registry(registry *reg) {
+	free(reg->slots);
+	free(reg->buckets);
+	reg->slots = NULL;
+	reg->buckets = NULL;
+	reg->capacity = reg->count = 0;
+}
+
+int registry_find(registry *reg, pid_t pid) {
+	int i = reg->buckets[hash_pid(pid, reg->nbuckets)];
+
+	while (i != -1 && reg->slots[i].info.pid != pid) {
+		i = reg->slots[i].hnext;
+	}
+	return i;
+}
+
+int registry_add(registry *reg, proc_info *info) {
+	device *dev;
+	int i, h;
+	unsigned char type = info->device;
+
+	if (reg->free_slot == -1 && !grow_registry(reg)) {
+		return -1;
+	}
+
+	// Take the first free slot
+	i = reg->free_slot;
+	dev = &reg->slots[i];
+	reg->free_slot = dev->hnext;
+	dev->info = *info;
+	dev->used = 1;
+	dev->outstanding = 0;
+
+	// Link it into its PID bucket
+	h = hash_pid(info->pid, reg->nbuckets);
+	dev->hnext = reg->buckets[h];
+	reg->buckets[h] = i;
+
+	// Link it to the front of its type list
+	dev->tprev = -1;
+	dev->tnext = reg->type_head[type];
+	if (dev->tnext != -1) {
+		reg->slots[dev->tnext].tprev = i;
+	}
+	reg->type_head[type] = i;
+	reg->type_count[type]++;
+
+	reg->count++;
+	return i;
+}
+
+int registry_remove(registry *reg, pid_t pid) {
+	device *dev;
+	int *link = &reg->buckets[hash_pid(pid, reg->nbuckets)];
+	int i;
+	unsigned char type;
+
+	// Find the link pointing at the device so it can be unchained
+	while (*link != -1 && reg->slots[*link].info.pid != pid) {
+		link = &reg->slots[*link].hnext;
+	}
+	if (*link == -1) {
+		return 0;
+	}
+	i = *link;
+	dev = &reg->slots[i];
+	*link = dev->hnext;
+
+	// Unlink it from its type list
+	type = dev->info.device;
+	if (dev->tprev != -1) {
+		reg->slots[dev->tprev].tnext = dev->tnext;
+	} else {
+		reg->type_head[type] = dev->tnext;
+	}
+	if (dev->tnext != -1) {
+		reg->slots[dev->tnext].tprev = dev->tprev;
+	}
+	if (reg->type_next[type] == i) {
+		reg->type_next[type] = dev->tnext;
+	}
+	reg->type_count[type]--;
+
+	// Give the slot back to the free list, old handles to it stop resolving
+	dev->used = 0;
+	dev->gen++;
+	dev->hnext = reg->free_slot;
+	reg->free_slot = i;
+	reg->count--;
+	return 1;
+}
+
+void registry_rekey(registry *reg, int slot, pid_t pid) {
+	device *dev = &reg->slots[slot];
+	int *link = &reg->buckets[hash_pid(dev->info.pid, reg->nbuckets)];
+	int h;
+
+	// Unchain it from the old PID's bucket and chain it into the new one's,
+	// the slot and so the handle stay the same
+	while (*link != slot) {
+		link = &reg->slots[*link].hnext;
+	}
+	*link = dev->hnext;
+	dev->info.pid = pid;
+	h = hash_pid(pid, reg->nbuckets);
+	dev->hnext = reg->buckets[h];
+	reg->buckets[h] = slot;
+}
+
+int registry_pick(registry *reg, char type) {
+	unsigned char t = type;
+	int start, i, best = -1;
+
+	// Start after the last actuator picked, or at the head of the pool
+	start = reg->type_next[t] != -1 ? reg->type_next[t] : reg->type_head[t];
+	if (start == -1) {
+		return -1;
+	}
+
+	// Walk the pool once looking for the least loaded actuator, an idle one
+	// can't be beaten so take it straight away
+	i = start;
+	do {
+		if (best == -1 || reg->slots[i].outstanding < reg->slots[best].outstanding) {
+			best = i;
+			if (reg->slots[i].outstanding == 0) {
+				break;
+			}
+		}
+		i = reg->slots[i].tnext != -1 ? reg->slots[i].tnext : reg->type_head[t];
+	} while (i != start);
+
+	reg->type_next[t] = reg->slots[best].tnext;
+	return best;
+}
+
+unsigned int registry_handle(registry *reg, int slot) {
+	return (unsigned int)reg->slots[slot].gen << HANDLEBITS | slot;
+}
+
+int registry_resolve(registry *reg, unsigned int handle) {
+	int slot = HANDLESLOT(handle);
+
+	if (slot >= reg->capacity || !reg->slots[slot].used ||
+			registry_handle(reg, slot) != handle) {
+		return -1;
+	}
+	return slot;
+}
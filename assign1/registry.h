@@ -0,0 +1,76 @@
+/*
+ * registry.h
+ *
+ * Header file for the controller's device registry. Devices are kept
+ * in a growable slot array indexed by a hash table on PID, and every
+ * device is also linked into a list for its device type so actuators
+ * of a type can be found without scanning the whole registry.
+ *
+ * Slot numbers stay the same for as long as the device is registered.
+ * A device's handle is its slot plus the slot's generation, which moves
+ * on whenever the slot is freed, so a handle kept after its device was
+ * removed no longer resolves even if the slot is reused. A device that
+ * restarts under a new PID can be rekeyed to it and keeps its handle.
+ *
+ * The type lists double as actuator pools. Picking an actuator takes the
+ * one with the least outstanding actions, starting after the last one
+ * picked so that equally loaded actuators are used round robin.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#include "message.h"
+#include "rules.h"
+
+// Starting number of slots, both tables double when they fill up
+#define REGINITSIZ 16
+
+// Number of device type lists, one per possible device type character
+#define REGTYPES 256
+
+// Handles keep the slot in the low bits and the generation above them
+#define HANDLEBITS 24
+#define HANDLESLOT(handle) ((handle) & ((1u << HANDLEBITS) - 1))
+
+// Registered device and its links into the PID table and type list
+typedef struct device {
+	proc_info info;
+	char used;
+	int hnext;		// Next slot in the same PID bucket
+	int tprev;		// Previous slot with the same device type
+	int tnext;		// Next slot with the same device type
+	int outstanding;	// Actions sent to the device that are not acknowledged
+	unsigned char gen;	// Generation of the slot, part of the device's handle
+	int rule;			// Rule the device's readings are checked against
+	rule_state state;	// What the rule remembers about the device
+	alarm_limit limit;	// Alarm state of a sensor
+	bucket tokens;		// Actions an actuator may still be sent
+} device;
+
+typedef struct registry {
+	device *slots;
+	int capacity;			// Number of slots allocated
+	int count;				// Number of devices registered
+	int free_slot;			// First unused slot, chained through hnext
+	int *buckets;			// PID hash table holding first slot of each chain
+	int nbuckets;			// Always a power of two
+	int type_head[REGTYPES];	// First slot of each device type list
+	int type_count[REGTYPES];	// Devices registered of each type
+	int type_next[REGTYPES];	// Slot to start the next pick from, -1 for the head
+} registry;
+
+extern int init_registry(registry *reg);
+extern void free_registry(registry *reg);
+extern int registry_add(registry *reg, proc_info *info);
+extern int registry_find(registry *reg, pid_t pid);
+extern int registry_remove(registry *reg, pid_t pid);
+extern void registry_rekey(registry *reg, int slot, pid_t pid);
+extern int registry_pick(registry *reg, char type);
+extern unsigned int registry_handle(registry *reg, int slot);
+extern int registry_resolve(registry *reg, unsigned int handle);
+
+#endif /* REGISTRY_H_ */
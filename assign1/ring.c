@@ -0,0 +1,167 @@
+/*
+ * ring.c
+ *
+ * Bounded multi-producer single-consumer ring in System V shared memory.
+ * Sensors claim a position by moving the head along and publish the frame
+ * through the cell's sequence number, so a sensor that is part way through
+ * a push never holds up the others.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/shm.h>
+#include "ring.h"
+
+ring *create_ring(key_t key, unsigned int size, unsigned int session, int *shmid) {
+	ring *rng;
+	unsigned int i;
+	int kept = 0;
+
+	// A ring left by a controller of the same session that handed over or crashed
+	// is taken over as it is, with the frames sensors pushed while no controller
+	// was running. Frames from another session carry handles this one never gave
+	*shmid = shmget(key, sizeof(ring) + sizeof(ring_cell) * size, 0666 | IPC_CREAT | IPC_EXCL);
+	if (*shmid == -1 && errno == EEXIST) {
+		*shmid = shmget(key, sizeof(ring) + sizeof(ring_cell) * size, 0666);
+		kept = 1;
+	}
+	if (*shmid == -1) {
+		fprintf(stderr, "Ring shared memory could not be created! Error Code: %d\n", errno);
+		return NULL;
+	}
+	rng = shmat(*shmid, NULL, 0);
+	if (rng == (void *)-1) {
+		fprintf(stderr, "Ring shared memory could not be attached! Error Code: %d\n", errno);
+		return NULL;
+	}
+	if (kept && rng->size == size && rng->session == session && !ring_closed(rng)) {
+		return rng;
+	}
+	if (kept) {
+		ring_close(rng);
+		shmdt(rng);
+		shmctl(*shmid, IPC_RMID, 0);
+		return create_ring(key, size, session, shmid);
+	}
+
+	rng->size = size;
+	rng->tail = 0;
+	rng->session = session;
+	atomic_init(&rng->head, 0);
+	atomic_init(&rng->sleeping, 0);
+	atomic_init(&rng->closed, 0);
+	for (i = 0; i < size; i++) {
+		atomic_init(&rng->cells[i].seq, i);
+	}
+	return rng;
+}
+
+ring *attach_ring(key_t key, unsigned int session) {
+	ring *rng;
+	int shmid = shmget(key, 0, 0);
+
+	// No ring means the controller uses the message queue only
+	if (shmid == -1) {
+		return NULL;
+	}
+	rng = shmat(shmid, NULL, 0);
+	if (rng == (void *)-1) {
+		fprintf(stderr, "Ring shared memory could not be attached! Error Code: %d\n", errno);
+		return NULL;
+	}
+
+	// A ring another controller left behind is drained by nobody
+	if (rng->session != session || ring_closed(rng)) {
+		shmdt(rng);
+		return NULL;
+	}
+	return rng;
+}
+
+void remove_ring(key_t key) {
+	ring *rng;
+	int shmid = shmget(key, 0, 0);
+
+	if (shmid == -1) {
+		return;
+	}
+	rng = shmat(shmid, NULL, 0);
+	if (rng != (void *)-1) {
+		ring_close(rng);
+		shmdt(rng);
+	}
+	shmctl(shmid, IPC_RMID, 0);
+}
+
+void ring_close(ring *rng) {
+	atomic_store(&rng->closed, 1);
+}
+
+int ring_closed(ring *rng) {
+	return atomic_load_explicit(&rng->closed, memory_order_acquire);
+}
+
+int ring_push(ring *rng, frame_info *frame) {
+	ring_cell *cell;
+	unsigned int pos = atomic_load_explicit(&rng->head, memory_order_relaxed);
+	int dif;
+
+	if (ring_closed(rng)) {
+		return 0;
+	}
+	while (1) {
+		cell = &rng->cells[pos & (rng->size - 1)];
+		dif = (int)(atomic_load_explicit(&cell->seq, memory_order_acquire) - pos);
+
+		if (dif == 0) {
+			// Cell is free, claim the position unless another sensor beat us to it
+			if (atomic_compare_exchange_weak_explicit(&rng->head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (dif < 0) {
+			// The controller has not popped this cell from the last lap, ring is full
+			return 0;
+		} else {
+			pos = atomic_load_explicit(&rng->head, memory_order_relaxed);
+		}
+	}
+
+	cell->frame = *frame;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return 1;
+}
+
+int ring_pop(ring *rng, frame_info *frame) {
+	ring_cell *cell = &rng->cells[rng->tail & (rng->size - 1)];
+
+	if (atomic_load_explicit(&cell->seq, memory_order_acquire) != rng->tail + 1) {
+		return 0;
+	}
+
+	*frame = cell->frame;
+	atomic_store_explicit(&cell->seq, rng->tail + rng->size, memory_order_release);
+	rng->tail++;
+	return 1;
+}
+
+int ring_sleep(ring *rng) {
+	ring_cell *cell = &rng->cells[rng->tail & (rng->size - 1)];
+
+	// Announce the sleep before the last look so a sensor pushing at the same
+	// time either sees the flag or has its frame seen here
+	atomic_store(&rng->sleeping, 1);
+	if (atomic_load(&cell->seq) == rng->tail + 1) {
+		atomic_store(&rng->sleeping, 0);
+		return 0;
+	}
+	return 1;
+}
+
+int ring_wake(ring *rng) {
+	// Pairs with the store in ring_sleep, only one sensor wins the exchange
+	atomic_thread_fence(memory_order_seq_cst);
+	return atomic_load_explicit(&rng->sleeping, memory_order_relaxed) &&
+			atomic_exchange(&rng->sleeping, 0);
+}
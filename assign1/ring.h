@@ -0,0 +1,64 @@
+/*
+ * ring.h
+ *
+ * Header file for the shared memory ring sensors can use instead of the
+ * message queue to send readings to the controller. Any number of sensors
+ * push frames into the ring and the controller child pops them, neither
+ * side making a system call while the ring has data in it.
+ *
+ * When the controller runs out of frames it marks itself asleep and
+ * blocks on the message queue. The first sensor to push after that sends
+ * one RINGCODE message on the queue to wake it up.
+ *
+ * A ring is stamped with the session of the controller draining it, and
+ * sensors only attach to a ring of the session they were acknowledged in.
+ * A segment that is removed stays mapped by the sensors attached to it, so
+ * whoever removes a ring closes it first. A sensor can't push into a
+ * closed ring and goes back to its worker to find out where to send.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdatomic.h>
+#include <sys/ipc.h>
+#include "message.h"
+
+// Project ID used with ftok on the message queue path for each worker's ring
+#define RINGPROJ(shard) ((shard) == 0 ? 2 : SHARDPROJ + 2 * (shard) + 1)
+
+// Frames the controller's ring holds, must be a power of two
+#define RINGSIZE 4096
+
+// Frame and the position it was written for, a cell is ready to pop when
+// seq is one past its position and free to push when seq equals it
+typedef struct ring_cell {
+	atomic_uint seq;
+	frame_info frame;
+} ring_cell;
+
+typedef struct ring {
+	unsigned int size;
+	atomic_uint head;			// Next position to push, shared by all sensors
+	char pad[64];				// Keep the controller's fields off the sensors' line
+	unsigned int tail;			// Next position to pop, only the controller uses it
+	atomic_int sleeping;		// Set while the controller is blocked on the queue
+	unsigned int session;		// Session of the controller draining the ring
+	atomic_int closed;			// Set once no controller drains the ring any more
+	ring_cell cells[];
+} ring;
+
+extern ring *create_ring(key_t key, unsigned int size, unsigned int session, int *shmid);
+extern ring *attach_ring(key_t key, unsigned int session);
+extern void remove_ring(key_t key);
+extern void ring_close(ring *rng);
+extern int ring_closed(ring *rng);
+extern int ring_push(ring *rng, frame_info *frame);
+extern int ring_pop(ring *rng, frame_info *frame);
+extern int ring_sleep(ring *rng);
+extern int ring_wake(ring *rng);
+
+#endif /* RING_H_ */
@@ -0,0 +1,343 @@
+/*
+ * rules.c
+ *
+ * Compiles rule files into rule tables and checks batches of readings
+ * against them. The comparisons use GCC's vector extensions so they are
+ * done four readings at a time even without optimisation turned on.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <limits.h>
+#include "rules.h"
+
+// Four readings compared at once
+typedef int v4si __attribute__((vector_size(16)));
+
+void init_rules(rule_set *set) {
+	memset(set, 0, sizeof(rule_set));
+
+	// Default rule, in alarm above the sensor's threshold
+	strcpy(set->rules[0].name, "default");
+	set->rules[0].flags = RULETHRESH;
+	set->rules[0].partner = -1;
+	set->rules[0].quiet = LIMITQUIET;
+	set->count = 1;
+
+	set->limits[0].rate = set->limits[1].rate = LIMITRATE;
+	set->limits[0].burst = set->limits[1].burst = LIMITBURST;
+}
+
+action_limit *rules_limit(rule_set *set, char type) {
+	if (type == AC_ACTUATOR_TYPE) {
+		return &set->limits[0];
+	} else if (type == BELL_ACTUATOR_TYPE) {
+		return &set->limits[1];
+	}
+	return NULL;
+}
+
+/**
+ * Returns the sensor type for a type name, 0 if it is not one.
+ */
+static char sensor_type(const char *name) {
+	if (strcmp(name, "temperature") == 0 || strcmp(name, "temp") == 0) {
+		return TEMP_SENSOR_TYPE;
+	} else if (strcmp(name, "smoke") == 0) {
+		return SMOKE_SENSOR_TYPE;
+	}
+	return 0;
+}
+
+/**
+ * Reads a level, either a number or 'threshold'.
+ *
+ * param word: Word to read.
+ * param level: Filled with the number.
+ * return: 1 for a number, 2 for the threshold, 0 if it is neither
+ */
+static int read_level(const char *word, int *level) {
+	char *end;
+
+	if (word == NULL) {
+		return 0;
+	}
+	if (strcmp(word, "threshold") == 0) {
+		return 2;
+	}
+	*level = strtol(word, &end, 10);
+	return *end == '\0';
+}
+
+/**
+ * Finds or adds the watch for a sensor name.
+ *
+ * return: Index of the watch, -1 if there is no room for another
+ */
+static int find_watch(rule_set *set, const char *name) {
+	int i;
+
+	for (i = 0; i < set->nwatches; i++) {
+		if (strcmp(set->watches[i].name, name) == 0) {
+			return i;
+		}
+	}
+	if (set->nwatches == MAXRULES) {
+		return -1;
+	}
+	snprintf(set->watches[i].name, sizeof(set->watches[i].name), "%s", name);
+	set->watches[i].alarm = 0;
+	return set->nwatches++;
+}
+
+/**
+ * Reads the rate limit line of an actuator type.
+ *
+ * param limit: Limit of the actuator type to fill.
+ * param save: Position in the line after the word 'limit'.
+ * return: 1 if the line is valid, 0 if not
+ */
+static int read_limit(action_limit *limit, char **save) {
+	char *word;
+	int rate, burst = LIMITBURST;
+
+	if (read_level(strtok_r(NULL, " \t\r\n", save), &rate) != 1 || rate < 0 || rate > 1000000) {
+		return 0;
+	}
+	if ((word = strtok_r(NULL, " \t\r\n", save)) != NULL) {
+		if (strcmp(word, "burst") != 0 ||
+				read_level(strtok_r(NULL, " \t\r\n", save), &burst) != 1 ||
+				burst < 1 || burst > 1000000 || strtok_r(NULL, " \t\r\n", save) != NULL) {
+			return 0;
+		}
+	}
+	limit->rate = rate;
+	limit->burst = burst;
+	return 1;
+}
+
+int rules_add(rule_set *set, char *line) {
+	char *word, *save;
+	rule rl;
+	int level;
+
+	// Skip comments and blank lines
+	if ((word = strchr(line, '#')) != NULL) {
+		*word = '\0';
+	}
+	if ((word = strtok_r(line, " \t\r\n", &save)) == NULL) {
+		return 1;
+	}
+	if (set->count == MAXRULES) {
+		return 0;
+	}
+
+	memset(&rl, 0, sizeof(rl));
+	rl.partner = -1;
+	rl.quiet = LIMITQUIET;
+	snprintf(rl.name, sizeof(rl.name), "%s", word);
+	rl.type = sensor_type(word);
+
+	word = strtok_r(NULL, " \t\r\n", &save);
+	if (word != NULL && strcmp(word, "limit") == 0) {
+		if (strcmp(rl.name, "ac") == 0) {
+			return read_limit(rules_limit(set, AC_ACTUATOR_TYPE), &save);
+		} else if (strcmp(rl.name, "bell") == 0) {
+			return read_limit(rules_limit(set, BELL_ACTUATOR_TYPE), &save);
+		}
+		return 0;
+	} else if (word != NULL && strcmp(word, "rise") == 0) {
+		rl.flags |= RULERISE;
+	} else if (word == NULL || strcmp(word, "above") != 0) {
+		return 0;
+	}
+	switch (read_level(strtok_r(NULL, " \t\r\n", &save), &level)) {
+	case 1:
+		rl.raise = level;
+		break;
+	case 2:
+		rl.flags |= RULETHRESH;
+		break;
+	default:
+		return 0;
+	}
+
+	while ((word = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		if (strcmp(word, "below") == 0 && !(rl.flags & RULERISE)) {
+			if (read_level(strtok_r(NULL, " \t\r\n", &save), &level) != 1) {
+				return 0;
+			}
+			rl.flags |= RULEHOLD;
+			rl.clear = level;
+		} else if (strcmp(word, "count") == 0) {
+			if (read_level(strtok_r(NULL, " \t\r\n", &save), &level) != 1 || level < 1) {
+				return 0;
+			}
+			rl.n = level;
+			word = strtok_r(NULL, " \t\r\n", &save);
+			if (word == NULL || strcmp(word, "of") != 0 ||
+					read_level(strtok_r(NULL, " \t\r\n", &save), &level) != 1 ||
+					level < rl.n || level > 64) {
+				return 0;
+			}
+			rl.flags |= RULECOUNT;
+			rl.m = level;
+		} else if (strcmp(word, "and") == 0) {
+			if ((word = strtok_r(NULL, " \t\r\n", &save)) == NULL ||
+					(rl.partner = find_watch(set, word)) == -1) {
+				return 0;
+			}
+			rl.flags |= RULEAND;
+		} else if (strcmp(word, "quiet") == 0) {
+			if (read_level(strtok_r(NULL, " \t\r\n", &save), &level) != 1 || level < 0) {
+				return 0;
+			}
+			rl.quiet = level;
+		} else {
+			return 0;
+		}
+	}
+
+	set->rules[set->count++] = rl;
+	return 1;
+}
+
+int load_rules(rule_set *set, const char *path) {
+	char line[256];
+	FILE *file;
+	int number = 0;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Rule file %s could not be opened! Error Code: %d\n", path, errno);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		if (!rules_add(set, line)) {
+			fprintf(stderr, "Rule on line %d of %s is not valid or does not fit!\n", number, path);
+			fclose(file);
+			return 0;
+		}
+	}
+	fclose(file);
+	return 1;
+}
+
+int rules_attach(rule_set *set, rule_state *state, const char *name, char type) {
+	int i, r = 0;
+
+	memset(state, 0, sizeof(rule_state));
+	state->watch = -1;
+	for (i = 0; i < set->nwatches; i++) {
+		if (strcmp(set->watches[i].name, name) == 0) {
+			state->watch = i;
+			set->watches[i].alarm = 0;
+		}
+	}
+
+	// A rule for the sensor's name wins over one for its type
+	for (i = 1; i < set->count; i++) {
+		if (set->rules[i].type == 0 && strcmp(set->rules[i].name, name) == 0) {
+			return i;
+		}
+		if (r == 0 && set->rules[i].type != 0 && set->rules[i].type == type) {
+			r = i;
+		}
+	}
+	return r;
+}
+
+/**
+ * Compares readings to a level four at a time.
+ *
+ * return: Mask with bit i set if values[i] is above the level
+ */
+static unsigned long long above(const int *values, int count, int level) {
+	v4si limit = {level, level, level, level}, bits = {1, 2, 4, 8}, v, gt;
+	unsigned long long mask = 0;
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		memcpy(&v, values + i, sizeof(v));
+		gt = (v > limit) & bits;
+		mask |= (unsigned long long)(gt[0] | gt[1] | gt[2] | gt[3]) << i;
+	}
+	for (; i < count; i++) {
+		mask |= (unsigned long long)(values[i] > level) << i;
+	}
+	return mask;
+}
+
+unsigned long long rules_check(rule_set *set, int r, rule_state *state,
+		long int threshold, const int *data, int count) {
+	rule *rl = &set->rules[r];
+	int rises[MAXBATCH + 4], shifted[MAXBATCH + 4], level = rl->raise, i;
+	const int *values = data;
+	unsigned long long breach, clear = 0, alarms, window, hit;
+	v4si a, b;
+
+	if (rl->flags & RULETHRESH) {
+		level = threshold > INT_MAX ? INT_MAX : threshold < INT_MIN ? INT_MIN : threshold;
+	}
+
+	// The rise of each reading is its data less the one before it, the first
+	// reading a sensor sends has not risen
+	if (rl->flags & RULERISE) {
+		shifted[0] = state->seen ? state->prev : data[0];
+		memcpy(shifted + 1, data, sizeof(int) * count);
+		for (i = 0; i + 4 <= count; i += 4) {
+			memcpy(&a, data + i, sizeof(a));
+			memcpy(&b, shifted + i, sizeof(b));
+			a -= b;
+			memcpy(rises + i, &a, sizeof(a));
+		}
+		for (; i < count; i++) {
+			rises[i] = data[i] - shifted[i];
+		}
+		values = rises;
+	}
+	state->prev = data[count - 1];
+	state->seen = 1;
+
+	breach = above(values, count, level);
+	if (rl->flags & RULEHOLD) {
+		clear = ~above(data, count, rl->clear - 1);
+	}
+
+	// Without a count or hold every breach is an alarm, otherwise the
+	// breaches go through the rule's state one reading at a time
+	if (!(rl->flags & (RULECOUNT | RULEHOLD))) {
+		alarms = breach;
+	} else {
+		alarms = 0;
+		window = rl->m == 64 ? ~0ULL : (1ULL << rl->m) - 1;
+		for (i = 0; i < count; i++) {
+			hit = (breach >> i) & 1;
+			state->history = (state->history << 1) | hit;
+			if (rl->flags & RULECOUNT) {
+				hit = __builtin_popcountll(state->history & window) >= rl->n;
+			}
+			if (rl->flags & RULEHOLD) {
+				if (hit) {
+					state->hold = 1;
+				} else if ((clear >> i) & 1) {
+					state->hold = 0;
+				}
+				hit = state->hold;
+			}
+			alarms |= hit << i;
+		}
+	}
+
+	// A combined rule only alarms while its partner was in alarm at its last reading
+	if ((rl->flags & RULEAND) && !set->watches[rl->partner].alarm) {
+		alarms = 0;
+	}
+	if (state->watch != -1) {
+		set->watches[state->watch].alarm = (alarms >> (count - 1)) & 1;
+	}
+	return alarms;
+}
@@ -0,0 +1,102 @@
+/*
+ * rules.h
+ *
+ * Header file for the rules the controller checks readings against. Rules
+ * are read from a file with one rule per line:
+ *
+ *   DEVICE above LEVEL [below LEVEL] [count N of M] [and DEVICE] [quiet MS]
+ *   DEVICE rise LEVEL [count N of M] [and DEVICE] [quiet MS]
+ *   ACTUATOR limit RATE [burst N]
+ *
+ * DEVICE is a sensor's name or its type, temp or smoke, and the rule for a
+ * sensor's name is used before the rule for its type. LEVEL is a number or
+ * 'threshold' for the sensor's own threshold.
+ *
+ *   above     a reading breaches when its data is above the level
+ *   rise      a reading breaches when its data rose more than the level
+ *             since the sensor's reading before it
+ *   below     once breached, the sensor stays in alarm until its data
+ *             falls below this level
+ *   count     the sensor is only in alarm when N of its last M readings
+ *             breached, M up to 64
+ *   and       the sensor is only in alarm while the named sensor is too
+ *   quiet     milliseconds the sensor's alarms are suppressed after it
+ *             raises one, 5000 by default (see limit.h)
+ *
+ * ACTUATOR is ac or bell, and each actuator of the type is sent at most
+ * RATE actions a second and N at once, 10 and 20 by default. A RATE of 0
+ * takes the limit off.
+ *
+ * Sensors without a rule are in alarm when their data is above their
+ * threshold, as they always were. A reading that leaves its sensor in
+ * alarm raises an alarm unless the sensor is in its quiet period.
+ *
+ * Each rule is compiled into a table entry of flags and levels. Readings
+ * are checked a batch at a time, comparing four readings per instruction,
+ * then the breaches are run through the rule's state as a bit mask.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef RULES_H_
+#define RULES_H_
+
+#include "message.h"
+#include "limit.h"
+
+// Most rules a rule file can hold, including the default rule
+#define MAXRULES 256
+
+// Flags making up a compiled rule
+#define RULERISE 0x01		// Compare the rise since the last reading, not the data
+#define RULEHOLD 0x02		// Stay in alarm until the data falls below the clear level
+#define RULECOUNT 0x04		// Need N breaches in the last M readings
+#define RULEAND 0x08		// Need the partner rule's sensor in alarm too
+#define RULETHRESH 0x10		// Raise level is the sensor's threshold
+
+// Compiled rule
+typedef struct rule {
+	char name[25];		// Sensor name or type the rule is for
+	char type;			// Sensor type if the rule is for a type, 0 for a name
+	unsigned char flags;
+	int raise;			// Level a reading must be above to breach
+	int clear;			// Level the data must fall below to leave alarm
+	unsigned char n;
+	unsigned char m;
+	short partner;		// Watch of the sensor that must also be in alarm
+	int quiet;			// Milliseconds alarms are suppressed after one is raised
+} rule;
+
+// Sensor another rule depends on and whether it was in alarm at its last reading
+typedef struct rule_watch {
+	char name[25];
+	char alarm;
+} rule_watch;
+
+// What a sensor's rule remembers between readings
+typedef struct rule_state {
+	unsigned long long history;	// Breaches of the last readings, newest in bit 0
+	int prev;					// Data of the last reading
+	char seen;					// Whether there was a last reading
+	char hold;					// Whether a held alarm is still on
+	short watch;				// Watch to keep up to date, -1 if no rule depends on it
+} rule_state;
+
+typedef struct rule_set {
+	rule rules[MAXRULES];	// Rule 0 is the default rule
+	int count;
+	rule_watch watches[MAXRULES];
+	int nwatches;
+	action_limit limits[2];	// Rate limit of ac then bell actuators
+} rule_set;
+
+extern void init_rules(rule_set *set);
+extern int rules_add(rule_set *set, char *line);
+extern int load_rules(rule_set *set, const char *path);
+extern action_limit *rules_limit(rule_set *set, char type);
+extern int rules_attach(rule_set *set, rule_state *state, const char *name, char type);
+extern unsigned long long rules_check(rule_set *set, int r, rule_state *state,
+		long int threshold, const int *data, int count);
+
+#endif /* RULES_H_ */
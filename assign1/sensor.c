@@ -10,28 +10,132 @@
  *
  * Sends initialization message on message queue to controller before reading
  * data. Waits until the controller sends an acknowledge signal then starts
- * reading random data. Sends all message data via message struct in message
- * header file on the message queue. If the data is greater than the threshold,
- * an alarm is printed.
+ * reading random data. Readings are sent on the message queue in compact
+ * frames under the handle the controller gave back in the acknowledge. If the
+ * data is greater than the threshold, an alarm is printed.
+ *
+ * The acknowledge also says which of the controller's workers keeps the
+ * sensor. Readings go to that worker's queue, or its ring if the controller
+ * was started with the shared memory transport, falling back to its queue
+ * while the ring is full. Init and quit messages stay on the main queue and
+ * the acknowledge and stop come on the mail queue.
+ * Smoke sensors send their readings to the worker's alarm lane instead, so
+ * they are handled ahead of any temperature readings waiting.
+ *
+ * A sensor that died comes back under the session token it kept (see
+ * session.h), and once the controller acknowledges the resume sends its
+ * readings under the handle it had.
+ *
+ * Optionally takes a batch size, flush interval and reading period. With a
+ * batch size above 1 the readings are collected and sent together in one
+ * batch message once the batch is full or the oldest reading has waited for
+ * the flush interval.
+ *
+ * Lastly takes an overload policy for when the worker's queue is full. By
+ * default the sensor waits for room as it always did. Otherwise it never
+ * waits: readings the queue has no room for are held back and sent as one
+ * batch once it has room again, keeping only the newest BACKLOG readings,
+ * one reading in SAMPLEEVERY or just the minimum, maximum and latest
+ * reading. The readings dropped or left out of a summary are counted and
+ * printed once the queue has room and when the sensor stops.
  *
  *  Created on: Oct 3, 2015
  *      Author: Nicolas McCallum 100936816
  */
 
 #include <sys/msg.h>
+#include <sys/shm.h>
+#include <time.h>
 #include "message.h"
+#include "ring.h"
+#include "log.h"
+#include "session.h"
+
+// Defaults for the optional arguments
+#define BATCHSIZ 1		// Readings per batch, 1 sends every reading on its own
+#define FLUSHMS 1000	// Milliseconds the oldest reading may wait in a batch
+#define PERIODMS 2000	// Milliseconds between readings
+
+// What to do with readings while the worker's queue is full
+#define POLICYBLOCK 0		// Wait for room
+#define POLICYDROP 1		// Hold back the newest BACKLOG readings, dropping the oldest
+#define POLICYSAMPLE 2		// Hold back one reading in SAMPLEEVERY, dropping the rest
+#define POLICYAGGREGATE 3	// Hold back the minimum, maximum and latest reading
+
+#define BACKLOG MAXBATCH	// Readings held back at most, they go out in one batch
+#define SAMPLEEVERY 4
 
 char *name;
 char type;
 long int threshold;
+char *path;
 int msgid;
+int mail_msgid;
+int data_msgid;
+int lane_msgid = -1;	// Alarm lane of the worker, only smoke sensors use one
+int shard;				// Worker and session named in the acknowledge
+unsigned int session;
 struct proc_msg msg;
+struct frame_msg frame;
+struct batch_msg batch;
+int batch_size = BATCHSIZ;
+int flush_ms = FLUSHMS;
+int period_ms = PERIODMS;
 int running = 1;
+ring *readings = NULL;
+int policy = POLICYBLOCK;
+struct batch_msg held;		// Readings held back while the queue is full
+reading low, high, latest;	// Summary of the readings held back to aggregate
+int overloaded = 0;			// Readings since the queue was first full, 0 if it has room
+long long int overload_start;
+unsigned long long dropped = 0;		// Readings never sent
+unsigned long long aggregated = 0;	// Readings only sent in a summary
+
+/**
+ * Connects to the queue and ring of the controller worker that keeps the
+ * sensor, given in the acknowledge. Only a ring stamped with the session of
+ * the acknowledge is used.
+ */
+void join_shard() {
+	if (shard == 0) {
+		data_msgid = msgid;
+	} else {
+		data_msgid = msgget(ftok(path, QUEUEPROJ(shard)), 0666);
+		if (data_msgid == -1) {
+			// Whatever left the token, the next run registers in full
+			fprintf(stderr, "[ERROR] Error connecting to worker %d queue: %d\n", shard, errno);
+			drop_session(path, name);
+			exit(MQGERR);
+		}
+	}
+
+	// Smoke readings go in the worker's alarm lane if the controller made one
+	if (readings != NULL) {
+		shmdt(readings);
+		readings = NULL;
+	}
+	if (type == SMOKE_SENSOR_TYPE) {
+		lane_msgid = msgget(ftok(path, LANEPROJ(shard)), 0666);
+		if (lane_msgid != -1) {
+			printf("[INIT] Sending readings through alarm lane of worker %d\n", shard);
+			return;
+		}
+	}
+
+	// Otherwise use the worker's ring if the controller made one
+	readings = attach_ring(ftok(path, RINGPROJ(shard)), session);
+	if (readings != NULL) {
+		printf("[INIT] Sending readings through shared memory ring of worker %d\n", shard);
+	} else {
+		printf("[INIT] Sending readings to worker %d on queue %d\n", shard, data_msgid);
+	}
+}
 
 /**
  * Sends initialization message to controller via message queue. Waits until
  * the controller sends back and acknowledge signal that the device was
- * registered.
+ * registered, or resumed if the init carries a session token, then sends
+ * readings under the handle and to the worker the acknowledge names.
  */
 void send_init() {
 	// Set the message type to init
@@ -46,7 +150,7 @@ void send_init() {
 
     // Wait for ack signal back
     while(1) {
-        if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), getpid(), 0) == -1) {
+        if (msgrcv(mail_msgid, (void *)&msg, sizeof(msg.pinfo), MBOX(getpid()), 0) == -1) {
             fprintf(stderr, "[ERROR] Failed during checking the init messages: %d\n", errno);
             exit(MQRERR);
         }
@@ -54,18 +158,44 @@ void send_init() {
         // Make sure its the right code sent back otherwise ignore the message
         if (msg.pinfo.data == ACKCODE) {
             printf("[INIT] Received acknowledge signal from controller\n");
+            frame.finfo.handle = msg.pinfo.handle;
+            batch.binfo.handle = msg.pinfo.handle;
+            shard = msg.pinfo.shard;
+            session = msg.pinfo.session;
+            join_shard();
+            save_session(path, name, &msg.pinfo);
             break;
         }
     }
 }
 
+/**
+ * Sends an init carrying the session token left by the sensor's last run
+ * so the controller moves it over to this PID. Nothing from the token is
+ * used until the controller acknowledges: a controller that no longer has
+ * the session registers the sensor again under a new handle and worker.
+ *
+ * param token: Session token from the last run.
+ */
+void resume_session(session_token *token) {
+	msg.pinfo.session = token->session;
+	msg.pinfo.handle = token->handle;
+	msg.pinfo.shard = token->shard;
+	msg.pinfo.previous = token->pid;
+
+	send_init();
+	if (msg.pinfo.session == token->session && msg.pinfo.handle == token->handle) {
+		printf("[INIT] Resumed session of PID %d with controller\n", token->pid);
+	}
+}
+
 /**
  * Checks for the stop message sent via message queue from the controller.
  *
  * return: 1 if the stop message exists and 0 if it doesn't
  */
 int check_for_stop() {
-	if (msgrcv(msgid, (void *)&msg, sizeof(msg.pinfo), getpid(), IPC_NOWAIT) == -1) {
+	if (msgrcv(mail_msgid, (void *)&msg, sizeof(msg.pinfo), MBOX(getpid()), IPC_NOWAIT) == -1) {
 		if (errno != ENOMSG && errno != EAGAIN) {
 			fprintf(stderr, "[ERROR] Failed during checking the stop message: %d\n", errno);
 		    exit(MQRERR);
@@ -74,9 +204,8 @@ int check_for_stop() {
 	} else {
 		if (msg.pinfo.data == STOPCODE) {
 			return 1;
-		} else {
-			return 0;
 		}
+		return 0;
 	}
 }
 
@@ -84,21 +213,284 @@ int check_for_stop() {
  * Method to print the alarm statement to the console.
  */
 void init_alarm(int data) {
-	printf("[ALARM] Temperature %d greater than threshold!\n", data);
+	log_info("[ALARM] Temperature %d greater than threshold!\n", data);
 }
 
 /**
- * Sends the data to the controller via the message queue.
+ * Returns the time from the monotonic clock in microseconds, which the
+ * controller and cloud time each hop of an alarm against.
  */
-void send_data(int data) {
-	// Set the message type to device info
-	msg.msg_type = DATACODE;
-	msg.pinfo.data = data;
+long long int now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Sends a message of readings to the worker's queue, or its alarm lane for
+ * a smoke sensor. A doorbell on the queue wakes the worker if it is asleep,
+ * if the queue has no room for it the worker is busy and looks at the lane
+ * soon anyway.
+ *
+ * param buf: Frame or batch message.
+ * param size: Bytes of the message after its type.
+ * param flags: IPC_NOWAIT to not wait for room.
+ * return: 1 if sent, 0 if the queue had no room
+ */
+int send_readings(void *buf, size_t size, int flags) {
+	struct proc_msg bell;
 
-	if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
+	if (msgsnd(lane_msgid != -1 ? lane_msgid : data_msgid, buf, size, flags) == -1) {
+		if (errno == EAGAIN) {
+			return 0;
+		}
 		fprintf(stderr, "[ERROR] Failed to send data to message queue!\n");
 		exit(MQSERR);
 	}
+	if (lane_msgid != -1) {
+		bell.msg_type = RINGCODE;
+		if (msgsnd(data_msgid, (void *)&bell, 0, IPC_NOWAIT) == -1 && errno != EAGAIN) {
+			fprintf(stderr, "[ERROR] Failed to wake controller for alarm lane!\n");
+			exit(MQSERR);
+		}
+	}
+	return 1;
+}
+
+/**
+ * Holds back a reading the worker's queue had no room for as the overload
+ * policy says.
+ *
+ * param read: Reading to hold back.
+ */
+void hold_reading(reading *read) {
+	reading *r = held.binfo.readings;
+
+	overloaded++;
+	if (policy == POLICYSAMPLE && (overloaded - 1) % SAMPLEEVERY != 0) {
+		dropped++;
+		return;
+	}
+
+	// Only the summary of the readings is kept to aggregate
+	if (policy == POLICYAGGREGATE) {
+		if (overloaded == 1 || read->data < low.data) {
+			low = *read;
+		}
+		if (overloaded == 1 || read->data > high.data) {
+			high = *read;
+		}
+		latest = *read;
+		return;
+	}
+
+	if (held.binfo.count == BACKLOG) {
+		memmove(r, r + 1, sizeof(reading) * (BACKLOG - 1));
+		held.binfo.count--;
+		dropped++;
+	}
+	r[held.binfo.count++] = *read;
+}
+
+/**
+ * Compares readings by the time they were read for qsort.
+ */
+int compare_reading(const void *a, const void *b) {
+	unsigned int x = ((const reading *)a)->time, y = ((const reading *)b)->time;
+
+	// Times wrap every 71 minutes so they are compared by their difference
+	return (int)(x - y);
+}
+
+/**
+ * Puts the minimum, maximum and latest reading held back in the batch in
+ * the order they were read, each one once.
+ */
+void hold_summary() {
+	reading *r = held.binfo.readings;
+	int i, n = 1;
+
+	r[0] = low;
+	r[1] = high;
+	r[2] = latest;
+	qsort(r, 3, sizeof(reading), compare_reading);
+	for (i = 1; i < 3; i++) {
+		if (r[i].time != r[n - 1].time || r[i].data != r[n - 1].data) {
+			r[n++] = r[i];
+		}
+	}
+	held.binfo.count = n;
+}
+
+/**
+ * Sends the readings held back while the worker's queue was full in one
+ * batch if it has room now.
+ *
+ * return: 1 if no readings are held back any more, 0 if the queue is still full
+ */
+int flush_held() {
+	if (!overloaded) {
+		return 1;
+	}
+
+	if (policy == POLICYAGGREGATE) {
+		hold_summary();
+	}
+	if (held.binfo.count > 0) {
+		held.msg_type = BTCHCODE;
+		held.binfo.handle = batch.binfo.handle;
+		if (!send_readings(&held, BATCHSIZE(held.binfo.count), IPC_NOWAIT)) {
+			return 0;
+		}
+	}
+	if (policy == POLICYAGGREGATE) {
+		aggregated += overloaded - held.binfo.count;
+	}
+	log_info("[OVERLOAD] Queue has room again after %lldms, sent %d of %d readings held back "
+			"(%llu dropped, %llu aggregated so far)\n", (now_us() - overload_start) / 1000,
+			held.binfo.count, overloaded, dropped, aggregated);
+	held.binfo.count = 0;
+	overloaded = 0;
+	return 1;
+}
+
+/**
+ * Sends a message of readings, or holds its readings back if the worker's
+ * queue has no room and the overload policy doesn't wait for it. Readings
+ * already held back go first.
+ *
+ * param buf: Frame or batch message.
+ * param size: Bytes of the message after its type.
+ * param reads: Readings in the message.
+ * param count: Number of readings.
+ */
+void deliver_readings(void *buf, size_t size, reading *reads, int count) {
+	int i;
+
+	if (policy == POLICYBLOCK) {
+		send_readings(buf, size, 0);
+		return;
+	}
+	if (flush_held() && send_readings(buf, size, IPC_NOWAIT)) {
+		return;
+	}
+
+	if (!overloaded) {
+		overload_start = now_us();
+		log_info("[OVERLOAD] Queue of the controller is full, holding back readings\n");
+	}
+	for (i = 0; i < count; i++) {
+		hold_reading(&reads[i]);
+	}
+}
+
+/**
+ * Sends the data to the controller via the message queue in a compact
+ * frame under the handle from the acknowledge.
+ */
+void send_data(int data) {
+	// Set the message type to compact reading
+	frame.msg_type = FRAMCODE;
+	frame.finfo.read.data = data;
+	frame.finfo.read.time = READTIME(now_us());
+	deliver_readings(&frame, sizeof(frame.finfo), &frame.finfo.read, 1);
+}
+
+/**
+ * Pushes the data into the controller's shared memory ring and rings the
+ * doorbell on the message queue if the controller is asleep. Sends the
+ * data on the message queue instead if the ring is full.
+ *
+ * A ring that was closed, or whose worker's queue was removed under the
+ * doorbell, is no longer drained. The sensor joins its worker again, which
+ * finds the queue the controller now uses and a ring only if it still
+ * drains one, and sends the data there.
+ */
+void push_data(int data) {
+	struct proc_msg bell;
+
+	frame.finfo.read.data = data;
+	frame.finfo.read.time = READTIME(now_us());
+	if (!ring_push(readings, &frame.finfo)) {
+		if (ring_closed(readings)) {
+			log_info("[INIT] Shared memory ring of worker %d was closed\n", shard);
+			join_shard();
+		}
+		send_data(data);
+		return;
+	}
+
+	if (ring_wake(readings)) {
+		bell.msg_type = RINGCODE;
+		if (msgsnd(data_msgid, (void *)&bell, 0, 0) == -1) {
+			if (errno != EIDRM && errno != EINVAL) {
+				fprintf(stderr, "[ERROR] Failed to wake controller for ring!\n");
+				exit(MQSERR);
+			}
+			log_info("[INIT] Queue of worker %d was removed\n", shard);
+			join_shard();
+			if (readings == NULL) {
+				send_data(data);
+			}
+		}
+	}
+}
+
+/**
+ * Sends the readings collected in the batch to the controller via the
+ * message queue and empties the batch.
+ */
+void flush_batch() {
+	if (batch.binfo.count == 0) {
+		return;
+	}
+
+	batch.msg_type = BTCHCODE;
+	deliver_readings(&batch, BATCHSIZE(batch.binfo.count), batch.binfo.readings, batch.binfo.count);
+	batch.binfo.count = 0;
+}
+
+/**
+ * Adds a reading to the batch and sends the batch if it is full or the
+ * oldest reading in it has waited for the flush interval.
+ *
+ * param data: Reading to add.
+ */
+void batch_data(int data) {
+	long long int now = now_us();
+
+	batch.binfo.readings[batch.binfo.count].data = data;
+	batch.binfo.readings[batch.binfo.count].time = READTIME(now);
+	batch.binfo.count++;
+
+	if (batch.binfo.count == batch_size ||
+			READTIME(now) - batch.binfo.readings[0].time >= flush_ms * 1000u) {
+		flush_batch();
+	}
+}
+
+/**
+ * Sleeps until the next reading is due. A batch whose oldest reading has
+ * waited for the flush interval is sent in between, so a reading period
+ * longer than the flush interval doesn't hold the batch back.
+ */
+void wait_reading() {
+	long long int due = now_us() + period_ms * 1000LL, now, flush;
+	unsigned int waited;
+
+	while (running && (now = now_us()) < due) {
+		flush = due;
+		if (batch.binfo.count > 0) {
+			waited = READTIME(now) - batch.binfo.readings[0].time;
+			if (waited >= flush_ms * 1000u) {
+				flush_batch();
+				continue;
+			}
+			flush = now + flush_ms * 1000LL - waited;
+		}
+		usleep((flush < due ? flush : due) - now);
+	}
 }
 
 /**
@@ -121,6 +513,28 @@ void set_type(char *input) {
 	}
 }
 
+/**
+ * Sets the overload policy given the input from console.
+ *
+ * Must be one of 'block', 'drop', 'sample' or 'aggregate'.
+ *
+ * param input: input string from console.
+ */
+void set_policy(char *input) {
+	if (strcmp(input, "block") == 0) {
+		policy = POLICYBLOCK;
+	} else if (strcmp(input, "drop") == 0) {
+		policy = POLICYDROP;
+	} else if (strcmp(input, "sample") == 0) {
+		policy = POLICYSAMPLE;
+	} else if (strcmp(input, "aggregate") == 0) {
+		policy = POLICYAGGREGATE;
+	} else {
+		fprintf(stderr, "[ERROR] Invalid overload policy entered. Must be one of: block, drop, sample, aggregate!\n");
+		exit(INITERR);
+	}
+}
+
 /**
  * Signal handler that checks for interrupt signal. Upon interrupt signal, message
  * is sent to controller to delete the device from the device list and stops the
@@ -138,6 +552,7 @@ void signal_handler(int signum) {
 		// Send quit message to the controller
 		msg.msg_type = QUITCODE;
 		msg.pinfo.pid = getpid();
+		msg.pinfo.device = type;
 		if (msgsnd(msgid, (void *)&msg, sizeof(msg.pinfo), 0) == -1) {
 			fprintf(stderr, "[ERROR] Quit signal failed to be sent\n");
 			exit(MQSERR);
@@ -146,10 +561,31 @@ void signal_handler(int signum) {
 }
 
 int main(int argc, char *argv[]) {
+	session_token token;
+
 	// Check that correct command line args were passed
-	if (argc != 5) {
-		perror("[ERROR] Sensor takes exactly 4 arguments (Path for Message Queue, "
-				"Sensor type, Name, Threshold)!\n");
+	if (argc < 5 || argc > 9) {
+		perror("[ERROR] Sensor takes 4 arguments (Path for Message Queue, "
+				"Sensor type, Name, Threshold) and optionally Batch size, Flush ms, Period ms, "
+				"Overload policy!\n");
+		exit(INITERR);
+	}
+
+	// Batch options, a batch can't be bigger than a batch message holds
+	if (argc > 5) {
+		batch_size = strtol(argv[5], NULL, 10);
+	}
+	if (argc > 6) {
+		flush_ms = strtol(argv[6], NULL, 10);
+	}
+	if (argc > 7) {
+		period_ms = strtol(argv[7], NULL, 10);
+	}
+	if (argc > 8) {
+		set_policy(argv[8]);
+	}
+	if (batch_size < 1 || batch_size > MAXBATCH) {
+		fprintf(stderr, "[ERROR] Batch size must be between 1 and %d!\n", MAXBATCH);
 		exit(INITERR);
 	}
 
@@ -170,12 +606,20 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Connect to message queue given the path
-	msgid = msgget(ftok(argv[1], 1), 0666 | IPC_CREAT);
+	path = argv[1];
+	msgid = msgget(ftok(argv[1], MAINPROJ), 0666 | IPC_CREAT);
 	if (msgid == -1) {
 		fprintf(stderr, "[ERROR] Error connecting to message queue: %d\n", errno);
 		exit(INITERR);
 	}
-	printf("[INIT] Connecting to message queue: %d, key %d\n", msgid, ftok(argv[1], 1));
+	printf("[INIT] Connecting to message queue: %d, key %d\n", msgid, ftok(argv[1], MAINPROJ));
+
+	// The controller's acknowledge and stop come on the mail queue
+	mail_msgid = msgget(ftok(argv[1], MAILPROJ), 0666 | IPC_CREAT);
+	if (mail_msgid == -1) {
+		fprintf(stderr, "[ERROR] Error connecting to mail queue: %d\n", errno);
+		exit(INITERR);
+	}
 
 	// Set the properties in the message struct
 	strcpy(msg.pinfo.name, argv[3]);
@@ -183,38 +627,71 @@ int main(int argc, char *argv[]) {
     msg.pinfo.data = 0;
 	msg.pinfo.pid = getpid();
 	msg.pinfo.threshold = threshold;
+	msg.pinfo.inbox = -1;
+	batch.binfo.count = 0;
+
+	// Resume the last run's session if it died, otherwise send the init and
+	// wait for ack signal
+	if (load_session(path, name, &token)) {
+		resume_session(&token);
+	} else {
+		send_init();
+	}
 
-	// Send the init and wait for ack signal
-    send_init();    
+	// Readings are printed through the logger so a slow terminal can't delay them
+	if (!log_init()) {
+		exit(INITERR);
+	}
 
     int range = threshold + 20;
 	while(running) {
 		// Look for quit message from controller
 		if (check_for_stop()) {
-			printf("[STOPPING] Stop signal received, shutting down...\n");
+			log_info("[STOPPING] Stop signal received, shutting down...\n");
 			break;
 		}
 
+		// Readings held back go out as soon as the queue has room
+		flush_held();
+
 		// Randomize temperature data
 		int r = rand() % range;
 
 		// Print the data to the screen for the sensor type
 		if (type == TEMP_SENSOR_TYPE) {
-		    printf("[DATA] Temperature sensor %s reads temperature %d (Threshold: %ld)\n",
+		    log_info("[DATA] Temperature sensor %s reads temperature %d (Threshold: %ld)\n",
 		    		name, r, threshold);
 		} else {
-		    printf("[DATA] Smoke sensor %s reads smoke level %d (Threshold: %ld)\n",
+		    log_info("[DATA] Smoke sensor %s reads smoke level %d (Threshold: %ld)\n",
 		    		name, r, threshold);
 		}
-		// Send the data over the message queue
-		send_data(r);
+		// Send the data through the ring, or over the message queue on its own
+		// or as part of a batch
+		if (readings != NULL) {
+			push_data(r);
+		} else if (batch_size == 1) {
+			send_data(r);
+		} else {
+			batch_data(r);
+		}
 
 		// Check if the value is over the threshold and print alarm if it is
 		if (r > threshold) {
 			init_alarm(r);
 		}
-		sleep(2);
+		wait_reading();
+	}
+
+	// The controller has forgotten the sensor, readings still held back are lost
+	if (overloaded) {
+		dropped += policy == POLICYAGGREGATE ? overloaded : held.binfo.count;
+	}
+	if (dropped > 0 || aggregated > 0) {
+		log_info("[OVERLOAD] %llu readings dropped and %llu aggregated while the controller was behind\n",
+				dropped, aggregated);
 	}
 
+	// Only a sensor that died resumes its session
+	drop_session(path, name);
 	exit(0);
 }
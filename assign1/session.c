@@ -0,0 +1,94 @@
+/*
+ * session.c
+ *
+ * Reads and writes the session token files of devices.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/ipc.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "session.h"
+
+/**
+ * Fills in the path of a device's token file, making the user's token
+ * directory if it isn't there yet.
+ *
+ * return: 1 if the device can keep a token there, 0 if not
+ */
+static int token_path(char *buf, const char *path, const char *name) {
+	struct stat info;
+	int n;
+
+	if (strchr(name, '/') != NULL) {
+		return 0;
+	}
+	snprintf(buf, 128, SESSIONDIR, (int)getuid());
+	if (mkdir(buf, 0700) == -1 && errno != EEXIST) {
+		return 0;
+	}
+
+	// Another user could have made it first to read or plant tokens
+	if (lstat(buf, &info) == -1 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() ||
+			(info.st_mode & 077) != 0) {
+		return 0;
+	}
+	n = snprintf(buf, 128, SESSIONPATH, (int)getuid(), (unsigned int)ftok(path, MAINPROJ), name);
+	return n < 128;
+}
+
+int load_session(const char *path, const char *name, session_token *token) {
+	char file[128];
+	int fd, n;
+
+	if (!token_path(file, path, name)) {
+		return 0;
+	}
+	fd = open(file, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1) {
+		return 0;
+	}
+	n = read(fd, token, sizeof(session_token));
+	close(fd);
+	if (n != sizeof(session_token) || token->session == 0 || token->pid <= 0) {
+		return 0;
+	}
+
+	// A device of the same name that is still running keeps its session
+	return kill(token->pid, 0) == -1 && errno == ESRCH;
+}
+
+void save_session(const char *path, const char *name, proc_info *info) {
+	session_token token;
+	char file[128];
+	int fd;
+
+	if (info->session == 0 || !token_path(file, path, name)) {
+		return;
+	}
+	token.session = info->session;
+	token.handle = info->handle;
+	token.shard = info->shard;
+	token.pid = getpid();
+	token.inbox = info->inbox;
+
+	// A device that can't keep its token just registers in full next time
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd == -1) {
+		return;
+	}
+	if (write(fd, &token, sizeof(token)) != sizeof(token)) {
+		unlink(file);
+	}
+	close(fd);
+}
+
+void drop_session(const char *path, const char *name) {
+	char file[128];
+
+	if (token_path(file, path, name)) {
+		unlink(file);
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * session.h
+ *
+ * Header file for the session tokens sensors and actuators keep so they can
+ * come back after a restart without a full handshake. The acknowledge of a
+ * registration names the controller's session along with the device's
+ * handle and worker, and the device saves them with its PID in a small file
+ * named after the controller's queue and the device, in a directory only
+ * the user running it can use. A name with a '/' in it keeps no token.
+ *
+ * A device that starts with a token sends an init carrying it. If the
+ * controller still has the device under its old PID in the same session it
+ * moves it over to the new PID, keeping its handle, rule state and window,
+ * and acknowledges it under that handle. Otherwise it registers the device
+ * again and the acknowledge carries its new handle and worker. Either way
+ * the device waits for the acknowledge, since a token from an earlier
+ * controller names a handle and worker the current one may give to another
+ * device or not have. A device that quits or is stopped removes its token,
+ * so only a device that died comes back this way. A token whose PID is
+ * still running belongs to another device of the same name, the device
+ * registers in full instead and the controller never moves a running
+ * device to a new PID.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include "message.h"
+
+// Directory of the user's tokens, only they can read it, and the token file
+// of a device in it by the key of the controller's main queue and the device's name
+#define SESSIONDIR "/tmp/iot_session_%d"
+#define SESSIONPATH SESSIONDIR "/%x_%s"
+
+typedef struct session_token {
+	unsigned int session;
+	unsigned int handle;
+	int shard;
+	pid_t pid;
+	int inbox;		// Inbox the device's run made, -1 if none
+} session_token;
+
+extern int load_session(const char *path, const char *name, session_token *token);
+extern void save_session(const char *path, const char *name, proc_info *info);
+extern void drop_session(const char *path, const char *name);
+
+#endif /* SESSION_H_ */
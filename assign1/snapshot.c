@@ -0,0 +1,371 @@
+/*
+ * snapshot.c
+ *
+ * Checkpoints and journal of a controller worker's state.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include "snapshot.h"
+
+// Journal entries read at a time while replaying
+#define REPLAYBATCH 256
+
+/**
+ * Returns the bytes a checkpoint of the registry and windows takes.
+ */
+static long long snapshot_size(registry *reg, int nwindows) {
+	return sizeof(snap_header) + sizeof(device) * (long long)reg->capacity +
+			sizeof(int) * (long long)reg->nbuckets + sizeof(window) * (long long)nwindows;
+}
+
+/**
+ * Returns the checksum of a journal entry, over everything before its check.
+ */
+static unsigned int journal_check(journal_entry *entry) {
+	const unsigned char *bytes = (const unsigned char *)entry;
+	unsigned int sum = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < offsetof(journal_entry, check); i++) {
+		sum = (sum ^ bytes[i]) * 16777619u;
+	}
+	return sum;
+}
+
+/**
+ * Walks a list of slots linked through the int at link in each device,
+ * taking a step from left for each slot. Fails on a slot outside the table,
+ * or once left runs out, which a loop or lists that share slots get to.
+ */
+static int valid_list(device *slots, int capacity, int first, size_t link, int *left) {
+	int i;
+
+	for (i = first; i != -1; i = *(int *)((char *)&slots[i] + link)) {
+		if (i < 0 || i >= capacity || --*left < 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Checks every index a checkpoint holds before any of them is used, the
+ * registry's links and tables, the devices' rules and watches and the
+ * windows' queues, so a damaged or planted file can't send the worker
+ * outside of them.
+ *
+ * returns: 1 if the checkpoint can be restored, 0 otherwise.
+ */
+static int valid_checkpoint(snap_header *saved) {
+	registry *reg = &saved->reg;
+	device *slots = (device *)(saved + 1);
+	int *buckets = (int *)(slots + reg->capacity);
+	window *windows = (window *)(buckets + reg->nbuckets);
+	int capacity = reg->capacity, left, i;
+
+	if ((reg->nbuckets & (reg->nbuckets - 1)) != 0 || reg->count < 0 || reg->count > capacity ||
+			saved->rules.count < 1 || saved->rules.count > MAXRULES ||
+			saved->rules.nwatches < 0 || saved->rules.nwatches > MAXRULES) {
+		return 0;
+	}
+	for (i = 0; i < capacity; i++) {
+		if (slots[i].hnext < -1 || slots[i].hnext >= capacity ||
+				slots[i].tprev < -1 || slots[i].tprev >= capacity ||
+				slots[i].tnext < -1 || slots[i].tnext >= capacity) {
+			return 0;
+		}
+		if (slots[i].used && (slots[i].rule < 0 || slots[i].rule >= saved->rules.count ||
+				slots[i].state.watch < -1 || slots[i].state.watch >= saved->rules.nwatches)) {
+			return 0;
+		}
+	}
+
+	// Every slot is on one PID chain or the free list, and on at most one type list
+	left = capacity;
+	for (i = 0; i < reg->nbuckets; i++) {
+		if (!valid_list(slots, capacity, buckets[i], offsetof(device, hnext), &left)) {
+			return 0;
+		}
+	}
+	if (!valid_list(slots, capacity, reg->free_slot, offsetof(device, hnext), &left)) {
+		return 0;
+	}
+	left = capacity;
+	for (i = 0; i < REGTYPES; i++) {
+		if (reg->type_count[i] < 0 || reg->type_next[i] < -1 || reg->type_next[i] >= capacity ||
+				!valid_list(slots, capacity, reg->type_head[i], offsetof(device, tnext), &left)) {
+			return 0;
+		}
+	}
+
+	for (i = 0; i < saved->nwindows; i++) {
+		if (windows[i].minh >= WINDOWSIZE || windows[i].minn > WINDOWSIZE ||
+				windows[i].maxh >= WINDOWSIZE || windows[i].maxn > WINDOWSIZE) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Maps the checkpoint at the snapshot's path if there is a whole one for
+ * its worker.
+ */
+static void map_checkpoint(snapshot *snap) {
+	struct stat info;
+	snap_header *saved;
+	int fd;
+
+	fd = open(snap->path, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "Checkpoint %s could not be opened! Error Code: %d\n", snap->path, errno);
+		}
+		return;
+	}
+	if (fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(snap_header)) {
+		fprintf(stderr, "Checkpoint %s is not a checkpoint!\n", snap->path);
+		close(fd);
+		return;
+	}
+	saved = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (saved == MAP_FAILED) {
+		fprintf(stderr, "Checkpoint %s could not be mapped! Error Code: %d\n", snap->path, errno);
+		return;
+	}
+
+	// A checkpoint is renamed into place whole, so only another layout fails these
+	if (saved->magic != SNAPMAGIC || saved->shard != snap->shard || saved->nwindows < 0 ||
+			saved->reg.capacity < 1 || saved->reg.nbuckets < 1 ||
+			snapshot_size(&saved->reg, saved->nwindows) != info.st_size || !valid_checkpoint(saved)) {
+		fprintf(stderr, "Checkpoint %s is not a checkpoint!\n", snap->path);
+		munmap(saved, info.st_size);
+		return;
+	}
+	snap->saved = saved;
+	snap->size = info.st_size;
+	snap->epoch = saved->epoch;
+}
+
+int open_snapshot(snapshot *snap, const char *dir, key_t key, int shard) {
+	struct stat info;
+
+	snap->shard = shard;
+	snap->saved = NULL;
+	snap->size = 0;
+	snap->epoch = 0;
+	snap->entries = 0;
+	snprintf(snap->path, sizeof(snap->path), SNAPNAME, dir, (unsigned int)key, shard);
+	snprintf(snap->journal_path, sizeof(snap->journal_path), JOURNALNAME, dir,
+			(unsigned int)key, shard);
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		fprintf(stderr, "State directory %s could not be created! Error Code: %d\n", dir, errno);
+		return 0;
+	}
+
+	// Another user could have made it first to plant a checkpoint
+	if (lstat(dir, &info) == -1 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() ||
+			(info.st_mode & 077) != 0) {
+		fprintf(stderr, "State directory %s is not a private directory of this user!\n", dir);
+		return 0;
+	}
+	snap->journal = open(snap->journal_path, O_RDWR | O_CREAT | O_APPEND | O_NOFOLLOW, 0600);
+	if (snap->journal == -1) {
+		fprintf(stderr, "Journal %s could not be opened! Error Code: %d\n", snap->journal_path, errno);
+		return 0;
+	}
+	map_checkpoint(snap);
+	return 1;
+}
+
+void close_snapshot(snapshot *snap, int keep) {
+	if (snap->saved != NULL) {
+		munmap(snap->saved, snap->size);
+		snap->saved = NULL;
+	}
+	if (snap->journal != -1) {
+		close(snap->journal);
+		snap->journal = -1;
+	}
+
+	// Without the files the next controller starts afresh
+	if (!keep) {
+		unlink(snap->path);
+		unlink(snap->journal_path);
+	}
+}
+
+int snapshot_take(snapshot *snap, unsigned int session, int nshards, registry *reg,
+		window *windows, int nwindows, rule_set *rules) {
+	struct timespec now;
+	char tmp[112];
+	snap_header *file;
+	char *pos;
+	long long size = snapshot_size(reg, nwindows);
+	int fd;
+
+	// The checkpoint found when opening is superseded
+	if (snap->saved != NULL) {
+		munmap(snap->saved, snap->size);
+		snap->saved = NULL;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", snap->path);
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd == -1) {
+		fprintf(stderr, "Checkpoint %s could not be created! Error Code: %d\n", tmp, errno);
+		return 0;
+	}
+	if (ftruncate(fd, size) == -1) {
+		fprintf(stderr, "Checkpoint %s could not be sized! Error Code: %d\n", tmp, errno);
+		close(fd);
+		unlink(tmp);
+		return 0;
+	}
+	file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		fprintf(stderr, "Checkpoint %s could not be mapped! Error Code: %d\n", tmp, errno);
+		unlink(tmp);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	file->magic = SNAPMAGIC;
+	file->session = session;
+	file->epoch = snap->epoch + 1;
+	file->nshards = nshards;
+	file->shard = snap->shard;
+	file->nwindows = nwindows;
+	file->taken = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+	file->reg = *reg;
+	file->reg.slots = NULL;
+	file->reg.buckets = NULL;
+	file->rules = *rules;
+
+	pos = (char *)(file + 1);
+	memcpy(pos, reg->slots, sizeof(device) * reg->capacity);
+	pos += sizeof(device) * reg->capacity;
+	memcpy(pos, reg->buckets, sizeof(int) * reg->nbuckets);
+	pos += sizeof(int) * reg->nbuckets;
+	memcpy(pos, windows, sizeof(window) * nwindows);
+	munmap(file, size);
+
+	// Once renamed the checkpoint holds everything journaled, older entries are skipped
+	if (rename(tmp, snap->path) == -1) {
+		fprintf(stderr, "Checkpoint %s could not be renamed! Error Code: %d\n", tmp, errno);
+		unlink(tmp);
+		return 0;
+	}
+	snap->epoch++;
+	snap->entries = 0;
+	if (ftruncate(snap->journal, 0) == -1) {
+		fprintf(stderr, "Journal %s could not be emptied! Error Code: %d\n", snap->journal_path, errno);
+	}
+	return 1;
+}
+
+int snapshot_restore(snapshot *snap, registry *reg, window *windows, int nwindows) {
+	snap_header *saved = snap->saved;
+	device *slots;
+	int *buckets;
+	char *pos;
+
+	if (saved == NULL) {
+		return 0;
+	}
+	slots = malloc(sizeof(device) * saved->reg.capacity);
+	buckets = malloc(sizeof(int) * saved->reg.nbuckets);
+	if (slots == NULL || buckets == NULL) {
+		fprintf(stderr, "Registry could not be allocated! Error Code: %d\n", errno);
+		free(slots);
+		free(buckets);
+		return 0;
+	}
+
+	// The tables are copied as they were so free slots and handles are too
+	pos = (char *)(saved + 1);
+	memcpy(slots, pos, sizeof(device) * saved->reg.capacity);
+	pos += sizeof(device) * saved->reg.capacity;
+	memcpy(buckets, pos, sizeof(int) * saved->reg.nbuckets);
+	pos += sizeof(int) * saved->reg.nbuckets;
+	memcpy(windows, pos, sizeof(window) * (saved->nwindows < nwindows ? saved->nwindows : nwindows));
+
+	free_registry(reg);
+	*reg = saved->reg;
+	reg->slots = slots;
+	reg->buckets = buckets;
+
+	munmap(snap->saved, snap->size);
+	snap->saved = NULL;
+	return 1;
+}
+
+int snapshot_replay(snapshot *snap, snapshot_apply apply) {
+	journal_entry entries[REPLAYBATCH];
+	off_t offset = 0;
+	ssize_t n;
+	int replayed = 0, i, count;
+
+	while (1) {
+		n = pread(snap->journal, entries, sizeof(entries), offset);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Journal %s could not be read! Error Code: %d\n", snap->journal_path, errno);
+			return -1;
+		}
+
+		// Whatever is left after the last whole entry was cut off by a crash
+		count = n / sizeof(journal_entry);
+		for (i = 0; i < count; i++) {
+			if (entries[i].check != journal_check(&entries[i])) {
+				return replayed;
+			}
+			if (entries[i].epoch != snap->epoch) {
+				continue;
+			}
+			if (!apply(&entries[i])) {
+				return replayed;
+			}
+			replayed++;
+		}
+		if (count < REPLAYBATCH) {
+			return replayed;
+		}
+		offset += n;
+	}
+}
+
+int snapshot_log(snapshot *snap, int op, int slot, proc_info *info) {
+	journal_entry entry;
+	ssize_t n;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.epoch = snap->epoch;
+	entry.op = op;
+	entry.slot = slot;
+	entry.info = *info;
+	entry.check = journal_check(&entry);
+
+	// One write per entry so a crash can only cut off the last one
+	do {
+		n = write(snap->journal, &entry, sizeof(entry));
+	} while (n == -1 && errno == EINTR);
+	if (n != sizeof(entry)) {
+		fprintf(stderr, "Journal %s could not be written! Error Code: %d\n", snap->journal_path, errno);
+		return 0;
+	}
+	snap->entries++;
+	return 1;
+}
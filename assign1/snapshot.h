@@ -0,0 +1,103 @@
+/*
+ * snapshot.h
+ *
+ * Header file for the state each controller worker keeps on disk so a
+ * controller that crashed or was restarted picks up where it left off.
+ * Every SNAPPERIOD milliseconds a worker checkpoints its registry, with the
+ * rule and alarm state of each device, its windows and its rules into a
+ * file of its own. In between, every device registered, removed or moved
+ * to a new PID is appended to the worker's journal before the device is
+ * acknowledged, so no registration is ever lost, only the readings since
+ * the last checkpoint.
+ *
+ * A checkpoint is written under a temporary name and renamed over the last
+ * one, so there is always one whole checkpoint. Each checkpoint starts a
+ * new epoch and the journal is emptied after it, a journal entry from an
+ * older epoch is already in the checkpoint and skipped. Entries carry a
+ * checksum and replaying stops at the first one that was not fully written.
+ *
+ * Restoring maps the checkpoint and copies it straight into the registry
+ * and windows, then replays the journal through the registry in the order
+ * it was written, so every device ends up in the same slot with the same
+ * handle it was acknowledged with. Every slot and link a checkpoint holds
+ * is checked against its tables first, a checkpoint that fails is not
+ * restored. The files are kept in the kernel's page cache as they are
+ * written, so they survive the controller crashing but not the machine.
+ * They are only for the controller's user, in a directory no one else
+ * may use.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <sys/ipc.h>
+#include "message.h"
+#include "registry.h"
+#include "rules.h"
+#include "window.h"
+
+// Directory the files are kept in, and the checkpoint and journal of each
+// worker by the key of the controller's main queue
+#define SNAPDIR "/tmp/iot_state"
+#define SNAPNAME "%s/controller_%x_%d"
+#define JOURNALNAME "%s/controller_%x_%d.journal"
+
+// Marks a file as a checkpoint of this layout
+#define SNAPMAGIC 0x534e4133
+
+// Milliseconds between the checkpoints of a worker that handled something
+#define SNAPPERIOD 2000
+
+// What a journal entry did to the registry
+#define JOURNALADD 1		// Device registered into the slot
+#define JOURNALREMOVE 2		// Device removed from the slot
+#define JOURNALREKEY 3		// Device in the slot moved to the PID in info
+
+// Layout of the start of a checkpoint file. The registry's slots, then its
+// PID table, then the worker's windows follow it
+typedef struct snap_header {
+	unsigned int magic;
+	unsigned int session;	// Session the devices were acknowledged in
+	unsigned int epoch;		// Journal entries of this epoch come after the checkpoint
+	int nshards;			// Workers the devices were sharded over
+	int shard;
+	int nwindows;
+	long long int taken;	// Monotonic milliseconds the checkpoint was taken
+	registry reg;			// Only the counts and lists, its tables follow
+	rule_set rules;			// Rules the devices were attached to and the state of the watches
+} snap_header;
+
+typedef struct journal_entry {
+	unsigned int epoch;
+	int op;
+	int slot;
+	proc_info info;			// Device as it was registered, or its new PID
+	unsigned int check;		// Checksum of everything before it
+} journal_entry;
+
+typedef struct snapshot {
+	char path[96];			// Checkpoint file
+	char journal_path[96];
+	int shard;				// Worker the files are for
+	int journal;			// Journal opened for appending
+	unsigned int epoch;
+	int entries;			// Journal entries written since the checkpoint
+	snap_header *saved;		// Checkpoint found when opened, NULL if none or once restored
+	long long size;			// Bytes mapped at saved
+} snapshot;
+
+// Called with each journal entry replayed, returns 0 to stop the replay
+typedef int (*snapshot_apply)(journal_entry *entry);
+
+extern int open_snapshot(snapshot *snap, const char *dir, key_t key, int shard);
+extern void close_snapshot(snapshot *snap, int keep);
+extern int snapshot_take(snapshot *snap, unsigned int session, int nshards, registry *reg,
+		window *windows, int nwindows, rule_set *rules);
+extern int snapshot_restore(snapshot *snap, registry *reg, window *windows, int nwindows);
+extern int snapshot_replay(snapshot *snap, snapshot_apply apply);
+extern int snapshot_log(snapshot *snap, int op, int slot, proc_info *info);
+
+#endif /* SNAPSHOT_H_ */
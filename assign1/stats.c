@@ -0,0 +1,113 @@
+/*
+ * stats.c
+ *
+ * Prints what a running controller is doing, read from its metrics (see
+ * metrics.h). Does not slow the controller down, it only reads memory the
+ * controller already writes.
+ *
+ *   ./stats message_queue_path [interval_s [count]]
+ *       Every interval seconds (default 1) prints each worker's rates over
+ *       the interval, what it has on hand and how deep its queue is, then
+ *       the parent's totals. Stops after count reports, or runs until the
+ *       controller closes or Ctrl+C when count is left out.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/msg.h>
+#include <sys/shm.h>
+#include "message.h"
+#include "latency.h"
+#include "metrics.h"
+
+// Names of the message types a worker counts, in METRICTYPE order
+const char *type_names[METRICTYPES] = {"init", "quit", "aack", "ring", "data", "fram", "btch"};
+
+/**
+ * Returns how many messages are waiting on a queue, or -1 if it is gone.
+ */
+long queue_depth(int queue) {
+	struct msqid_ds ds;
+
+	if (msgctl(queue, IPC_STAT, &ds) == -1) {
+		return -1;
+	}
+	return ds.msg_qnum;
+}
+
+/**
+ * Prints one worker's rates between two copies of its metrics taken secs apart.
+ */
+void print_worker(int shard, worker_metrics *now, worker_metrics *last, double secs) {
+	int t;
+
+	printf("[STATS] Worker %d (PID %d): %8.0f readings/s %7.0f alarms/s %6.0f actions/s, "
+			"%d devices, %d acks outstanding, queue depth %ld\n", shard, now->pid,
+			(now->readings - last->readings) / secs, (now->alarms - last->alarms) / secs,
+			(now->actions - last->actions) / secs, now->devices, now->outstanding,
+			queue_depth(now->queue));
+	printf("[STATS]   msgs/s");
+	for (t = 0; t < METRICTYPES; t++) {
+		printf(" %s %.0f", type_names[t], (now->messages[t] - last->messages[t]) / secs);
+	}
+	printf(" (lane %.0f)", (now->lane - last->lane) / secs);
+	printf(", suppressed %llu dropped %llu timeouts %llu registered %llu resumed %llu checkpoints %llu"
+			" without window %llu\n", now->suppressed, now->dropped, now->timeouts, now->registered,
+			now->resumed, now->checkpoints, now->unwindowed);
+}
+
+int main(int argc, char *argv[]) {
+	metrics *stats, now, last;
+	long long int taken, before;
+	int interval = 1, count = -1, s;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "[ERROR] Stats takes: message_queue_path [interval_s [count]]\n");
+		exit(INITERR);
+	}
+	if (argc > 2 && (interval = atoi(argv[2])) <= 0) {
+		fprintf(stderr, "[ERROR] Interval must be a positive number of seconds\n");
+		exit(INITERR);
+	}
+	if (argc > 3) {
+		count = atoi(argv[3]);
+	}
+
+	stats = attach_metrics(ftok(argv[1], METRICSPROJ));
+	if (stats == NULL) {
+		exit(SHMERR);
+	}
+	printf("[STATS] Controller %d with %d workers\n", stats->parent, stats->nshards);
+
+	// Rates are the change between two copies, the first over the controller's lifetime
+	memset(&last, 0, sizeof(metrics));
+	before = stats->started;
+	while (count != 0) {
+		sleep(interval);
+
+		// The controller removed its metrics when it closed
+		if (kill(stats->parent, 0) == -1) {
+			printf("[STATS] Controller closed\n");
+			break;
+		}
+		memcpy(&now, stats, sizeof(metrics));
+		taken = latency_now();
+
+		for (s = 0; s < now.nshards; s++) {
+			print_worker(s, &now.workers[s], &last.workers[s], (taken - before) / 1e6);
+		}
+		printf("[STATS] Parent: %llu alarms and %llu aggregates sent to cloud, %d bytes buffered, "
+				"mail queue depth %ld, up %llds\n", now.forwarded, now.aggregates, now.buffered,
+				queue_depth(now.mail), (taken - now.started) / 1000000);
+
+		last = now;
+		before = taken;
+		if (count > 0) {
+			count--;
+		}
+	}
+
+	shmdt(stats);
+	exit(0);
+}
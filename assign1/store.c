@@ -0,0 +1,701 @@
+/*
+ * store.c
+ *
+ * Append only record store used by the cloud and read by the query
+ * tool. Segments are numbered from zero in the store's directory, only
+ * the newest one is ever written and a full one is packed and never
+ * changed again.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "store.h"
+#include "codec.h"
+
+/**
+ * Returns the device index entry to start probing at for a PID.
+ */
+static int hash_pid(pid_t pid) {
+	return ((unsigned int)pid * 2654435761u) & (SEGDEVICES - 1);
+}
+
+/**
+ * Orders packed device table entries on PID.
+ */
+static int compare_devices(const void *a, const void *b) {
+	pid_t x = ((const pack_device *)a)->pid, y = ((const pack_device *)b)->pid;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Adds a mapped segment to the end of the store's list.
+ *
+ * return: 1 on success, 0 if memory could not be allocated
+ */
+static int add_segment(store *st, segment *raw, packed *pack) {
+	store_seg *segs;
+
+	if (st->nsegs == st->capacity) {
+		segs = realloc(st->segs, sizeof(store_seg) * (st->capacity ? st->capacity * 2 : 16));
+		if (segs == NULL) {
+			fprintf(stderr, "Store could not grow past %d segments! Error Code: %d\n", st->nsegs, errno);
+			return 0;
+		}
+		st->segs = segs;
+		st->capacity = st->capacity ? st->capacity * 2 : 16;
+	}
+	st->segs[st->nsegs].raw = raw;
+	st->segs[st->nsegs].pack = pack;
+	st->nsegs++;
+	return 1;
+}
+
+/**
+ * Maps an open segment or packed segment file.
+ *
+ * param fd: File to map, closed before returning since the mapping keeps it.
+ * param size: Bytes in the file.
+ * param writable: Whether the mapping can be written.
+ * return: Mapped file, NULL on failure
+ */
+static void *map_file(int fd, long long size, int writable) {
+	void *file;
+
+	file = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		fprintf(stderr, "Store segment could not be mapped! Error Code: %d\n", errno);
+		return NULL;
+	}
+	return file;
+}
+
+/**
+ * Checks every index a segment holds before it is used: its count, its
+ * device index and each device's chain of records. Every record on a chain
+ * must be older than the one before it, so walking one always ends, and no
+ * more records can be counted on the chains than the segment has. A record
+ * past the count is one the cloud is still writing, or was when it stopped;
+ * a segment opened to be written has those taken off its chains, since the
+ * next record appended takes its place.
+ *
+ * param writable: Whether the segment is opened to be written.
+ * return: 1 if the segment can be used, 0 otherwise
+ */
+static int valid_segment(segment *seg, int writable) {
+	int count = atomic_load(&seg->count), used = 0, counted = 0, h, rec;
+
+	if (count < 0 || count > SEGRECORDS || seg->ndevices < 0 || seg->ndevices >= SEGDEVICES) {
+		return 0;
+	}
+	for (h = 0; h < SEGDEVICES; h++) {
+		if (seg->devices[h].pid == 0) {
+			continue;
+		}
+		used++;
+		for (rec = seg->devices[h].last; rec != -1; rec = seg->prev[rec]) {
+			if (rec < 0 || rec >= SEGRECORDS || seg->prev[rec] >= rec) {
+				return 0;
+			}
+			counted += rec < count;
+		}
+		while (writable && seg->devices[h].last >= count) {
+			seg->devices[h].last = seg->prev[seg->devices[h].last];
+		}
+	}
+
+	// A probe for a PID not in the index stops at an unused entry
+	return used < SEGDEVICES && counted <= count;
+}
+
+/**
+ * Checks a packed segment's table before it is used. Each run's readings
+ * must start inside the file after the table, and are decoded no further
+ * than its end.
+ *
+ * param size: Bytes in the file.
+ * return: 1 if the packed segment can be used, 0 otherwise
+ */
+static int valid_pack(packed *pack, long long size) {
+	long long start;
+	int d;
+
+	if (pack->size != size || pack->ndevices < 0 ||
+			(long long)pack->ndevices > (size - (long long)sizeof(packed)) / (long long)sizeof(pack_device)) {
+		return 0;
+	}
+	start = sizeof(packed) + sizeof(pack_device) * (long long)pack->ndevices;
+	for (d = 0; d < pack->ndevices; d++) {
+		if (pack->devices[d].count < 0 || pack->devices[d].offset < start ||
+				pack->devices[d].offset > size ||
+				(d > 0 && pack->devices[d].pid < pack->devices[d - 1].pid)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Opens and maps a segment file, packed or not.
+ *
+ * param path: File to open.
+ * param magic: Magic number the file must start with.
+ * param writable: Whether the file is opened to be written.
+ * return: Mapped file, NULL if it could not be, with errno ENOENT if it is missing
+ */
+static void *open_file(const char *path, unsigned int magic, int writable) {
+	struct stat info;
+	void *file;
+	int fd;
+
+	fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_NOFOLLOW);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "Store segment %s could not be opened! Error Code: %d\n", path, errno);
+		}
+		return NULL;
+	}
+
+	if (fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(packed) ||
+			(magic == SEGMAGIC && info.st_size != sizeof(segment))) {
+		fprintf(stderr, "Store segment %s is not a segment!\n", path);
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((file = map_file(fd, info.st_size, writable)) == NULL) {
+		return NULL;
+	}
+	if (*(unsigned int *)file != magic ||
+			(magic == SEGMAGIC && !valid_segment(file, writable)) ||
+			(magic == PACKMAGIC && !valid_pack(file, info.st_size))) {
+		fprintf(stderr, "Store segment %s is not a segment!\n", path);
+		munmap(file, info.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return file;
+}
+
+/**
+ * Walks a device's chain in a segment back to its first record.
+ *
+ * param recs: Filled with the device's records oldest first.
+ * return: Number of records
+ */
+static int device_records(segment *seg, pid_t pid, int *recs) {
+	int count = atomic_load(&seg->count), h, rec, n = 0, i, swap;
+
+	for (h = hash_pid(pid); seg->devices[h].pid != pid; h = (h + 1) & (SEGDEVICES - 1));
+	for (rec = seg->devices[h].last; rec != -1; rec = seg->prev[rec]) {
+		if (rec < count) {
+			recs[n++] = rec;
+		}
+	}
+	for (i = 0; i < n / 2; i++) {
+		swap = recs[i];
+		recs[i] = recs[n - 1 - i];
+		recs[n - 1 - i] = swap;
+	}
+	return n;
+}
+
+/**
+ * Returns whether a device's record starts a new run in a packed segment,
+ * which it does when it came from another controller or was another type
+ * than the device's record before it.
+ */
+static int starts_run(segment *seg, int *recs, int n) {
+	return n == 0 || seg->controller[recs[n]] != seg->controller[recs[n - 1]] ||
+			seg->type[recs[n]] != seg->type[recs[n - 1]];
+}
+
+/**
+ * Packs a full segment into its own file. The packed file is written under
+ * a temporary name and renamed, so the store never has half of one. Only
+ * the segment and the store's directory are used, so the packer can do it
+ * while the store is written.
+ *
+ * param i: Number of the segment to pack.
+ * return: 1 on success, 0 on failure
+ */
+static int write_pack(const char *dir, int i, segment *seg) {
+	char path[96], tmp[112];
+	int count = atomic_load(&seg->count), ndevices = 0, nruns = 0, d, h, n, len;
+	pack_device *devs, *run = NULL;
+	packed *pack;
+	encoder enc;
+	int *recs;
+	long long size;
+	int fd, written;
+
+	devs = malloc(sizeof(pack_device) * SEGDEVICES);
+	recs = malloc(sizeof(int) * SEGRECORDS);
+	if (devs == NULL || recs == NULL) {
+		fprintf(stderr, "Store segment %d could not be packed! Error Code: %d\n", i, errno);
+		free(devs);
+		free(recs);
+		return 0;
+	}
+	for (h = 0; h < SEGDEVICES; h++) {
+		if (seg->devices[h].pid != 0) {
+			devs[ndevices++].pid = seg->devices[h].pid;
+		}
+	}
+	qsort(devs, ndevices, sizeof(pack_device), compare_devices);
+	for (d = 0; d < ndevices; d++) {
+		len = device_records(seg, devs[d].pid, recs);
+		for (n = 0; n < len; n++) {
+			nruns += starts_run(seg, recs, n);
+		}
+	}
+
+	// Room for every reading at its largest plus a partly used byte for each
+	// run, only what was used is written
+	size = sizeof(packed) + sizeof(pack_device) * nruns + CODECBYTES(count) + nruns;
+	pack = malloc(size);
+	if (pack == NULL) {
+		fprintf(stderr, "Store segment %d could not be packed! Error Code: %d\n", i, errno);
+		free(devs);
+		free(recs);
+		return 0;
+	}
+
+	// Each run of a device's records from one controller and of one type is
+	// encoded after the one before it
+	size = sizeof(packed) + sizeof(pack_device) * nruns;
+	nruns = 0;
+	for (d = 0; d < ndevices; d++) {
+		len = device_records(seg, devs[d].pid, recs);
+		for (n = 0; n < len; n++) {
+			if (starts_run(seg, recs, n)) {
+				if (run != NULL) {
+					size += encoded_bytes(&enc);
+				}
+				run = &pack->devices[nruns++];
+				run->pid = devs[d].pid;
+				run->controller = seg->controller[recs[n]];
+				run->type = seg->type[recs[n]];
+				run->count = 0;
+				run->first = seg->time[recs[n]];
+				run->offset = size;
+				init_encoder(&enc, (unsigned char *)pack + size, CODECBYTES(len - n));
+			}
+			encode_reading(&enc, seg->time[recs[n]], seg->data[recs[n]]);
+			run->last = seg->time[recs[n]];
+			run->count++;
+		}
+	}
+	if (run != NULL) {
+		size += encoded_bytes(&enc);
+	}
+	free(devs);
+	free(recs);
+
+	pack->magic = PACKMAGIC;
+	pack->count = count;
+	pack->ndevices = nruns;
+	pack->first = seg->first;
+	pack->last = seg->last;
+	pack->size = size;
+
+	sprintf(path, PACKNAME, dir, i);
+	sprintf(tmp, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd == -1) {
+		fprintf(stderr, "Store segment %s could not be created! Error Code: %d\n", tmp, errno);
+		free(pack);
+		return 0;
+	}
+	written = write(fd, pack, size);
+	free(pack);
+	if (written != size || fsync(fd) == -1 || rename(tmp, path) == -1) {
+		fprintf(stderr, "Store segment %s could not be written! Error Code: %d\n", path, errno);
+		close(fd);
+		unlink(tmp);
+		return 0;
+	}
+	close(fd);
+	return 1;
+}
+
+/**
+ * Swaps a segment whose packed file is in place for the packed file, and
+ * removes the segment file.
+ *
+ * param i: Segment packed.
+ * return: 1 on success, 0 on failure
+ */
+static int swap_pack(store *st, int i) {
+	char path[96];
+
+	// Readers holding the segment keep their mapping after it is removed
+	munmap(st->segs[i].raw, sizeof(segment));
+	st->segs[i].raw = NULL;
+	sprintf(path, SEGNAME, st->dir, i);
+	unlink(path);
+
+	sprintf(path, PACKNAME, st->dir, i);
+	st->segs[i].pack = open_file(path, PACKMAGIC, 0);
+	return st->segs[i].pack != NULL;
+}
+
+/**
+ * Packs a segment and swaps it for its packed file while the caller waits.
+ *
+ * param i: Segment to pack.
+ * return: 1 on success, 0 on failure
+ */
+static int pack_segment(store *st, int i) {
+	return write_pack(st->dir, i, st->segs[i].raw) && swap_pack(st, i);
+}
+
+/**
+ * Packer thread, packs the segment the store handed it.
+ */
+static void *run_packer(void *arg) {
+	store *st = arg;
+
+	atomic_store(&st->packed, write_pack(st->dir, st->packing, st->packing_seg) ? 1 : -1);
+	return NULL;
+}
+
+/**
+ * Waits for the packer to finish the segment it was handed and swaps the
+ * segment for its packed file. A segment that could not be packed stays as
+ * it is and is packed again the next time the store is opened.
+ */
+static void finish_pack(store *st) {
+	if (st->packing == -1) {
+		return;
+	}
+	pthread_join(st->packer, NULL);
+	if (atomic_load(&st->packed) != 1 || !swap_pack(st, st->packing)) {
+		fprintf(stderr, "Store segment %d left unpacked until the store is opened again\n",
+				st->packing);
+	}
+	st->packing = -1;
+}
+
+/**
+ * Hands a full segment to the packer, so the disk writes and compression
+ * happen off the thread appending records. Only one segment is packed at a
+ * time, one handed over while the last is still packing waits for it. The
+ * segment is packed right away if no packer can be started.
+ *
+ * param i: Segment to pack.
+ * return: 1 on success, 0 on failure
+ */
+static int start_pack(store *st, int i) {
+	sigset_t all, old;
+	int err;
+
+	finish_pack(st);
+	st->packing = i;
+	st->packing_seg = st->segs[i].raw;
+	atomic_store(&st->packed, 0);
+
+	// The packer takes no signals, they must still interrupt the process's waits
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&st->packer, NULL, run_packer, st);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		st->packing = -1;
+		return pack_segment(st, i);
+	}
+	return 1;
+}
+
+/**
+ * Creates the next segment file and makes it the one written to. The
+ * segment written until now is full and is handed to the packer.
+ *
+ * return: 1 on success, 0 on failure
+ */
+static int new_segment(store *st) {
+	char path[96];
+	segment *seg;
+	int fd;
+
+	if (st->nsegs > 0 && st->segs[st->nsegs - 1].raw != NULL && !start_pack(st, st->nsegs - 1)) {
+		return 0;
+	}
+
+	sprintf(path, SEGNAME, st->dir, st->nsegs);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	if (fd == -1) {
+		fprintf(stderr, "Store segment %s could not be created! Error Code: %d\n", path, errno);
+		return 0;
+	}
+
+	// A new file reads as zeros, so only the header needs filling in
+	if (ftruncate(fd, sizeof(segment)) == -1) {
+		fprintf(stderr, "Store segment %s could not be sized! Error Code: %d\n", path, errno);
+		close(fd);
+		return 0;
+	}
+	if ((seg = map_file(fd, sizeof(segment), 1)) == NULL) {
+		return 0;
+	}
+	seg->magic = SEGMAGIC;
+	atomic_init(&seg->count, 0);
+
+	if (!add_segment(st, seg, NULL)) {
+		munmap(seg, sizeof(segment));
+		return 0;
+	}
+	return 1;
+}
+
+int open_store(store *st, const char *dir, int writable) {
+	struct stat info;
+	char path[96];
+	segment *raw;
+	packed *pack;
+	int i;
+
+	snprintf(st->dir, sizeof(st->dir), "%s", dir);
+	st->writable = writable;
+	st->segs = NULL;
+	st->nsegs = 0;
+	st->capacity = 0;
+	st->packing = -1;
+
+	if (writable && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Store directory %s could not be created! Error Code: %d\n", dir, errno);
+		return 0;
+	}
+
+	// Another user could have made it first to plant or read segments. A
+	// store nothing was written to yet is empty
+	if (lstat(dir, &info) == -1) {
+		if (!writable && errno == ENOENT) {
+			return 1;
+		}
+		fprintf(stderr, "Store directory %s could not be checked! Error Code: %d\n", dir, errno);
+		return 0;
+	}
+	if (!S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077) != 0) {
+		fprintf(stderr, "Store directory %s is not a private directory of this user!\n", dir);
+		return 0;
+	}
+
+	// Map every segment already there, stopping at the first number missing
+	while (1) {
+		raw = NULL;
+		sprintf(path, PACKNAME, dir, st->nsegs);
+		pack = open_file(path, PACKMAGIC, 0);
+		if (pack != NULL) {
+			// A segment left behind by a cloud stopped part way through packing it
+			sprintf(path, SEGNAME, dir, st->nsegs);
+			if (writable) {
+				unlink(path);
+			}
+		} else if (errno == ENOENT) {
+			sprintf(path, SEGNAME, dir, st->nsegs);
+			raw = open_file(path, SEGMAGIC, writable);
+			if (raw == NULL && errno == ENOENT) {
+				break;
+			}
+		}
+
+		if ((raw == NULL && pack == NULL) || !add_segment(st, raw, pack)) {
+			close_store(st);
+			return 0;
+		}
+	}
+
+	// Only the newest segment is written, pack any older one the cloud did not
+	for (i = 0; writable && i < st->nsegs - 1; i++) {
+		if (st->segs[i].raw != NULL && !pack_segment(st, i)) {
+			close_store(st);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void close_store(store *st) {
+	int i;
+
+	finish_pack(st);
+	for (i = 0; i < st->nsegs; i++) {
+		if (st->segs[i].raw != NULL) {
+			if (st->writable) {
+				msync(st->segs[i].raw, sizeof(segment), MS_SYNC);
+			}
+			munmap(st->segs[i].raw, sizeof(segment));
+		} else if (st->segs[i].pack != NULL) {
+			munmap(st->segs[i].pack, st->segs[i].pack->size);
+		}
+	}
+	free(st->segs);
+	st->segs = NULL;
+	st->nsegs = 0;
+	st->capacity = 0;
+}
+
+int store_append(store *st, proc_info *pinfo, pid_t controller, long long time) {
+	segment *seg = st->nsegs > 0 ? st->segs[st->nsegs - 1].raw : NULL;
+	seg_device *dev;
+	int rec, h;
+
+	// Swap in the last segment packed once the packer is done with it
+	if (st->packing != -1 && atomic_load_explicit(&st->packed, memory_order_acquire) != 0) {
+		finish_pack(st);
+	}
+
+	// Start a new segment once the newest is out of records or device entries
+	if (seg == NULL || atomic_load_explicit(&seg->count, memory_order_relaxed) == SEGRECORDS ||
+			seg->ndevices >= SEGDEVICES / 4 * 3) {
+		if (!new_segment(st)) {
+			return 0;
+		}
+		seg = st->segs[st->nsegs - 1].raw;
+	}
+	rec = atomic_load_explicit(&seg->count, memory_order_relaxed);
+
+	for (h = hash_pid(pinfo->pid); seg->devices[h].pid != 0 && seg->devices[h].pid != pinfo->pid;
+			h = (h + 1) & (SEGDEVICES - 1));
+	dev = &seg->devices[h];
+	if (dev->pid == 0) {
+		dev->pid = pinfo->pid;
+		dev->count = 0;
+		dev->last = -1;
+		seg->ndevices++;
+	}
+
+	seg->time[rec] = time;
+	seg->device[rec] = pinfo->pid;
+	seg->controller[rec] = controller;
+	seg->data[rec] = pinfo->data;
+	seg->type[rec] = pinfo->device;
+	seg->prev[rec] = dev->last;
+	dev->last = rec;
+	dev->count++;
+
+	if (rec == 0) {
+		seg->first = time;
+	}
+	seg->last = time;
+
+	// Readers only look at records below the count, so publish the record last
+	atomic_store_explicit(&seg->count, rec + 1, memory_order_release);
+	return 1;
+}
+
+/**
+ * Hands back the records of a device in a segment still being written.
+ *
+ * param hits: Room for a segment's records.
+ * return: Number of records found
+ */
+static int query_raw(segment *seg, pid_t pid, long long from, long long to,
+		store_visit visit, int *hits) {
+	store_record record;
+	int count = atomic_load_explicit(&seg->count, memory_order_acquire);
+	int h, rec, nhits = 0, found = 0;
+
+	if (count == 0 || seg->last < from || seg->first > to) {
+		return 0;
+	}
+
+	for (h = hash_pid(pid); seg->devices[h].pid != 0 && seg->devices[h].pid != pid;
+			h = (h + 1) & (SEGDEVICES - 1));
+	if (seg->devices[h].pid == 0) {
+		return 0;
+	}
+
+	// Walk the device's chain newest first, skipping records still being
+	// written and stopping at the first one older than the range
+	for (rec = seg->devices[h].last; rec != -1 && (rec >= count || seg->time[rec] >= from);
+			rec = seg->prev[rec]) {
+		if (rec < count && seg->time[rec] <= to) {
+			hits[nhits++] = rec;
+		}
+	}
+
+	while (nhits > 0) {
+		rec = hits[--nhits];
+		record.time = seg->time[rec];
+		record.device = seg->device[rec];
+		record.controller = seg->controller[rec];
+		record.data = seg->data[rec];
+		record.type = seg->type[rec];
+		visit(&record);
+		found++;
+	}
+	return found;
+}
+
+/**
+ * Hands back the records of a device in a packed segment, decoding only
+ * that device's readings and stopping past the end of the range.
+ *
+ * return: Number of records found
+ */
+static int query_pack(packed *pack, pid_t pid, long long from, long long to, store_visit visit) {
+	pack_device key, *dev;
+	store_record record;
+	decoder dec;
+	int found = 0;
+
+	if (pack->last < from || pack->first > to) {
+		return 0;
+	}
+
+	// The device's runs are next to each other, oldest first
+	key.pid = pid;
+	dev = bsearch(&key, pack->devices, pack->ndevices, sizeof(pack_device), compare_devices);
+	if (dev == NULL) {
+		return 0;
+	}
+	while (dev > pack->devices && (dev - 1)->pid == pid) {
+		dev--;
+	}
+
+	for (; dev < pack->devices + pack->ndevices && dev->pid == pid && dev->first <= to; dev++) {
+		if (dev->last < from) {
+			continue;
+		}
+		record.device = dev->pid;
+		record.controller = dev->controller;
+		record.type = dev->type;
+		init_decoder(&dec, (unsigned char *)pack + dev->offset, pack->size - dev->offset, dev->count);
+		while (decode_reading(&dec, &record.time, &record.data) && record.time <= to) {
+			if (record.time >= from) {
+				visit(&record);
+				found++;
+			}
+		}
+	}
+	return found;
+}
+
+int store_query(store *st, pid_t pid, long long from, long long to, store_visit visit) {
+	int *hits, i, found = 0;
+
+	hits = malloc(sizeof(int) * SEGRECORDS);
+	if (hits == NULL) {
+		fprintf(stderr, "Store query could not be allocated! Error Code: %d\n", errno);
+		return -1;
+	}
+
+	for (i = 0; i < st->nsegs; i++) {
+		if (st->segs[i].raw != NULL) {
+			found += query_raw(st->segs[i].raw, pid, from, to, visit, hits);
+		} else if (st->segs[i].pack != NULL) {
+			found += query_pack(st->segs[i].pack, pid, from, to, visit);
+		}
+	}
+
+	free(hits);
+	return found;
+}
@@ -0,0 +1,138 @@
+/*
+ * store.h
+ *
+ * Header file for the cloud's record store. Every alarm the cloud takes
+ * in is appended to a segment file that is mapped into memory, so storing
+ * a record is a few writes to memory and the kernel writes the pages out.
+ *
+ * A segment keeps each field of its records in its own column, and holds
+ * a small index with the newest record of every device in it. Each record
+ * points back to the device's record before it in the same segment, so
+ * the readings of one device can be walked newest first without looking
+ * at anyone else's. Segments also keep the times of their first and last
+ * records so a query skips every segment outside its time range.
+ *
+ * Records are stored in the order they arrive and timed with the cloud's
+ * clock when they do, so times only go forward within a device's chain.
+ * The store's directory and files are only for the cloud's user, and every
+ * index a segment holds is checked when it is opened.
+ *
+ * Once a segment is full it is packed into a file of its own, with the
+ * readings of each device compressed one after the other (see codec.h)
+ * behind a table of the devices sorted on PID, and the segment file is
+ * removed. A device's readings are split into runs from one controller and
+ * of one type, each with its own table entry keeping those once, since a
+ * PID can be reused by another device or reach the cloud through another
+ * controller. Packing compresses and writes the whole segment, so the
+ * store hands it to a packer thread and carries on appending to the next
+ * segment; the full segment is swapped for its packed file on the first
+ * append after the packer is done.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "message.h"
+
+// Directory segment files are kept in, and the name of each segment
+#define STOREDIR "/tmp/cloud_store"
+#define SEGNAME "%s/seg_%06d"
+#define PACKNAME "%s/seg_%06d.z"
+
+// Marks a file as a segment or packed segment of this layout
+#define SEGMAGIC 0x53454731
+#define PACKMAGIC 0x53455a31
+
+// Records in a segment before a new one is started
+#define SEGRECORDS 65536
+
+// Devices a segment can index, must be a power of two. A segment is
+// closed early once three quarters of these are used
+#define SEGDEVICES 4096
+
+// Newest record of a device in a segment and how many it has there
+typedef struct seg_device {
+	pid_t pid;		// 0 while the entry is unused
+	int count;
+	int last;
+} seg_device;
+
+// Layout of a segment file, each column holds one field of every record
+typedef struct segment {
+	unsigned int magic;
+	atomic_int count;			// Records written, a record is complete before it counts
+	int ndevices;				// Entries of the device index in use
+	long long first;			// Time of the first record
+	long long last;				// Time of the last record
+	seg_device devices[SEGDEVICES];	// Open addressed on PID
+	long long time[SEGRECORDS];		// Milliseconds since the epoch the record arrived
+	pid_t device[SEGRECORDS];		// PID of the device that raised the alarm
+	pid_t controller[SEGRECORDS];	// PID of the controller that sent it
+	int data[SEGRECORDS];
+	int prev[SEGRECORDS];			// Device's record before this one, -1 for none
+	char type[SEGRECORDS];			// Device type character
+} segment;
+
+// Entry of a run of a device's records in a packed segment's table
+typedef struct pack_device {
+	pid_t pid;
+	pid_t controller;
+	char type;
+	int count;
+	long long first;		// Time of the run's first record
+	long long last;			// Time of the run's last record
+	long long offset;		// Bytes from the start of the file to its readings
+} pack_device;
+
+// Layout of a packed segment file, the readings follow the device table
+typedef struct packed {
+	unsigned int magic;
+	int count;
+	int ndevices;				// Runs in the table
+	long long first;
+	long long last;
+	long long size;				// Bytes in the file
+	pack_device devices[];		// Sorted on PID, a device's runs oldest first
+} packed;
+
+// Segment of the store, only one of the two is mapped
+typedef struct store_seg {
+	segment *raw;		// Segment still being written, NULL once packed
+	packed *pack;		// Packed segment, NULL until the segment is full
+} store_seg;
+
+typedef struct store {
+	char dir[64];
+	int writable;
+	store_seg *segs;	// Every segment mapped, oldest first
+	int nsegs;
+	int capacity;		// Entries allocated in segs
+	pthread_t packer;
+	int packing;			// Segment handed to the packer, -1 if none
+	segment *packing_seg;
+	atomic_int packed;		// Set by the packer when done, 1 if packed and -1 if not
+} store;
+
+// Record as a query hands it back
+typedef struct store_record {
+	long long time;
+	pid_t device;
+	pid_t controller;
+	int data;
+	char type;
+} store_record;
+
+// Called with each record a query finds, oldest first
+typedef void (*store_visit)(store_record *rec);
+
+extern int open_store(store *st, const char *dir, int writable);
+extern void close_store(store *st);
+extern int store_append(store *st, proc_info *pinfo, pid_t controller, long long time);
+extern int store_query(store *st, pid_t pid, long long from, long long to, store_visit visit);
+
+#endif /* STORE_H_ */
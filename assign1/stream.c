@@ -0,0 +1,135 @@
+/*
+ * stream.c
+ *
+ * Writes and parses the framed stream between the controller and the
+ * cloud. The writer sends a header and its records with one writev and
+ * keeps anything the FIFO did not take. The reader fills its buffer with
+ * large reads and hands back one whole frame at a time.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/uio.h>
+#include "stream.h"
+
+void init_stream(stream *strm, int fd) {
+	strm->fd = fd;
+	strm->len = 0;
+}
+
+/**
+ * Keeps the part of the data that was not written in the buffer.
+ *
+ * param data: Data the write was given.
+ * param len: Bytes in the data.
+ * param written: Bytes the write took.
+ */
+static void hold(stream *strm, void *data, int len, int written) {
+	if (written < len) {
+		memcpy(strm->buf + strm->len, (char *)data + written, len - written);
+		strm->len += len - written;
+	}
+}
+
+int stream_send(stream *strm, int type, void *records, int count, int size) {
+	stream_header header;
+	struct iovec iov[2];
+	ssize_t written;
+	int length = count * size;
+
+	header.magic = STREAMMAGIC;
+	header.type = type;
+	header.count = count;
+	header.length = length;
+	if (length > STREAMMAXLEN || stream_full(strm)) {
+		fprintf(stderr, "[ERROR] Frame of %d bytes does not fit the stream\n", length);
+		return 0;
+	}
+
+	// Data already waiting has to go first, queue the frame behind it
+	if (strm->len > 0) {
+		hold(strm, &header, sizeof(header), 0);
+		hold(strm, records, length, 0);
+		return stream_flush(strm);
+	}
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = records;
+	iov[1].iov_len = length;
+	written = writev(strm->fd, iov, 2);
+	if (written == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			return 0;
+		}
+		written = 0;
+	}
+
+	// Keep whatever the FIFO had no room for
+	if (written < (ssize_t)sizeof(header)) {
+		hold(strm, &header, sizeof(header), written);
+		hold(strm, records, length, 0);
+	} else {
+		hold(strm, records, length, written - sizeof(header));
+	}
+	return 1;
+}
+
+int stream_flush(stream *strm) {
+	ssize_t written;
+
+	if (strm->len == 0) {
+		return 1;
+	}
+
+	written = write(strm->fd, strm->buf, strm->len);
+	if (written == -1) {
+		return errno == EAGAIN || errno == EINTR;
+	}
+	memmove(strm->buf, strm->buf + written, strm->len - written);
+	strm->len -= written;
+	return 1;
+}
+
+int stream_full(stream *strm) {
+	return strm->len + (int)sizeof(stream_header) + STREAMMAXLEN > STREAMBUFSIZ;
+}
+
+int stream_read(stream *strm) {
+	ssize_t nread = read(strm->fd, strm->buf + strm->len, STREAMBUFSIZ - strm->len);
+
+	if (nread > 0) {
+		strm->len += nread;
+	}
+	return nread;
+}
+
+char *stream_next(stream *strm, stream_header *header, int *offset) {
+	int left, start = *offset;
+
+	// Skip forward to the next magic number if we are out of step
+	while (*offset + (int)sizeof(stream_header) <= strm->len) {
+		memcpy(header, strm->buf + *offset, sizeof(stream_header));
+		if (header->magic == STREAMMAGIC && header->length <= STREAMMAXLEN) {
+			break;
+		}
+		(*offset)++;
+	}
+	if (*offset != start) {
+		fprintf(stderr, "[ERROR] Stream out of step, skipped %d bytes\n", *offset - start);
+	}
+
+	left = strm->len - *offset - (int)sizeof(stream_header);
+	if (left < 0 || left < (int)header->length) {
+		return NULL;
+	}
+
+	*offset += sizeof(stream_header) + header->length;
+	return strm->buf + *offset - header->length;
+}
+
+void stream_consume(stream *strm, int offset) {
+	memmove(strm->buf, strm->buf + offset, strm->len - offset);
+	strm->len -= offset;
+}
@@ -0,0 +1,61 @@
+/*
+ * stream.h
+ *
+ * Header file for the framed stream the controller sends to the cloud
+ * over a FIFO. Each frame is a header followed by count records
+ * of the same type, so many records go out in one write and the cloud
+ * can take many of them out of one read.
+ *
+ * Controllers say hello on the server FIFO with a frame small enough to be
+ * written atomically, then send everything else on their own client FIFO.
+ *
+ * The writing side never blocks. Whatever the FIFO won't take right away
+ * waits in the stream's buffer, and the writer must stop producing frames
+ * while stream_full() is true. This is how the controller passes a slow
+ * cloud's backpressure back to the child.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "message.h"
+
+// Marks the start of every frame so a reader can tell it is in step
+#define STREAMMAGIC 0x53595343
+
+// Types of record a frame can carry
+#define STREAMALRM 1	// proc_info of an alarm the controller dealt with
+#define STREAMHELO 2	// pid_t of a controller that made its client FIFO
+#define STREAMAGGR 3	// aggregate of a sensor's window of readings
+
+// Bytes buffered on each side of the stream
+#define STREAMBUFSIZ 65536
+
+// Largest frame payload, a frame always fits in a buffer with its header
+#define STREAMMAXLEN (STREAMBUFSIZ / 4)
+
+typedef struct stream_header {
+	unsigned int magic;
+	unsigned short type;
+	unsigned short count;
+	unsigned int length;	// Bytes of records following the header
+} stream_header;
+
+typedef struct stream {
+	int fd;
+	int len;				// Bytes held in the buffer
+	char buf[STREAMBUFSIZ];
+} stream;
+
+extern void init_stream(stream *strm, int fd);
+extern int stream_send(stream *strm, int type, void *records, int count, int size);
+extern int stream_flush(stream *strm);
+extern int stream_full(stream *strm);
+extern int stream_read(stream *strm);
+extern char *stream_next(stream *strm, stream_header *header, int *offset);
+extern void stream_consume(stream *strm, int offset);
+
+#endif /* STREAM_H_ */
@@ -0,0 +1,143 @@
+/*
+ * test_codec.c
+ *
+ * Unit tests for the reading codec. Readings are checked to take the bits
+ * codec.h gives them at the edges of each size and to decode to what was
+ * encoded. Run by 'make test'.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "codec.h"
+
+/**
+ * Encodes a single reading, which is against a time and data of zero, and
+ * decodes it back.
+ *
+ * return: Bits the reading took
+ */
+static long long one_reading(long long time, int data) {
+	unsigned char buf[CODECBYTES(1)];
+	long long t;
+	int d;
+	encoder enc;
+	decoder dec;
+
+	init_encoder(&enc, buf, sizeof(buf));
+	assert(encode_reading(&enc, time, data));
+	init_decoder(&dec, buf, encoded_bytes(&enc), 1);
+	assert(decode_reading(&dec, &t, &d) && t == time && d == data);
+	assert(!decode_reading(&dec, &t, &d));
+	return enc.bits;
+}
+
+/**
+ * Each delta of delta size ends where codec.h says, with unchanged data
+ * taking a single bit.
+ */
+static void test_dod() {
+	assert(one_reading(0, 0) == 2);
+	assert(one_reading(63, 0) == 10 && one_reading(-64, 0) == 10);
+	assert(one_reading(64, 0) == 13 && one_reading(-65, 0) == 13);
+	assert(one_reading(255, 0) == 13 && one_reading(-256, 0) == 13);
+	assert(one_reading(256, 0) == 17 && one_reading(-257, 0) == 17);
+	assert(one_reading(2047, 0) == 17 && one_reading(-2048, 0) == 17);
+	assert(one_reading(2048, 0) == 69 && one_reading(-2049, 0) == 69);
+	assert(one_reading(LLONG_MAX, 0) == 69 && one_reading(LLONG_MIN, 0) == 69);
+}
+
+/**
+ * Each data difference size ends where codec.h says, after the single bit
+ * of an unchanged time.
+ */
+static void test_data() {
+	assert(one_reading(0, 31) == 9 && one_reading(0, -32) == 9);
+	assert(one_reading(0, 32) == 17 && one_reading(0, -33) == 17);
+	assert(one_reading(0, 4095) == 17 && one_reading(0, -4096) == 17);
+	assert(one_reading(0, 4096) == 36 && one_reading(0, -4097) == 36);
+	assert(one_reading(0, INT_MAX) == 36 && one_reading(0, INT_MIN) == 36);
+}
+
+/**
+ * Streams of readings decode to what was encoded, whether their times keep
+ * a steady period, wander at each size's edges or jump by 64 bits, and
+ * their data swings across the whole range.
+ */
+static void test_stream() {
+	long long jumps[] = {0, 1, -1, 63, -64, 64, -65, 255, -256, 256, -257, 2047, -2048, 2048,
+			-2049, 1LL << 40, -(1LL << 40), LLONG_MAX / 4, LLONG_MIN / 4};
+	int njumps = sizeof(jumps) / sizeof(jumps[0]);
+	static long long times[4096];
+	static int datas[4096];
+	static unsigned char buf[CODECBYTES(4096)];
+	long long t, delta = 1000;
+	int i, d;
+	encoder enc;
+	decoder dec;
+
+	srand(1);
+	times[0] = 1LL << 50;
+	for (i = 0; i < 4096; i++) {
+		if (i > 0) {
+			delta += jumps[rand() % njumps] * (i % 3 == 0);
+			times[i] = times[i - 1] + delta;
+		}
+		datas[i] = i % 7 == 0 ? (int)((unsigned int)rand() << 1) : rand() % 100 - 50;
+	}
+
+	init_encoder(&enc, buf, sizeof(buf));
+	for (i = 0; i < 4096; i++) {
+		assert(encode_reading(&enc, times[i], datas[i]));
+	}
+	init_decoder(&dec, buf, encoded_bytes(&enc), 4096);
+	for (i = 0; i < 4096; i++) {
+		assert(decode_reading(&dec, &t, &d) && t == times[i] && d == datas[i]);
+	}
+	assert(!decode_reading(&dec, &t, &d));
+}
+
+/**
+ * An encoder stops before a reading that might not fit, and a decoder
+ * given fewer bytes than its readings took stops at the first reading that
+ * runs past them.
+ */
+static void test_ends() {
+	unsigned char buf[CODECBYTES(2)];
+	long long t;
+	int d;
+	encoder enc;
+	decoder dec;
+
+	init_encoder(&enc, buf, CODECBYTES(1));
+	assert(encode_reading(&enc, 1LL << 40, INT_MIN));
+	assert(!encode_reading(&enc, 0, 0) && enc.count == 1);
+
+	// The longest reading there is ends in the 13th byte
+	assert(enc.bits == CODECMAXBITS);
+	init_decoder(&dec, buf, 12, 1);
+	assert(!decode_reading(&dec, &t, &d));
+	init_decoder(&dec, buf, 13, 1);
+	assert(decode_reading(&dec, &t, &d) && t == 1LL << 40 && d == INT_MIN);
+
+	// A count past the readings written finds the end of the bytes
+	init_encoder(&enc, buf, sizeof(buf));
+	assert(encode_reading(&enc, 5, 5));
+	init_decoder(&dec, buf, encoded_bytes(&enc), INT_MAX);
+	assert(decode_reading(&dec, &t, &d) && t == 5 && d == 5);
+	while (decode_reading(&dec, &t, &d));
+	assert(dec.left == 0 && dec.bits <= encoded_bytes(&enc) * 8 + 1);
+}
+
+int main() {
+	test_dod();
+	test_data();
+	test_stream();
+	test_ends();
+	printf("[TEST] codec passed\n");
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * test_limit.c
+ *
+ * Unit tests for the alarm and action limits. Times are made up
+ * milliseconds rather than read from the clock. Run by 'make test'.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <assert.h>
+#include "limit.h"
+
+/**
+ * The first alarm of a batch is raised and the rest are suppressed, and no
+ * alarm is raised again until the quiet period has passed in full.
+ */
+static void test_quiet() {
+	alarm_limit lim;
+
+	limit_reset(&lim);
+	assert(limit_alarms(&lim, 100, 0, 0, 4) == 0 && !lim.active);
+	assert(limit_alarms(&lim, 100, 10, 0xc, 4) == 0x4 && lim.active && lim.suppressed == 1);
+	assert(limit_alarms(&lim, 100, 109, 0x1, 4) == 0 && !lim.active && lim.suppressed == 2);
+	assert(limit_alarms(&lim, 100, 110, 0xa, 4) == 0x2 && lim.active && lim.suppressed == 3);
+	assert(lim.last == 110);
+
+	// The last reading of the batch decides whether the sensor is in alarm
+	assert(limit_alarms(&lim, 100, 300, 1ULL << 63, 64) == 1ULL << 63 && lim.active);
+	assert(limit_alarms(&lim, 100, 300, 0, 64) == 0 && !lim.active);
+
+	// Without a quiet period every batch raises its first alarm
+	limit_reset(&lim);
+	assert(limit_alarms(&lim, 0, 0, 0x3, 2) == 0x1);
+	assert(limit_alarms(&lim, 0, 0, 0x3, 2) == 0x1 && lim.suppressed == 2);
+}
+
+/**
+ * A bucket starts full, fills at its rate up to its burst and drops the
+ * actions it has no token for.
+ */
+static void test_bucket() {
+	action_limit limit = {10, 2}, none = {0, 1};
+	bucket bkt;
+
+	bucket_reset(&bkt, &limit, 0);
+	assert(bucket_take(&bkt, &limit, 0) && bucket_take(&bkt, &limit, 0));
+	assert(!bucket_take(&bkt, &limit, 0) && bkt.dropped == 1);
+
+	// A token takes 100 milliseconds at 10 a second
+	assert(!bucket_take(&bkt, &limit, 99) && bkt.dropped == 2);
+	assert(bucket_take(&bkt, &limit, 100));
+	assert(!bucket_take(&bkt, &limit, 100));
+
+	// A long wait fills the bucket to its burst and no more
+	assert(bucket_take(&bkt, &limit, 100000) && bucket_take(&bkt, &limit, 100000));
+	assert(!bucket_take(&bkt, &limit, 100000));
+
+	// A rate of 0 never drops
+	bucket_reset(&bkt, &none, 0);
+	assert(bucket_take(&bkt, &none, 0) && bucket_take(&bkt, &none, 0) && bkt.dropped == 0);
+}
+
+int main() {
+	test_quiet();
+	test_bucket();
+	printf("[TEST] limit passed\n");
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * test_rules.c
+ *
+ * Unit tests for the alarm rules. Rules are compiled from lines the way a
+ * rule file holds them, and readings are checked against them one at a time
+ * and a batch at a time. Run by 'make test'.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <assert.h>
+#include "rules.h"
+
+/**
+ * Compiles a rule line into the set. Compiling splits up the line, so a
+ * copy is compiled.
+ *
+ * return: 1 if the rule was added, 0 if it is not valid
+ */
+static int add(rule_set *set, const char *line) {
+	char copy[128];
+
+	snprintf(copy, sizeof(copy), "%s", line);
+	return rules_add(set, copy);
+}
+
+/**
+ * Checks readings one at a time.
+ *
+ * return: Mask with bit i set if reading i left the sensor in alarm
+ */
+static unsigned long long check_each(rule_set *set, int r, rule_state *state, long int threshold,
+		const int *data, int count) {
+	unsigned long long alarms = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		alarms |= rules_check(set, r, state, threshold, data + i, 1) << i;
+	}
+	return alarms;
+}
+
+/**
+ * A sensor without a rule is in alarm above its own threshold, not at it.
+ */
+static void test_default() {
+	int data[] = {20, 21, 19, 100};
+	rule_set set;
+	rule_state state;
+	int r;
+
+	init_rules(&set);
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(r == 0);
+	assert(rules_check(&set, r, &state, 20, data, 4) == 0xa);
+}
+
+/**
+ * A rule for a sensor's name wins over one for its type, and a level of
+ * 'threshold' is the sensor's own.
+ */
+static void test_attach() {
+	int data[] = {26, 31};
+	rule_set set;
+	rule_state state;
+	int r;
+
+	init_rules(&set);
+	assert(add(&set, "temp above threshold"));
+	assert(add(&set, "s1 above 25"));
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(r == 2);
+	assert(rules_check(&set, r, &state, 30, data, 2) == 0x3);
+	r = rules_attach(&set, &state, "s2", TEMP_SENSOR_TYPE);
+	assert(r == 1);
+	assert(rules_check(&set, r, &state, 30, data, 2) == 0x2);
+	assert(rules_attach(&set, &state, "s3", SMOKE_SENSOR_TYPE) == 0);
+}
+
+/**
+ * Once breached, a sensor with a 'below' level stays in alarm until its data
+ * falls below that level, reaching it is not enough.
+ */
+static void test_below() {
+	int data[] = {25, 26, 20, 16, 15, 14, 20, 26};
+	rule_set set;
+	rule_state state;
+	int r;
+
+	init_rules(&set);
+	assert(add(&set, "s1 above 25 below 15"));
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, 8) == 0x9e);
+
+	// The hold carries over from one batch to the next
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, 2) == 0x2);
+	assert(rules_check(&set, r, &state, 0, data + 2, 3) == 0x7);
+	assert(rules_check(&set, r, &state, 0, data + 5, 3) == 0x4);
+}
+
+/**
+ * A rise rule compares each reading to the one before it, across batches,
+ * and the first reading a sensor sends has not risen. A 'below' level only
+ * applies to a level the data itself is above, so it can't be combined
+ * with a rise.
+ */
+static void test_rise() {
+	int data[] = {10, 16, 21, 20, 26}, next[] = {32, 37};
+	rule_set set;
+	rule_state state;
+	int r;
+
+	init_rules(&set);
+	assert(add(&set, "s1 rise 5"));
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, 5) == 0x12);
+	assert(rules_check(&set, r, &state, 0, next, 2) == 0x1);
+
+	assert(!add(&set, "s2 rise 5 below 3"));
+	assert(!add(&set, "s2 above 5 below 3 rise 2"));
+	assert(set.count == 2);
+}
+
+/**
+ * Count rules need N breaches in the last M readings. With M of 64 the
+ * window covers a whole batch and a breach drops out of it 64 readings on.
+ */
+static void test_count() {
+	int data[MAXBATCH], i;
+	rule_set set;
+	rule_state state;
+	int r;
+
+	init_rules(&set);
+	assert(add(&set, "s1 above 10 count 64 of 64"));
+	assert(add(&set, "s2 above 10 count 2 of 64"));
+	assert(!add(&set, "s3 above 10 count 2 of 65"));
+	assert(!add(&set, "s3 above 10 count 3 of 2"));
+	assert(!add(&set, "s3 above 10 count 0 of 4"));
+	assert(set.count == 3);
+
+	// Every one of the last 64 readings must breach
+	for (i = 0; i < MAXBATCH; i++) {
+		data[i] = 11;
+	}
+	r = rules_attach(&set, &state, "s1", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, MAXBATCH) == 1ULL << 63);
+	assert(rules_check(&set, r, &state, 0, data, 1) == 1);
+	data[0] = 10;
+	assert(rules_check(&set, r, &state, 0, data, MAXBATCH) == 0);
+	assert(rules_check(&set, r, &state, 0, data + 1, 1) == 1);
+
+	// Breaches 63 readings apart are both in the window, 64 apart they are not
+	for (i = 0; i < MAXBATCH; i++) {
+		data[i] = i == 0 || i == 63 ? 11 : 0;
+	}
+	r = rules_attach(&set, &state, "s2", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, MAXBATCH) == 1ULL << 63);
+	assert(rules_check(&set, r, &state, 0, data + 1, 62) == 0);
+	assert(rules_check(&set, r, &state, 0, data, 1) == 1);
+
+	rules_attach(&set, &state, "s2", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r, &state, 0, data, MAXBATCH - 1) == 0);
+	assert(rules_check(&set, r, &state, 0, data + 1, 1) == 0);
+	assert(rules_check(&set, r, &state, 0, data, 1) == 0);
+}
+
+/**
+ * A combined rule only alarms while its partner's last reading left it in
+ * alarm.
+ */
+static void test_and() {
+	int high[] = {11}, low[] = {5};
+	rule_set set;
+	rule_state one, two;
+	int r1, r2;
+
+	init_rules(&set);
+	assert(add(&set, "s1 above 10"));
+	assert(add(&set, "s2 above 10 and s1"));
+	r1 = rules_attach(&set, &one, "s1", TEMP_SENSOR_TYPE);
+	r2 = rules_attach(&set, &two, "s2", TEMP_SENSOR_TYPE);
+	assert(rules_check(&set, r2, &two, 0, high, 1) == 0);
+	assert(rules_check(&set, r1, &one, 0, high, 1) == 1);
+	assert(rules_check(&set, r2, &two, 0, high, 1) == 1);
+	assert(rules_check(&set, r1, &one, 0, low, 1) == 0);
+	assert(rules_check(&set, r2, &two, 0, high, 1) == 0);
+}
+
+/**
+ * Actuator limit lines set their type's rate and burst.
+ */
+static void test_limit_lines() {
+	rule_set set;
+
+	init_rules(&set);
+	assert(add(&set, "ac limit 5 burst 2"));
+	assert(add(&set, "bell limit 0"));
+	assert(!add(&set, "ac limit 5 burst 0"));
+	assert(!add(&set, "temp limit 5"));
+	assert(rules_limit(&set, AC_ACTUATOR_TYPE)->rate == 5);
+	assert(rules_limit(&set, AC_ACTUATOR_TYPE)->burst == 2);
+	assert(rules_limit(&set, BELL_ACTUATOR_TYPE)->rate == 0);
+	assert(set.count == 1);
+}
+
+/**
+ * Checking a batch at a time raises the same alarms as checking its
+ * readings one at a time, for every kind of rule and for short batches.
+ */
+static void test_batches() {
+	const char *kinds[] = {"s1 above threshold", "s2 above 25 below 15", "s3 rise 5",
+			"s4 above 20 count 3 of 5", "s5 rise 3 count 2 of 64"};
+	int nkinds = sizeof(kinds) / sizeof(kinds[0]);
+	int data[MAXBATCH * 64], i, j, r, len;
+	rule_set set;
+	rule_state one, batch;
+	char name[4];
+
+	srand(1);
+	for (i = 0; i < MAXBATCH * 64; i++) {
+		data[i] = rand() % 40;
+	}
+	init_rules(&set);
+	for (i = 0; i < nkinds; i++) {
+		assert(add(&set, kinds[i]));
+	}
+
+	for (i = 0; i < nkinds; i++) {
+		sprintf(name, "s%d", i + 1);
+		r = rules_attach(&set, &one, name, TEMP_SENSOR_TYPE);
+		rules_attach(&set, &batch, name, TEMP_SENSOR_TYPE);
+		for (j = 0; j < MAXBATCH * 64; j += len) {
+			len = 1 + j % MAXBATCH;
+			len = j + len > MAXBATCH * 64 ? MAXBATCH * 64 - j : len;
+			assert(rules_check(&set, r, &batch, 20, data + j, len) ==
+					check_each(&set, r, &one, 20, data + j, len));
+		}
+	}
+}
+
+int main() {
+	test_default();
+	test_attach();
+	test_below();
+	test_rise();
+	test_count();
+	test_and();
+	test_limit_lines();
+	test_batches();
+	printf("[TEST] rules passed\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * test_window.c
+ *
+ * Unit tests for the sliding windows. Readings are added to a window and
+ * its aggregates are checked against the readings it should hold. Run by
+ * 'make test'.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include "window.h"
+
+window *win;
+
+/**
+ * Starts the window over for a made up sensor.
+ */
+static void attach() {
+	proc_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.pid = 1;
+	info.device = TEMP_SENSOR_TYPE;
+	strcpy(info.name, "s1");
+	window_attach(win, &info);
+}
+
+/**
+ * Fills the window with n readings of one value.
+ */
+static void fill(int value, int n) {
+	int data[WINDOWSIZE], i;
+
+	for (i = 0; i < n; i++) {
+		data[i] = value;
+	}
+	window_add(win, data, n);
+}
+
+/**
+ * Returns the median and 90th percentile of the window.
+ */
+static void percentiles(int *p50, int *p90) {
+	aggregate agg;
+
+	assert(window_read(win, &agg));
+	*p50 = agg.p50;
+	*p90 = agg.p90;
+}
+
+/**
+ * A window only has aggregates while it is attached and has readings, and
+ * keeps them under the sensor's new PID when it moves.
+ */
+static void test_attach() {
+	aggregate agg;
+
+	attach();
+	assert(!window_read(win, &agg));
+	fill(5, 1);
+	assert(window_read(win, &agg) && agg.pid == 1 && agg.count == 1 && strcmp(agg.name, "s1") == 0);
+	window_rekey(win, 2);
+	assert(window_read(win, &agg) && agg.pid == 2 && agg.count == 1);
+	window_detach(win);
+	assert(!window_read(win, &agg));
+}
+
+/**
+ * The mean, minimum and maximum follow the last WINDOWSIZE readings as the
+ * window slides, one reading at a time and in batches.
+ */
+static void test_sliding() {
+	int data[WINDOWSIZE * 40], i, j, len, min, max;
+	long long sum;
+	aggregate agg;
+
+	srand(1);
+	for (i = 0; i < WINDOWSIZE * 40; i++) {
+		data[i] = rand() % 40;
+	}
+	attach();
+	for (i = 0; i < WINDOWSIZE * 40; i += len) {
+		len = 1 + i % WINDOWSIZE;
+		len = i + len > WINDOWSIZE * 40 ? WINDOWSIZE * 40 - i : len;
+		window_add(win, data + i, len);
+
+		min = INT_MAX;
+		max = INT_MIN;
+		sum = 0;
+		for (j = i + len - WINDOWSIZE < 0 ? 0 : i + len - WINDOWSIZE; j < i + len; j++) {
+			min = data[j] < min ? data[j] : min;
+			max = data[j] > max ? data[j] : max;
+			sum += data[j];
+		}
+		assert(window_read(win, &agg));
+		assert(agg.count == (i + len < WINDOWSIZE ? i + len : WINDOWSIZE));
+		assert(agg.min == min && agg.max == max && agg.mean == (double)sum / agg.count);
+		assert(agg.p50 >= min && agg.p90 <= max && agg.p50 <= agg.p90);
+	}
+
+	// A minimum and maximum that left the window are gone from it
+	attach();
+	fill(100, WINDOWSIZE);
+	fill(1, WINDOWSIZE);
+	assert(window_read(win, &agg) && agg.min == 1 && agg.max == 1 && agg.mean == 1);
+}
+
+/**
+ * Percentiles land on the start of the histogram bucket holding them,
+ * exact below 16 and within an eighth above, and never outside the
+ * window's readings.
+ */
+static void test_buckets() {
+	int data[WINDOWSIZE], p50, p90, i;
+
+	// Each value below 16 has a bucket of its own, 16 and 17 share one
+	attach();
+	fill(15, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == 15 && p90 == 15);
+	attach();
+	fill(16, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == 16 && p90 == 16);
+	attach();
+	fill(17, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == 17 && p90 == 17);
+
+	// The median is the bucket where half the readings are reached
+	attach();
+	fill(15, WINDOWSIZE / 2);
+	fill(16, WINDOWSIZE / 2);
+	percentiles(&p50, &p90);
+	assert(p50 == 15 && p90 == 16);
+	attach();
+	fill(15, WINDOWSIZE / 2 - 1);
+	fill(16, WINDOWSIZE / 2 + 1);
+	percentiles(&p50, &p90);
+	assert(p50 == 16 && p90 == 16);
+
+	// 0 to 63 once each, the 32nd reading is in the bucket of 30 and 31 and
+	// the 58th in the bucket of 56 to 59
+	for (i = 0; i < WINDOWSIZE; i++) {
+		data[i] = i;
+	}
+	attach();
+	window_add(win, data, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == 30 && p90 == 56);
+
+	// The ends of the range
+	attach();
+	fill(INT_MAX, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == INT_MAX && p90 == INT_MAX);
+	attach();
+	fill(-5, WINDOWSIZE);
+	percentiles(&p50, &p90);
+	assert(p50 == -5 && p90 == -5);
+}
+
+int main() {
+	win = create_windows(1);
+	assert(win != NULL);
+	test_attach();
+	test_sliding();
+	test_buckets();
+	printf("[TEST] window passed\n");
+	return 0;
+}
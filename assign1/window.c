@@ -0,0 +1,160 @@
+/*
+ * window.c
+ *
+ * Sliding windows of sensor readings, written by a controller worker and
+ * read by the controller's parent.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#include <sys/mman.h>
+#include "window.h"
+
+/**
+ * Returns the histogram bucket for a reading.
+ */
+static int bucket(int value) {
+	int top;
+
+	if (value < 16) {
+		return value < 0 ? 0 : value;
+	}
+	top = 31 - __builtin_clz(value);
+	return 16 + (top - 4) * 8 + ((value >> (top - 3)) & 7);
+}
+
+/**
+ * Returns the smallest reading that falls in a histogram bucket.
+ */
+static int bucket_start(int b) {
+	if (b < 16) {
+		return b;
+	}
+	return (8 + (b - 16) % 8) << ((b - 16) / 8 + 1);
+}
+
+window *create_windows(int capacity) {
+	window *windows;
+
+	// Shared with the processes forked after, which is every worker and the parent.
+	// Pages are only backed once a window on them is used
+	windows = mmap(NULL, sizeof(window) * capacity, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (windows == MAP_FAILED) {
+		fprintf(stderr, "Windows could not be mapped! Error Code: %d\n", errno);
+		return NULL;
+	}
+	return windows;
+}
+
+void window_attach(window *win, proc_info *info) {
+	atomic_fetch_add(&win->lock, 1);
+	win->pid = info->pid;
+	strcpy(win->name, info->name);
+	win->type = info->device;
+	win->count = 0;
+	win->sum = 0;
+	win->minh = win->minn = win->maxh = win->maxn = 0;
+	memset(win->hist, 0, sizeof(win->hist));
+	atomic_fetch_add(&win->lock, 1);
+}
+
+void window_detach(window *win) {
+	atomic_fetch_add(&win->lock, 1);
+	win->pid = 0;
+	atomic_fetch_add(&win->lock, 1);
+}
+
+void window_rekey(window *win, pid_t pid) {
+	atomic_fetch_add(&win->lock, 1);
+	win->pid = pid;
+	atomic_fetch_add(&win->lock, 1);
+}
+
+void window_add(window *win, const int *data, int count) {
+	unsigned int n;
+	int i, v;
+
+	atomic_fetch_add(&win->lock, 1);
+	for (i = 0; i < count; i++) {
+		n = win->count++;
+		v = data[i];
+
+		// Readings leaving the window leave the queue fronts before their place is reused
+		if (win->minn > 0 && win->minq[win->minh] + WINDOWSIZE <= n) {
+			win->minh = (win->minh + 1) % WINDOWSIZE;
+			win->minn--;
+		}
+		if (win->maxn > 0 && win->maxq[win->maxh] + WINDOWSIZE <= n) {
+			win->maxh = (win->maxh + 1) % WINDOWSIZE;
+			win->maxn--;
+		}
+		if (n >= WINDOWSIZE) {
+			win->sum -= win->data[n % WINDOWSIZE];
+			win->hist[bucket(win->data[n % WINDOWSIZE])]--;
+		}
+
+		win->data[n % WINDOWSIZE] = v;
+		win->sum += v;
+		win->hist[bucket(v)]++;
+
+		// Readings behind the new one that can no longer be the minimum or maximum
+		while (win->minn > 0 &&
+				win->data[win->minq[(win->minh + win->minn - 1) % WINDOWSIZE] % WINDOWSIZE] >= v) {
+			win->minn--;
+		}
+		win->minq[(win->minh + win->minn++) % WINDOWSIZE] = n;
+		while (win->maxn > 0 &&
+				win->data[win->maxq[(win->maxh + win->maxn - 1) % WINDOWSIZE] % WINDOWSIZE] <= v) {
+			win->maxn--;
+		}
+		win->maxq[(win->maxh + win->maxn++) % WINDOWSIZE] = n;
+	}
+	atomic_fetch_add(&win->lock, 1);
+}
+
+int window_read(window *win, aggregate *agg) {
+	static window copy;
+	unsigned int before;
+	int n, b, seen, p50 = -1;
+
+	// Copy the window while its worker leaves it alone
+	do {
+		while ((before = atomic_load(&win->lock)) & 1);
+		memcpy(&copy, win, sizeof(window));
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load(&win->lock) != before);
+
+	if (copy.pid == 0 || copy.count == 0) {
+		return 0;
+	}
+	n = copy.count < WINDOWSIZE ? copy.count : WINDOWSIZE;
+
+	agg->pid = copy.pid;
+	strcpy(agg->name, copy.name);
+	agg->type = copy.type;
+	agg->count = n;
+	agg->mean = (double)copy.sum / n;
+	agg->min = copy.data[copy.minq[copy.minh] % WINDOWSIZE];
+	agg->max = copy.data[copy.maxq[copy.maxh] % WINDOWSIZE];
+
+	// Walk the histogram to the bucket holding each percentile's reading
+	for (b = 0, seen = 0; b < WINDOWBUCKETS; b++) {
+		seen += copy.hist[b];
+		if (p50 == -1 && seen * 2 >= n) {
+			p50 = bucket_start(b);
+		}
+		if (seen * 10 >= n * 9) {
+			agg->p90 = bucket_start(b);
+			break;
+		}
+	}
+	agg->p50 = p50;
+
+	// The histogram only has the start of a bucket and puts readings below 0 in
+	// the bucket of 0, keep it within the window
+	agg->p50 = agg->p50 < agg->min ? agg->min : agg->p50 > agg->max ? agg->max : agg->p50;
+	agg->p90 = agg->p90 < agg->min ? agg->min : agg->p90 > agg->max ? agg->max : agg->p90;
+	return 1;
+}
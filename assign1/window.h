@@ -0,0 +1,75 @@
+/*
+ * window.h
+ *
+ * Header file for the sliding windows the controller keeps over each
+ * sensor's latest readings. A window holds the last WINDOWSIZE readings in
+ * a ring with their running sum, a monotonic queue each for the minimum
+ * and maximum, and a histogram for percentiles, so adding a reading takes
+ * the same few steps however long the window is.
+ *
+ * Each worker keeps its windows in a slab of shared memory, indexed by
+ * the sensor's registry slot, which the parent reads from to forward the
+ * aggregates to the cloud. A window's lock is odd while its worker is
+ * changing it, and a reader copies the window again if the lock was odd
+ * or moved while it copied.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: Nicolas McCallum 100936816
+ */
+
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+#include <stdatomic.h>
+#include "message.h"
+
+// Readings in a window
+#define WINDOWSIZE 64
+
+// Windows each worker reserves in its slab. Only the windows up to the
+// worker's registry capacity are used, so only their pages are touched,
+// and sensors in later registry slots have none and are counted
+#define WINDOWSLOTS 65536
+
+// Histogram buckets, one for each value below 16 then eight for each power
+// of two above, so percentiles are within an eighth of the value
+#define WINDOWBUCKETS (16 + 27 * 8)
+
+typedef struct window {
+	atomic_uint lock;
+	pid_t pid;				// Sensor the window is for, 0 for none
+	char name[25];
+	char type;
+	unsigned int count;		// Readings ever added
+	long long sum;			// Sum of the readings in the window
+	unsigned char minh;		// Head and length of the minimum queue
+	unsigned char minn;
+	unsigned char maxh;		// Head and length of the maximum queue
+	unsigned char maxn;
+	int data[WINDOWSIZE];	// Reading number n is at n % WINDOWSIZE
+	unsigned int minq[WINDOWSIZE];	// Reading numbers with rising data
+	unsigned int maxq[WINDOWSIZE];	// Reading numbers with falling data
+	unsigned char hist[WINDOWBUCKETS];
+} window;
+
+// Aggregates of one window, as the cloud is sent them
+typedef struct aggregate {
+	pid_t pid;
+	char name[25];
+	char type;
+	int count;			// Readings in the window
+	int min;
+	int max;
+	int p50;
+	int p90;
+	double mean;
+} aggregate;
+
+extern window *create_windows(int capacity);
+extern void window_attach(window *win, proc_info *info);
+extern void window_detach(window *win);
+extern void window_rekey(window *win, pid_t pid);
+extern void window_add(window *win, const int *data, int count);
+extern int window_read(window *win, aggregate *agg);
+
+#endif /* WINDOW_H_ */